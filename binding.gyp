@@ -1,16 +1,61 @@
 {
+  "variables": {
+    "rpio_core_sources": [
+      "source/rpio.c",
+      "source/c_gpio.c",
+      "source/cpuinfo.c",
+      "source/event_fd.c",
+      "source/event_gpio.c",
+      "source/event_trace.c",
+      "source/event_loadgen.c",
+      "source/sequence.c",
+      "source/soft_pwm.c",
+      "source/thread_sched.c",
+      "source/timing.c"
+    ]
+  },
   "targets": [
+    {
+      "target_name": "librpio",
+      "product_name": "rpio",
+      "product_prefix": "lib",
+      "type": "static_library",
+      "sources": [ "<@(rpio_core_sources)" ],
+      "cflags": [ "-fPIC" ],
+      "direct_dependent_settings": {
+        "include_dirs": [ "source" ]
+      },
+      "link_settings": {
+        "libraries": [ "-lpthread" ]
+      }
+    },
+    {
+      "target_name": "librpio_shared",
+      "product_name": "rpio",
+      "product_prefix": "lib",
+      "type": "shared_library",
+      "sources": [ "<@(rpio_core_sources)" ],
+      "ldflags": [
+        "-Wl,--version-script=<(module_root_dir)/source/rpio.map"
+      ],
+      "direct_dependent_settings": {
+        "include_dirs": [ "source" ]
+      },
+      "link_settings": {
+        "libraries": [ "-lpthread" ]
+      }
+    },
     {
       "target_name": "rpio",
+      "dependencies": [ "librpio" ],
       "sources": [
         "source/node_gpio.cc",
         "source/node_common.cc",
         "source/node_constants.cc",
         "source/node_pwm.cc",
-        "source/c_gpio.c",
-        "source/cpuinfo.c",
-        "source/event_gpio.c",
-        "source/soft_pwm.c"
+        "source/node_event.cc",
+        "source/node_pin.cc",
+        "source/node_sequence.cc"
         ]
     }
   ]
@@ -0,0 +1,43 @@
+"""Build the RPi._GPIO Python module against librpio, the C core that the
+Node addon also links (see binding.gyp)"""
+
+import re
+
+from setuptools import setup, Extension
+
+# the library version is kept in the public header
+with open('source/rpio.h') as f:
+    header = f.read()
+version = '.'.join(re.search(r'#define RPIO_VERSION_%s (\d+)' % part, header).group(1)
+                   for part in ('MAJOR', 'MINOR', 'PATCH'))
+
+rpio_core_sources = [
+    'source/rpio.c',
+    'source/c_gpio.c',
+    'source/cpuinfo.c',
+    'source/event_fd.c',
+    'source/event_gpio.c',
+    'source/event_trace.c',
+    'source/event_loadgen.c',
+    'source/sequence.c',
+    'source/soft_pwm.c',
+    'source/thread_sched.c',
+    'source/timing.c',
+]
+
+setup(
+    name='RPIO',
+    version=version,
+    description='RPIO is an advanced GPIO module for the Raspberry Pi.',
+    license='MIT',
+    url='https://github.com/rodjbs/RPIO',
+    libraries=[('rpio', {'sources': rpio_core_sources})],
+    ext_modules=[Extension('RPi._GPIO',
+                           ['source/py_gpio.c', 'source/common.c', 'source/constants.c',
+                            'source/py_pwm.c', 'source/py_pin.c'],
+                           # common.h defines its globals in the header
+                           extra_compile_args=['-fcommon'],
+                           libraries=['pthread'])],
+    package_dir={'': 'source'},
+    py_modules=['gpio_asyncio'],
+)
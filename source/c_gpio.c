@@ -20,6 +20,7 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 
+#include <pthread.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -27,10 +28,12 @@ SOFTWARE.
 #include <sys/mman.h>
 #include <string.h>
 #include "c_gpio.h"
+#include "timing.h"
 
 #define BCM2708_PERI_BASE_DEFAULT   0x20000000
 #define BCM2709_PERI_BASE_DEFAULT   0x3f000000
 #define GPIO_BASE_OFFSET            0x200000
+#define ST_BASE_OFFSET              0x3000
 #define FSEL_OFFSET                 0   // 0x0000
 #define SET_OFFSET                  7   // 0x001c / 4
 #define CLR_OFFSET                  10  // 0x0028 / 4
@@ -46,15 +49,47 @@ SOFTWARE.
 #define PAGE_SIZE  (4*1024)
 #define BLOCK_SIZE (4*1024)
 
+// set-up and hold time for the pull up/down control signal: 150 cycles of
+// the 250MHz core clock is 600ns, with some margin
+#define SHORT_WAIT_NS 1000
+
 static volatile uint32_t *gpio_map;
+static volatile uint32_t *st_map = MAP_FAILED;
+
+// pins whose pull up/down has been set by this process, per pull value
+static uint32_t pud_state[3][2];
+
+/* Locks for the registers changed by read-modify-write, so callers on
+   different threads can configure pins at the same time.  The write-1-to-
+   clear event status registers only affect the bits written and need no
+   lock.  Each function select register covers 10 pins and each event enable
+   register one bank; the pull up/down sequence drives one control register
+   for every pin, so it has a single lock, which also guards pud_state.  SET
+   and CLR writes of a bank go with an update of its out_shadow, under
+   out_lock.  None of them is held while taking another. */
+static pthread_mutex_t fsel_lock[6] = {
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER,
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER };
+static pthread_mutex_t pud_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t detect_lock[2] = {
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER };
+static pthread_mutex_t out_lock[2] = {
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER };
+
+// board state when the registers were first mapped
+static struct gpio_snapshot boot_state;
+
+/* Levels last written to the output latches, per bank, so outputs can be
+   read back and toggled without a read of the level register.  It changes
+   together with the SET and CLR writes under out_lock, so two threads
+   toggling or writing a bank leave the latches and the shadow agreeing;
+   readers load it without the lock.  Pins becoming outputs load it from the
+   level register once, as the latch cannot be read. */
+static uint32_t out_shadow[2];
 
 void short_wait(void)
 {
-    int i;
-
-    for (i=0; i<150; i++) {    // wait 150 cycles
-        asm volatile("nop");
-    }
+    busy_wait_ns(SHORT_WAIT_NS);
 }
 
 int setup(void)
@@ -76,6 +111,9 @@ int setup(void)
         if ((uint32_t)gpio_map < 0) {
             return SETUP_MMAP_FAIL;
         } else {
+            snapshot_take(&boot_state);
+            out_shadow[0] = boot_state.level[0];
+            out_shadow[1] = boot_state.level[1];
             return SETUP_OK;
         }
     }
@@ -130,6 +168,17 @@ int setup(void)
     if ((uint32_t)gpio_map < 0)
         return SETUP_MMAP_FAIL;
 
+    // the system timer is cheaper to poll in waits than the vDSO clock; it is
+    // mapped once and kept, see cleanup()
+    if (st_map == MAP_FAILED) {
+        st_map = (uint32_t *)mmap(NULL, BLOCK_SIZE, PROT_READ, MAP_SHARED, mem_fd, peri_base + ST_BASE_OFFSET);
+        if (st_map != MAP_FAILED)
+            timing_use_systimer(st_map);
+    }
+
+    snapshot_take(&boot_state);
+    out_shadow[0] = boot_state.level[0];
+    out_shadow[1] = boot_state.level[1];
     return SETUP_OK;
 }
 
@@ -138,9 +187,8 @@ void clear_event_detect(int gpio)
     int offset = EVENT_DETECT_OFFSET + (gpio/32);
     int shift = (gpio%32);
 
-    *(gpio_map+offset) |= (1 << shift);
-    short_wait();
-    *(gpio_map+offset) = 0;
+    // write 1 to clear, leaving the events latched on other pins
+    *(gpio_map+offset) = (1 << shift);
 }
 
 int eventdetected(int gpio)
@@ -160,10 +208,12 @@ void set_rising_event(int gpio, int enable)
     int offset = RISING_ED_OFFSET + (gpio/32);
     int shift = (gpio%32);
 
+    pthread_mutex_lock(&detect_lock[gpio/32]);
     if (enable)
         *(gpio_map+offset) |= 1 << shift;
     else
         *(gpio_map+offset) &= ~(1 << shift);
+    pthread_mutex_unlock(&detect_lock[gpio/32]);
     clear_event_detect(gpio);
 }
 
@@ -172,12 +222,12 @@ void set_falling_event(int gpio, int enable)
     int offset = FALLING_ED_OFFSET + (gpio/32);
     int shift = (gpio%32);
 
-    if (enable) {
+    pthread_mutex_lock(&detect_lock[gpio/32]);
+    if (enable)
         *(gpio_map+offset) |= (1 << shift);
-        *(gpio_map+offset) = (1 << shift);
-    } else {
+    else
         *(gpio_map+offset) &= ~(1 << shift);
-    }
+    pthread_mutex_unlock(&detect_lock[gpio/32]);
     clear_event_detect(gpio);
 }
 
@@ -186,10 +236,12 @@ void set_high_event(int gpio, int enable)
     int offset = HIGH_DETECT_OFFSET + (gpio/32);
     int shift = (gpio%32);
 
+    pthread_mutex_lock(&detect_lock[gpio/32]);
     if (enable)
         *(gpio_map+offset) |= (1 << shift);
     else
         *(gpio_map+offset) &= ~(1 << shift);
+    pthread_mutex_unlock(&detect_lock[gpio/32]);
     clear_event_detect(gpio);
 }
 
@@ -198,17 +250,28 @@ void set_low_event(int gpio, int enable)
     int offset = LOW_DETECT_OFFSET + (gpio/32);
     int shift = (gpio%32);
 
+    pthread_mutex_lock(&detect_lock[gpio/32]);
     if (enable)
         *(gpio_map+offset) |= 1 << shift;
     else
         *(gpio_map+offset) &= ~(1 << shift);
+    pthread_mutex_unlock(&detect_lock[gpio/32]);
     clear_event_detect(gpio);
 }
 
-void set_pullupdn(int gpio, int pud)
+static void set_pullupdn_mask(int pud, uint32_t mask0, uint32_t mask1)
 {
-    int clk_offset = PULLUPDNCLK_OFFSET + (gpio/32);
-    int shift = (gpio%32);
+    int i;
+
+    pthread_mutex_lock(&pud_lock);
+    for (i=PUD_OFF; i<=PUD_UP; i++) {
+        pud_state[i][0] &= ~mask0;
+        pud_state[i][1] &= ~mask1;
+    }
+    if (pud != PUD_DOWN && pud != PUD_UP)
+        pud = PUD_OFF;
+    pud_state[pud][0] |= mask0;
+    pud_state[pud][1] |= mask1;
 
     if (pud == PUD_DOWN)
         *(gpio_map+PULLUPDN_OFFSET) = (*(gpio_map+PULLUPDN_OFFSET) & ~3) | PUD_DOWN;
@@ -218,10 +281,49 @@ void set_pullupdn(int gpio, int pud)
         *(gpio_map+PULLUPDN_OFFSET) &= ~3;
 
     short_wait();
-    *(gpio_map+clk_offset) = 1 << shift;
+    if (mask0)
+        *(gpio_map+PULLUPDNCLK_OFFSET) = mask0;
+    if (mask1)
+        *(gpio_map+PULLUPDNCLK_OFFSET+1) = mask1;
     short_wait();
     *(gpio_map+PULLUPDN_OFFSET) &= ~3;
-    *(gpio_map+clk_offset) = 0;
+    if (mask0)
+        *(gpio_map+PULLUPDNCLK_OFFSET) = 0;
+    if (mask1)
+        *(gpio_map+PULLUPDNCLK_OFFSET+1) = 0;
+    pthread_mutex_unlock(&pud_lock);
+}
+
+void set_pullupdn(int gpio, int pud)
+{
+    if (gpio < 32)
+        set_pullupdn_mask(pud, 1 << gpio, 0);
+    else
+        set_pullupdn_mask(pud, 0, 1 << (gpio-32));
+}
+
+// the SET and CLR writes of a bank and its shadow; CLR is written last, so
+// a pin in both masks ends up low in the latch and the shadow alike
+static void write_bank(int bank, uint32_t set, uint32_t clr)
+{
+    pthread_mutex_lock(&out_lock[bank]);
+    __atomic_store_n(&out_shadow[bank], (out_shadow[bank] | set) & ~clr, __ATOMIC_RELAXED);
+    if (set)
+        *(gpio_map+SET_OFFSET+bank) = set;
+    if (clr)
+        *(gpio_map+CLR_OFFSET+bank) = clr;
+    pthread_mutex_unlock(&out_lock[bank]);
+}
+
+// load the shadow of the pins in mask from the level register
+void sync_output_state(int bank, uint32_t mask)
+{
+    uint32_t level;
+
+    pthread_mutex_lock(&out_lock[bank]);
+    level = *(gpio_map+PINLEVEL_OFFSET+bank);
+    __atomic_store_n(&out_shadow[bank], (out_shadow[bank] & ~mask) | (level & mask), __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&out_lock[bank]);
 }
 
 void setup_gpio(int gpio, int direction, int pud)
@@ -230,10 +332,170 @@ void setup_gpio(int gpio, int direction, int pud)
     int shift = (gpio%10)*3;
 
     set_pullupdn(gpio, pud);
+    pthread_mutex_lock(&fsel_lock[gpio/10]);
     if (direction == OUTPUT)
         *(gpio_map+offset) = (*(gpio_map+offset) & ~(7<<shift)) | (1<<shift);
     else  // direction == INPUT
         *(gpio_map+offset) = (*(gpio_map+offset) & ~(7<<shift));
+    pthread_mutex_unlock(&fsel_lock[gpio/10]);
+
+    if (direction == OUTPUT)
+        sync_output_state(gpio/32, 1 << (gpio%32));
+}
+
+/* Batched configuration: collect the changes for many pins, then apply
+   them with one write per register and one pull up/down clock sequence
+   per pull value */
+void txn_begin(struct gpio_txn *txn)
+{
+    memset(txn, 0, sizeof(struct gpio_txn));
+}
+
+void txn_setup_gpio(struct gpio_txn *txn, int gpio, int direction, int pud)
+{
+    int reg = gpio/10;
+    int shift = (gpio%10)*3;
+    int i;
+
+    txn->fsel_mask[reg] |= 7 << shift;
+    txn->fsel_value[reg] &= ~(7 << shift);
+    if (direction == OUTPUT)
+        txn->fsel_value[reg] |= 1 << shift;
+
+    for (i=PUD_OFF; i<=PUD_UP; i++)
+        txn->pud[i][gpio/32] &= ~(1 << (gpio%32));
+    if (pud >= PUD_OFF && pud <= PUD_UP)
+        txn->pud[pud][gpio/32] |= 1 << (gpio%32);
+}
+
+void txn_output_gpio(struct gpio_txn *txn, int gpio, int value)
+{
+    if (value) {
+        txn->set[gpio/32] |= 1 << (gpio%32);
+        txn->clr[gpio/32] &= ~(1 << (gpio%32));
+    } else {
+        txn->clr[gpio/32] |= 1 << (gpio%32);
+        txn->set[gpio/32] &= ~(1 << (gpio%32));
+    }
+}
+
+void txn_commit(struct gpio_txn *txn)
+{
+    uint32_t outputs[2] = {0, 0};
+    int gpio, shift, i;
+
+    // initial levels first, so outputs come up at the right level
+    for (i=0; i<2; i++)
+        if (txn->set[i] || txn->clr[i])
+            write_bank(i, txn->set[i], txn->clr[i]);
+
+    for (i=PUD_OFF; i<=PUD_UP; i++)
+        if (txn->pud[i][0] || txn->pud[i][1])
+            set_pullupdn_mask(i, txn->pud[i][0], txn->pud[i][1]);
+
+    for (i=0; i<6; i++) {
+        if (txn->fsel_mask[i]) {
+            pthread_mutex_lock(&fsel_lock[i]);
+            *(gpio_map+FSEL_OFFSET+i) = (*(gpio_map+FSEL_OFFSET+i) & ~txn->fsel_mask[i]) | txn->fsel_value[i];
+            pthread_mutex_unlock(&fsel_lock[i]);
+        }
+    }
+
+    for (gpio=0; gpio<54; gpio++) {
+        shift = (gpio%10)*3;
+        if (((txn->fsel_mask[gpio/10] >> shift) & 7) && ((txn->fsel_value[gpio/10] >> shift) & 7) == 1)
+            outputs[gpio/32] |= 1 << (gpio%32);
+    }
+    for (i=0; i<2; i++)
+        if (outputs[i])
+            sync_output_state(i, outputs[i]);
+}
+
+/* Whole board snapshot: read every function select, level, event detect
+   enable and the pull state known to this process in one pass */
+void snapshot_take(struct gpio_snapshot *snap)
+{
+    int i;
+
+    snap->magic = SNAPSHOT_MAGIC;
+    for (i=0; i<6; i++)
+        snap->fsel[i] = *(gpio_map+FSEL_OFFSET+i);
+    for (i=0; i<2; i++) {
+        snap->level[i] = *(gpio_map+PINLEVEL_OFFSET+i);
+        snap->rising[i] = *(gpio_map+RISING_ED_OFFSET+i);
+        snap->falling[i] = *(gpio_map+FALLING_ED_OFFSET+i);
+        snap->high[i] = *(gpio_map+HIGH_DETECT_OFFSET+i);
+        snap->low[i] = *(gpio_map+LOW_DETECT_OFFSET+i);
+    }
+    pthread_mutex_lock(&pud_lock);
+    memcpy(snap->pud, pud_state, sizeof(pud_state));
+    pthread_mutex_unlock(&pud_lock);
+}
+
+static uint32_t merge(uint32_t reg, uint32_t value, uint32_t mask)
+{
+    return (reg & ~mask) | (value & mask);
+}
+
+/* Reapply a snapshot to the pins in mask0 (gpio 0-31) and mask1 (gpio
+   32-53) with one write per register.  Pins with no pull in the snapshot
+   are set to PUD_OFF if this process has set their pull since, which is
+   how cleanup() undoes setup(), and otherwise keep the pull they have. */
+void snapshot_restore(const struct gpio_snapshot *snap, uint32_t mask0, uint32_t mask1)
+{
+    struct gpio_txn txn;
+    uint32_t mask[2] = {mask0, mask1};
+    uint32_t rising, falling, high, low, changed;
+    uint32_t known, set_since;
+    int gpio, i;
+
+    txn_begin(&txn);
+    for (i=0; i<2; i++) {
+        txn.set[i] = snap->level[i] & mask[i];
+        txn.clr[i] = ~snap->level[i] & mask[i];
+        known = snap->pud[PUD_OFF][i] | snap->pud[PUD_DOWN][i] | snap->pud[PUD_UP][i];
+        pthread_mutex_lock(&pud_lock);
+        set_since = (pud_state[PUD_OFF][i] | pud_state[PUD_DOWN][i] | pud_state[PUD_UP][i]) & ~known;
+        pthread_mutex_unlock(&pud_lock);
+        txn.pud[PUD_OFF][i] = (snap->pud[PUD_OFF][i] | set_since) & mask[i];
+        txn.pud[PUD_DOWN][i] = snap->pud[PUD_DOWN][i] & mask[i];
+        txn.pud[PUD_UP][i] = snap->pud[PUD_UP][i] & mask[i];
+    }
+    for (gpio=0; gpio<54; gpio++) {
+        if (mask[gpio/32] & (1 << (gpio%32))) {
+            txn.fsel_mask[gpio/10] |= 7 << ((gpio%10)*3);
+        }
+    }
+    for (i=0; i<6; i++)
+        txn.fsel_value[i] = snap->fsel[i] & txn.fsel_mask[i];
+    txn_commit(&txn);
+
+    for (i=0; i<2; i++) {
+        if (!mask[i])
+            continue;
+        pthread_mutex_lock(&detect_lock[i]);
+        rising = *(gpio_map+RISING_ED_OFFSET+i);
+        falling = *(gpio_map+FALLING_ED_OFFSET+i);
+        high = *(gpio_map+HIGH_DETECT_OFFSET+i);
+        low = *(gpio_map+LOW_DETECT_OFFSET+i);
+        changed = ((rising ^ snap->rising[i]) | (falling ^ snap->falling[i]) |
+                   (high ^ snap->high[i]) | (low ^ snap->low[i])) & mask[i];
+        if (changed) {
+            *(gpio_map+RISING_ED_OFFSET+i) = merge(rising, snap->rising[i], changed);
+            *(gpio_map+FALLING_ED_OFFSET+i) = merge(falling, snap->falling[i], changed);
+            *(gpio_map+HIGH_DETECT_OFFSET+i) = merge(high, snap->high[i], changed);
+            *(gpio_map+LOW_DETECT_OFFSET+i) = merge(low, snap->low[i], changed);
+        }
+        pthread_mutex_unlock(&detect_lock[i]);
+        // drop the events latched under the old detect settings
+        if (changed)
+            *(gpio_map+EVENT_DETECT_OFFSET+i) = changed;
+    }
+}
+
+const struct gpio_snapshot *snapshot_boot(void)
+{
+    return &boot_state;
 }
 
 // Contribution by Eric Ptak <trouch@trouch.com>
@@ -249,16 +511,10 @@ int gpio_function(int gpio)
 
 void output_gpio(int gpio, int value)
 {
-    int offset, shift;
-
     if (value) // value == HIGH
-        offset = SET_OFFSET + (gpio/32);
+        write_bank(gpio/32, 1 << (gpio%32), 0);
     else       // value == LOW
-       offset = CLR_OFFSET + (gpio/32);
-
-    shift = (gpio%32);
-
-    *(gpio_map+offset) = 1 << shift;
+        write_bank(gpio/32, 0, 1 << (gpio%32));
 }
 
 int input_gpio(int gpio)
@@ -271,6 +527,82 @@ int input_gpio(int gpio)
    return value;
 }
 
+// write a whole bank (gpio 0-31 or 32-53) in one go, set wins over clr
+void output_gpio_bank(int bank, uint32_t set, uint32_t clr)
+{
+    clr &= ~set;
+    if (set || clr)
+        write_bank(bank, set, clr);
+}
+
+uint32_t input_gpio_bank(int bank)
+{
+    return *(gpio_map+PINLEVEL_OFFSET+bank);
+}
+
+// invert the outputs in mask from their shadow levels, with no read of the
+// level register; returns the new shadow of the bank
+uint32_t toggle_gpio_bank(int bank, uint32_t mask)
+{
+    uint32_t old;
+
+    pthread_mutex_lock(&out_lock[bank]);
+    old = out_shadow[bank];
+    __atomic_store_n(&out_shadow[bank], old ^ mask, __ATOMIC_RELAXED);
+    if (mask & ~old)
+        *(gpio_map+SET_OFFSET+bank) = mask & ~old;
+    if (mask & old)
+        *(gpio_map+CLR_OFFSET+bank) = mask & old;
+    pthread_mutex_unlock(&out_lock[bank]);
+    return old ^ mask;
+}
+
+// returns the new level of the output
+int toggle_gpio(int gpio)
+{
+    return (toggle_gpio_bank(gpio/32, 1 << (gpio%32)) >> (gpio%32)) & 1;
+}
+
+// the levels last written to a bank; bits of pins that are not outputs are
+// meaningless
+uint32_t output_state_bank(int bank)
+{
+    return __atomic_load_n(&out_shadow[bank], __ATOMIC_RELAXED);
+}
+
+int output_state(int gpio)
+{
+    return (output_state_bank(gpio/32) >> (gpio%32)) & 1;
+}
+
+/* Compare the shadow with the level register for the pins of a bank whose
+   function is output.  A difference means another process or a direct
+   register write changed the pin, or the pin is shorted.
+   returns the mask of pins that differ */
+uint32_t verify_output_bank(int bank)
+{
+    uint32_t fsel[6];
+    uint32_t outputs = 0;
+    uint32_t level;
+    int gpio, i;
+
+    for (i=0; i<6; i++)
+        fsel[i] = *(gpio_map+FSEL_OFFSET+i);
+    for (gpio=bank*32; gpio<54 && gpio<bank*32+32; gpio++)
+        if (((fsel[gpio/10] >> ((gpio%10)*3)) & 7) == 1)
+            outputs |= 1 << (gpio%32);
+    level = *(gpio_map+PINLEVEL_OFFSET+bank);
+    return (output_state_bank(bank) ^ level) & outputs;
+}
+
+// the mapped GPIO registers, for callers that write them directly
+volatile uint32_t *gpio_registers(void)
+{
+    return gpio_map;
+}
+
+// the system timer stays mapped and in use: threads that outlive cleanup()
+// may still be reading the time from it
 void cleanup(void)
 {
     munmap((void *)gpio_map, BLOCK_SIZE);
@@ -20,16 +20,59 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 
+#include <stdint.h>
+
+struct gpio_txn
+{
+    uint32_t fsel_mask[6];
+    uint32_t fsel_value[6];
+    uint32_t pud[3][2];     // pins to clock, per pull value and bank
+    uint32_t set[2];
+    uint32_t clr[2];
+};
+
+// register state for the whole board; pull up/down cannot be read back, so
+// pud[] holds the pins whose pull this process knows, per pull value
+struct gpio_snapshot
+{
+    uint32_t magic;
+    uint32_t fsel[6];
+    uint32_t level[2];
+    uint32_t rising[2];
+    uint32_t falling[2];
+    uint32_t high[2];
+    uint32_t low[2];
+    uint32_t pud[3][2];
+};
+
+#define SNAPSHOT_MAGIC 0x53504752   // "RGPS"
+
 int setup(void);
 void setup_gpio(int gpio, int direction, int pud);
 int gpio_function(int gpio);
 void output_gpio(int gpio, int value);
 int input_gpio(int gpio);
+void output_gpio_bank(int bank, uint32_t set, uint32_t clr);
+uint32_t input_gpio_bank(int bank);
+int toggle_gpio(int gpio);
+uint32_t toggle_gpio_bank(int bank, uint32_t mask);
+int output_state(int gpio);
+uint32_t output_state_bank(int bank);
+uint32_t verify_output_bank(int bank);
+void sync_output_state(int bank, uint32_t mask);
+volatile uint32_t *gpio_registers(void);
 void set_rising_event(int gpio, int enable);
 void set_falling_event(int gpio, int enable);
 void set_high_event(int gpio, int enable);
 void set_low_event(int gpio, int enable);
 int eventdetected(int gpio);
+void txn_begin(struct gpio_txn *txn);
+void txn_setup_gpio(struct gpio_txn *txn, int gpio, int direction, int pud);
+void txn_output_gpio(struct gpio_txn *txn, int gpio, int value);
+void txn_commit(struct gpio_txn *txn);
+void snapshot_take(struct gpio_snapshot *snap);
+void snapshot_restore(const struct gpio_snapshot *snap, uint32_t mask0, uint32_t mask1);
+const struct gpio_snapshot *snapshot_boot(void);
 void cleanup(void);
 
 #define SETUP_OK           0
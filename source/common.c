@@ -24,13 +24,46 @@ SOFTWARE.
 #include "c_gpio.h"
 #include "common.h"
 
-int gpio_mode = MODE_UNKNOWN;
 const int pin_to_gpio_rev1[41] = {-1, -1, -1, 0, -1, 1, -1, 4, 14, -1, 15, 17, 18, 21, -1, 22, 23, -1, 24, 10, -1, 9, 25, 11, 8, -1, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 };
 const int pin_to_gpio_rev2[41] = {-1, -1, -1, 2, -1, 3, -1, 4, 14, -1, 15, 17, 18, 27, -1, 22, 23, -1, 24, 10, -1, 9, 25, 11, 8, -1, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 };
 const int pin_to_gpio_rev3[41] = {-1, -1, -1, 2, -1, 3, -1, 4, 14, -1, 15, 17, 18, 27, -1, 22, 23, -1, 24, 10, -1, 9, 25, 11, 8, -1, 7, -1, -1, 5, -1, 6, 12, 13, -1, 19, 16, 26, 20, -1, 21 };
 int setup_error = 0;
 int module_setup = 0;
 
+#if PY_VERSION_HEX < 0x03050000
+// without per-module state every import shares one
+static struct module_state shared_state;
+#endif
+
+// the interpreter that set each gpio up, NULL if none has
+static struct module_state *gpio_owner[54];
+
+// the setup state and channel ownership are shared by every thread and
+// interpreter using the module.  The GIL serialises them on a normal build,
+// a free-threaded build locks them instead.  PyMutex detaches the thread
+// while it waits, so the lock cannot deadlock against a stop-the-world pause.
+#ifdef Py_GIL_DISABLED
+static PyMutex state_mutex;
+
+void state_lock(void)
+{
+    PyMutex_Lock(&state_mutex);
+}
+
+void state_unlock(void)
+{
+    PyMutex_Unlock(&state_mutex);
+}
+#else
+void state_lock(void)
+{
+}
+
+void state_unlock(void)
+{
+}
+#endif
+
 int check_gpio_priv(void)
 {
     // check module has been imported cleanly
@@ -49,8 +82,75 @@ int check_gpio_priv(void)
     return 0;
 }
 
-int get_gpio_number(int channel, unsigned int *gpio)
+void init_module_state(struct module_state *state, int main_interp)
+{
+    int i;
+
+    state->main_interp = main_interp;
+    state->gpio_mode = MODE_UNKNOWN;
+    for (i=0; i<54; i++)
+        state->gpio_direction[i] = -1;
+    state->gpio_warnings = 1;
+}
+
+// the state of a module object, as passed to module functions as self
+struct module_state *get_module_state(PyObject *module)
+{
+#if PY_VERSION_HEX >= 0x03050000
+    return PyModule_GetState(module);
+#else
+    return &shared_state;
+#endif
+}
+
+// the module object imported by the calling interpreter, for the Pin, PinGroup
+// and PWM types that every interpreter shares
+// returns a new reference, or NULL with an exception set
+PyObject *current_module(void)
+{
+    PyObject *module;
+
+#if PY_VERSION_HEX >= 0x03070000
+    PyObject *name;
+
+    if ((name = PyUnicode_FromString("RPi._GPIO")) == NULL)
+        return NULL;
+    module = PyImport_GetModule(name);
+    Py_DECREF(name);
+#else
+    if ((module = PyImport_AddModule("RPi._GPIO")) != NULL)
+        Py_INCREF(module);
+#endif
+    if (module != NULL && get_module_state(module) == NULL) {
+        Py_CLEAR(module);
+        PyErr_Clear();
+    }
+    if (module == NULL && !PyErr_Occurred())
+        PyErr_SetString(PyExc_RuntimeError, "RPi._GPIO is not imported in this interpreter");
+    return module;
+}
+
+// call with the state lock held
+int gpio_in_use(struct module_state *state, unsigned int gpio)
 {
+    return gpio_owner[gpio] != NULL && gpio_owner[gpio] != state;
+}
+
+void claim_gpio(struct module_state *state, unsigned int gpio)
+{
+    gpio_owner[gpio] = state;
+}
+
+void release_gpio(struct module_state *state, unsigned int gpio)
+{
+    if (gpio_owner[gpio] == state)
+        gpio_owner[gpio] = NULL;
+}
+
+int get_gpio_number(struct module_state *state, int channel, unsigned int *gpio)
+{
+    int gpio_mode = state->gpio_mode;
+
     // check setmode() has been run
     if (gpio_mode != BOARD && gpio_mode != BCM)
     {
@@ -85,3 +185,56 @@ int get_gpio_number(int channel, unsigned int *gpio)
 
     return 0;
 }
+
+// convert a channel or list/tuple of channels into gpio numbers
+// returns the number of gpios stored, or -1 with an exception set
+int parse_gpio_list(struct module_state *state, PyObject *chanlist, unsigned int *gpios, int max)
+{
+    int i, chancount, channel;
+    PyObject *tempobj;
+
+#if PY_MAJOR_VERSION > 2
+    if (PyLong_Check(chanlist)) {
+        channel = (int)PyLong_AsLong(chanlist);
+#else
+    if (PyInt_Check(chanlist)) {
+        channel = (int)PyInt_AsLong(chanlist);
+#endif
+        if (PyErr_Occurred())
+            return -1;
+        if (get_gpio_number(state, channel, &gpios[0]))
+            return -1;
+        return 1;
+    } else if (PyList_Check(chanlist) || PyTuple_Check(chanlist)) {
+        chancount = PySequence_Fast_GET_SIZE(chanlist);
+    } else {
+        PyErr_SetString(PyExc_ValueError, "Channel must be an integer or list/tuple of integers");
+        return -1;
+    }
+
+    if (chancount > max) {
+        PyErr_SetString(PyExc_ValueError, "Too many channels");
+        return -1;
+    }
+
+    for (i=0; i<chancount; i++) {
+        tempobj = PySequence_Fast_GET_ITEM(chanlist, i);
+#if PY_MAJOR_VERSION > 2
+        if (PyLong_Check(tempobj)) {
+            channel = (int)PyLong_AsLong(tempobj);
+#else
+        if (PyInt_Check(tempobj)) {
+            channel = (int)PyInt_AsLong(tempobj);
+#endif
+            if (PyErr_Occurred())
+                return -1;
+        } else {
+            PyErr_SetString(PyExc_ValueError, "Channel must be an integer");
+            return -1;
+        }
+
+        if (get_gpio_number(state, channel, &gpios[i]))
+            return -1;
+    }
+    return chancount;
+}
@@ -30,14 +30,32 @@ SOFTWARE.
 #define I2C          42
 #define PWM          43
 
-int gpio_mode;
+// each interpreter importing the module has its own numbering mode, channel
+// directions and warnings setting.  The registers, the library threads and
+// which interpreter owns a channel are shared by the whole process.
+struct module_state
+{
+    int main_interp;            // callbacks can only be added in the main interpreter
+    int gpio_mode;
+    int gpio_direction[54];
+    int gpio_warnings;
+};
+
 const int pin_to_gpio_rev1[41];
 const int pin_to_gpio_rev2[41];
 const int pin_to_gpio_rev3[41];
 const int (*pin_to_gpio)[41];
-int gpio_direction[54];
 rpi_info rpiinfo;
 int setup_error;
 int module_setup;
+void state_lock(void);
+void state_unlock(void);
 int check_gpio_priv(void);
-int get_gpio_number(int channel, unsigned int *gpio);
+void init_module_state(struct module_state *state, int main_interp);
+struct module_state *get_module_state(PyObject *module);
+PyObject *current_module(void);
+int gpio_in_use(struct module_state *state, unsigned int gpio);
+void claim_gpio(struct module_state *state, unsigned int gpio);
+void release_gpio(struct module_state *state, unsigned int gpio);
+int get_gpio_number(struct module_state *state, int channel, unsigned int *gpio);
+int parse_gpio_list(struct module_state *state, PyObject *chanlist, unsigned int *gpios, int max);
@@ -25,6 +25,7 @@ SOFTWARE.
 #include "common.h"
 #include "c_gpio.h"
 #include "event_gpio.h"
+#include "thread_sched.h"
 
 void define_constants(PyObject *module)
 {
@@ -78,4 +79,22 @@ void define_constants(PyObject *module)
 
    both_edge = Py_BuildValue("i", BOTH_EDGE + PY_EVENT_CONST_OFFSET);
    PyModule_AddObject(module, "BOTH", both_edge);
+
+   event_thread_class = Py_BuildValue("i", THREAD_EVENT);
+   PyModule_AddObject(module, "EVENT_THREAD", event_thread_class);
+
+   pwm_thread_class = Py_BuildValue("i", THREAD_PWM);
+   PyModule_AddObject(module, "PWM_THREAD", pwm_thread_class);
+
+   wave_thread_class = Py_BuildValue("i", THREAD_WAVE);
+   PyModule_AddObject(module, "WAVE_THREAD", wave_thread_class);
+
+   sched_other = Py_BuildValue("i", SCHED_OTHER);
+   PyModule_AddObject(module, "SCHED_OTHER", sched_other);
+
+   sched_fifo = Py_BuildValue("i", SCHED_FIFO);
+   PyModule_AddObject(module, "SCHED_FIFO", sched_fifo);
+
+   sched_rr = Py_BuildValue("i", SCHED_RR);
+   PyModule_AddObject(module, "SCHED_RR", sched_rr);
 }
@@ -40,5 +40,11 @@ PyObject *pud_down;
 PyObject *rising_edge;
 PyObject *falling_edge;
 PyObject *both_edge;
+PyObject *event_thread_class;
+PyObject *pwm_thread_class;
+PyObject *wave_thread_class;
+PyObject *sched_other;
+PyObject *sched_fifo;
+PyObject *sched_rr;
 
 void define_constants(PyObject *module);
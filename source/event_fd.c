@@ -0,0 +1,203 @@
+/*
+Based on RPi.GPIO by Ben Croston
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "event_fd.h"
+
+// every open eventfd has its own queue and channels, so watchers never
+// take each other's edges and closing one leaves the others alone
+struct fd_watcher
+{
+    int fd;
+    struct edge_record *queue;     // ring of EVENT_FD_QUEUE
+    unsigned int head;
+    unsigned int count;
+    unsigned long dropped;
+    unsigned long long mask;       // gpios queued to the fd
+    struct fd_watcher *next;
+};
+
+static pthread_mutex_t fd_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct fd_watcher *watcher_list = NULL;
+
+// call with fd_lock held
+static struct fd_watcher *get_watcher(int fd)
+{
+    struct fd_watcher *w;
+
+    for (w = watcher_list; w != NULL; w = w->next)
+        if (w->fd == fd)
+            return w;
+    return NULL;
+}
+
+static void free_watcher(struct fd_watcher *w)
+{
+    close(w->fd);
+    free(w->queue);
+    free(w);
+}
+
+int event_fd_open(void)
+// return values:
+// >=0 - A new eventfd, readable while edges are queued to it
+//  -1 - Unable to create the eventfd or the queue
+{
+    struct fd_watcher *w;
+
+    if ((w = calloc(1, sizeof(struct fd_watcher))) == NULL)
+        return -1;
+    if ((w->queue = malloc(EVENT_FD_QUEUE * sizeof(struct edge_record))) == NULL ||
+        (w->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+        free(w->queue);
+        free(w);
+        return -1;
+    }
+
+    pthread_mutex_lock(&fd_lock);
+    w->next = watcher_list;
+    watcher_list = w;
+    pthread_mutex_unlock(&fd_lock);
+    return w->fd;
+}
+
+void event_fd_close(int fd)
+{
+    struct fd_watcher **prev, *w = NULL;
+
+    pthread_mutex_lock(&fd_lock);
+    for (prev = &watcher_list; *prev != NULL; prev = &(*prev)->next) {
+        if ((*prev)->fd == fd) {
+            w = *prev;
+            *prev = w->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&fd_lock);
+    if (w != NULL)
+        free_watcher(w);
+}
+
+void event_fd_close_all(void)
+{
+    struct fd_watcher *w, *next;
+
+    pthread_mutex_lock(&fd_lock);
+    w = watcher_list;
+    watcher_list = NULL;
+    pthread_mutex_unlock(&fd_lock);
+    for (; w != NULL; w = next) {
+        next = w->next;
+        free_watcher(w);
+    }
+}
+
+int event_fd_watch(int fd, unsigned int gpio, int watch)
+// return values:
+// 0 - Success
+// 1 - fd is not an open event fd
+{
+    struct fd_watcher *w;
+
+    if (gpio >= 54)
+        return 0;
+    pthread_mutex_lock(&fd_lock);
+    if ((w = get_watcher(fd)) != NULL) {
+        if (watch)
+            w->mask |= 1ULL << gpio;
+        else
+            w->mask &= ~(1ULL << gpio);
+    }
+    pthread_mutex_unlock(&fd_lock);
+    return w == NULL;
+}
+
+// stop queueing a gpio to every fd, when its edge detection is removed
+void event_fd_unwatch(unsigned int gpio)
+{
+    struct fd_watcher *w;
+
+    if (gpio >= 54)
+        return;
+    pthread_mutex_lock(&fd_lock);
+    for (w = watcher_list; w != NULL; w = w->next)
+        w->mask &= ~(1ULL << gpio);
+    pthread_mutex_unlock(&fd_lock);
+}
+
+// called on the poll thread for every edge that passed the bounce time
+void event_fd_record(unsigned int gpio, int level, unsigned long long timestamp)
+{
+    struct fd_watcher *w;
+    struct edge_record *r;
+    uint64_t one = 1;
+
+    pthread_mutex_lock(&fd_lock);
+    for (w = watcher_list; w != NULL; w = w->next) {
+        if (!(w->mask & (1ULL << gpio)))
+            continue;
+        if (w->count < EVENT_FD_QUEUE) {
+            r = &w->queue[(w->head + w->count) % EVENT_FD_QUEUE];
+            r->gpio = gpio;
+            r->level = level;
+            r->timestamp = timestamp;
+            // only the first edge of a batch wakes the reader
+            if (w->count++ == 0 && write(w->fd, &one, sizeof(one)) != sizeof(one)) {
+                // counter already at its maximum, the fd is readable anyway
+            }
+        } else {
+            w->dropped++;
+        }
+    }
+    pthread_mutex_unlock(&fd_lock);
+}
+
+int event_fd_drain(int fd, struct edge_record *records, int max, unsigned long *dropped)
+// copy up to max edges queued to fd without blocking; the fd stays
+// readable while edges are left in its queue
+// return values:
+// >=0 - The number of edges copied
+//  -1 - fd is not an open event fd
+{
+    struct fd_watcher *w;
+    uint64_t value;
+    int i, n = -1;
+
+    pthread_mutex_lock(&fd_lock);
+    if ((w = get_watcher(fd)) != NULL) {
+        *dropped = w->dropped;
+        w->dropped = 0;
+        n = (int)w->count < max ? (int)w->count : max;
+        for (i=0; i<n; i++)
+            records[i] = w->queue[(w->head + i) % EVENT_FD_QUEUE];
+        w->head = (w->head + n) % EVENT_FD_QUEUE;
+        w->count -= n;
+        if (w->count == 0 && read(w->fd, &value, sizeof(value)) != sizeof(value)) {
+            // nothing was signalled
+        }
+    }
+    pthread_mutex_unlock(&fd_lock);
+    return n;
+}
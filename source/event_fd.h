@@ -0,0 +1,45 @@
+/*
+Based on RPi.GPIO by Ben Croston
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* Edges queued for event loops outside the library.  Each event_fd_open()
+   gives a new eventfd with its own queue and channels, readable while
+   edges are queued to it, and its owner drains them without blocking from
+   whatever loop it runs (asyncio, libuv or plain epoll). */
+
+#include <stdint.h>
+
+#define EVENT_FD_QUEUE 65536   // edges held before new ones are dropped
+
+struct edge_record
+{
+    uint32_t gpio;
+    uint32_t level;         // level read when the edge was detected
+    uint64_t timestamp;     // monotonic ns, taken when the edge was detected
+};
+
+int event_fd_open(void);
+void event_fd_close(int fd);
+void event_fd_close_all(void);
+int event_fd_watch(int fd, unsigned int gpio, int watch);
+void event_fd_unwatch(unsigned int gpio);
+void event_fd_record(unsigned int gpio, int level, unsigned long long timestamp);
+int event_fd_drain(int fd, struct edge_record *records, int max, unsigned long *dropped);
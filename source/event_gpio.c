@@ -28,8 +28,12 @@ SOFTWARE.
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
-#include <sys/time.h>
+#include <time.h>
 #include "event_gpio.h"
+#include "event_trace.h"
+#include "event_fd.h"
+#include "thread_sched.h"
+#include "timing.h"
 
 const char *stredge[4] = {"none", "rising", "falling", "both"};
 
@@ -38,6 +42,7 @@ struct gpios
     unsigned int gpio;
     int value_fd;
     int exported;
+    int pooled;
     int edge;
     int initial_thread;
     int initial_wait;
@@ -53,15 +58,42 @@ struct callback
 {
     unsigned int gpio;
     void (*func)(unsigned int gpio);
+    void (*func_ex)(unsigned int gpio, int level, unsigned long long timestamp);
+    int removed;
     struct callback *next;
+    struct callback *next_retired;
 };
 struct callback *callbacks = NULL;
 
+/* callbacks is guarded by cb_lock, which run_callbacks() drops while each
+   callback runs.  Nodes removed meanwhile are unlinked but keep their next
+   pointer, and are freed by the last run_callbacks() to finish. */
+static pthread_mutex_t cb_lock = PTHREAD_MUTEX_INITIALIZER;
+static int cb_readers = 0;
+static struct callback *cb_retired = NULL;
+
+// lines exported and opened ahead of time by event_pool_prepare()
+struct line
+{
+    int value_fd;   // -1 when not in the pool
+    int exported;   // exported by us, so unexport on release
+    int in_use;     // taken by new_gpio()
+};
+struct line line_pool[54];
+int line_pool_initialised = 0;
+
 pthread_t threads;
-int event_occurred[54] = { 0 };
+int event_occurred[54] = { 0 };   // set and cleared atomically
 int thread_running = 0;
 int epfd_thread = -1;
-int epfd_blocking = -1;
+
+/* event_lock serialises changes to edge detection, which can wait on sysfs
+   and udev.  list_lock is only held briefly, and guards gpio_list against
+   the poll thread and edge_wait_ready(), so they are never held up by a
+   change.  gpio_list and the value files of its lines change holding both;
+   reading them needs either. */
+static pthread_mutex_t event_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t list_lock = PTHREAD_MUTEX_INITIALIZER;
 
 /************* /sys/class/gpio functions ************/
 int gpio_export(unsigned int gpio)
@@ -94,6 +126,14 @@ int gpio_unexport(unsigned int gpio)
     return 0;
 }
 
+int gpio_is_exported(unsigned int gpio)
+{
+    char dirname[24];
+
+    snprintf(dirname, sizeof(dirname), "/sys/class/gpio/gpio%d", gpio);
+    return access(dirname, F_OK) == 0;
+}
+
 int gpio_set_direction(unsigned int gpio, unsigned int in_flag)
 {
     int retry;
@@ -183,21 +223,35 @@ struct gpios *new_gpio(unsigned int gpio)
     }
 
     new_gpio->gpio = gpio;
-    if (gpio_export(gpio) != 0) {
-        free(new_gpio);
-        return NULL;
-    }
-    new_gpio->exported = 1;
+    if (line_pool_initialised && line_pool[gpio].value_fd != -1 && !line_pool[gpio].in_use) {
+        // already exported, set as an input and opened
+        line_pool[gpio].in_use = 1;
+        new_gpio->value_fd = line_pool[gpio].value_fd;
+        new_gpio->exported = line_pool[gpio].exported;
+        new_gpio->pooled = 1;
+    } else {
+        // reuse a line left exported by a previous run
+        new_gpio->exported = 0;
+        if (!gpio_is_exported(gpio)) {
+            if (gpio_export(gpio) != 0) {
+                free(new_gpio);
+                return NULL;
+            }
+            new_gpio->exported = 1;
+        }
 
-    if (gpio_set_direction(gpio,1) != 0) { // 1==input
-        free(new_gpio);
-        return NULL;
-    }
+        if (gpio_set_direction(gpio,1) != 0) { // 1==input
+            free(new_gpio);
+            return NULL;
+        }
 
-    if ((new_gpio->value_fd = open_value_file(gpio)) == -1) {
-        gpio_unexport(gpio);
-        free(new_gpio);
-        return NULL;
+        if ((new_gpio->value_fd = open_value_file(gpio)) == -1) {
+            if (new_gpio->exported)
+                gpio_unexport(gpio);
+            free(new_gpio);
+            return NULL;
+        }
+        new_gpio->pooled = 0;
     }
 
     new_gpio->initial_thread = 1;
@@ -206,15 +260,14 @@ struct gpios *new_gpio(unsigned int gpio)
     new_gpio->lastcall = 0;
     new_gpio->thread_added = 0;
 
-    if (gpio_list == NULL) {
-        new_gpio->next = NULL;
-    } else {
-        new_gpio->next = gpio_list;
-    }
+    pthread_mutex_lock(&list_lock);
+    new_gpio->next = gpio_list;
     gpio_list = new_gpio;
+    pthread_mutex_unlock(&list_lock);
     return new_gpio;
 }
 
+// call holding list_lock
 void delete_gpio(unsigned int gpio)
 {
     struct gpios *g = gpio_list;
@@ -240,19 +293,128 @@ void delete_gpio(unsigned int gpio)
 
 int gpio_event_added(unsigned int gpio)
 {
-    struct gpios *g = gpio_list;
-    while (g != NULL) {
-        if (g->gpio == gpio)
-            return g->edge;
-        g = g->next;
+    struct gpios *g;
+    int edge = 0;
+
+    pthread_mutex_lock(&list_lock);
+    if ((g = get_gpio(gpio)) != NULL)
+        edge = g->edge;
+    pthread_mutex_unlock(&list_lock);
+    return edge;
+}
+
+/*********** line pool functions ***********/
+void line_pool_init(void)
+{
+    int i;
+
+    if (line_pool_initialised)
+        return;
+    for (i=0; i<54; i++) {
+        line_pool[i].value_fd = -1;
+        line_pool[i].exported = 0;
+        line_pool[i].in_use = 0;
     }
+    line_pool_initialised = 1;
+}
+
+int event_pool_prepare(const unsigned int *gpios, int count)
+// return values:
+// 0 - Success
+// 1 - One or more lines could not be prepared
+{
+    int pending[54] = { 0 };
+    int i, fd, retry, remaining = 0;
+    char filename[33];
+    struct timespec delay;
+
+    pthread_mutex_lock(&event_lock);
+    line_pool_init();
+
+    // export everything first so udev can work on all the lines at once
+    for (i=0; i<count; i++) {
+        if (gpios[i] >= 54 || line_pool[gpios[i]].value_fd != -1 || pending[gpios[i]])
+            continue;
+        if (get_gpio(gpios[i]) != NULL)    // already in use for edge detection
+            continue;
+        if (!gpio_is_exported(gpios[i])) {
+            if (gpio_export(gpios[i]) != 0)
+                continue;
+            line_pool[gpios[i]].exported = 1;
+        }
+        pending[gpios[i]] = 1;
+        remaining++;
+    }
+
+    // then wait for the permissions on all of them together
+    delay.tv_sec = 0;
+    delay.tv_nsec = 10000000L; // 10ms
+    for (retry=0; retry<100 && remaining; retry++) {
+        for (i=0; i<54; i++) {
+            if (!pending[i])
+                continue;
+            snprintf(filename, sizeof(filename), "/sys/class/gpio/gpio%d/direction", i);
+            if ((fd = open(filename, O_WRONLY)) < 0)
+                continue;
+            write(fd, "in", 3);
+            close(fd);
+            if ((line_pool[i].value_fd = open_value_file(i)) != -1) {
+                line_pool[i].in_use = 0;
+            } else if (line_pool[i].exported) {
+                gpio_unexport(i);
+                line_pool[i].exported = 0;
+            }
+            pending[i] = 0;
+            remaining--;
+        }
+        if (remaining)
+            nanosleep(&delay, NULL);
+    }
+
+    // give up on anything udev did not get to
+    for (i=0; i<54; i++) {
+        if (pending[i] && line_pool[i].exported) {
+            gpio_unexport(i);
+            line_pool[i].exported = 0;
+        }
+    }
+
+    for (i=0; i<count; i++) {
+        if (gpios[i] >= 54 || (line_pool[gpios[i]].value_fd == -1 && get_gpio(gpios[i]) == NULL)) {
+            pthread_mutex_unlock(&event_lock);
+            return 1;
+        }
+    }
+    pthread_mutex_unlock(&event_lock);
     return 0;
 }
 
+void event_pool_release(void)
+{
+    int i;
+
+    pthread_mutex_lock(&event_lock);
+    if (!line_pool_initialised) {
+        pthread_mutex_unlock(&event_lock);
+        return;
+    }
+    for (i=0; i<54; i++) {
+        if (line_pool[i].value_fd == -1 || line_pool[i].in_use)
+            continue;
+        close(line_pool[i].value_fd);
+        line_pool[i].value_fd = -1;
+        if (line_pool[i].exported)
+            gpio_unexport(i);
+        line_pool[i].exported = 0;
+    }
+    pthread_mutex_unlock(&event_lock);
+}
+
 /******* callback list functions ********/
-int add_edge_callback(unsigned int gpio, void (*func)(unsigned int gpio))
+static int append_callback(unsigned int gpio, void (*func)(unsigned int gpio),
+                           void (*func_ex)(unsigned int gpio, int level, unsigned long long timestamp))
 {
-    struct callback *cb = callbacks;
+    struct callback *cb;
     struct callback *new_cb;
 
     new_cb = malloc(sizeof(struct callback));
@@ -261,8 +423,12 @@ int add_edge_callback(unsigned int gpio, void (*func)(unsigned int gpio))
 
     new_cb->gpio = gpio;
     new_cb->func = func;
+    new_cb->func_ex = func_ex;
+    new_cb->removed = 0;
     new_cb->next = NULL;
 
+    pthread_mutex_lock(&cb_lock);
+    cb = callbacks;
     if (callbacks == NULL) {
         // start new list
         callbacks = new_cb;
@@ -272,37 +438,76 @@ int add_edge_callback(unsigned int gpio, void (*func)(unsigned int gpio))
             cb = cb->next;
         cb->next = new_cb;
     }
+    pthread_mutex_unlock(&cb_lock);
     return 0;
 }
 
+int add_edge_callback(unsigned int gpio, void (*func)(unsigned int gpio))
+{
+    return append_callback(gpio, func, NULL);
+}
+
+// as add_edge_callback(), with the level read after the edge and the
+// time_ns() timestamp of the edge
+int add_edge_callback_ex(unsigned int gpio, void (*func)(unsigned int gpio, int level, unsigned long long timestamp))
+{
+    return append_callback(gpio, NULL, func);
+}
+
 int callback_exists(unsigned int gpio)
 {
-    struct callback *cb = callbacks;
-    while (cb != NULL) {
-        if (cb->gpio == gpio)
-            return 1;
-        cb = cb->next;
-    }
-    return 0;
+    struct callback *cb;
+    int found = 0;
+
+    pthread_mutex_lock(&cb_lock);
+    for (cb = callbacks; cb != NULL && !found; cb = cb->next)
+        found = cb->gpio == gpio;
+    pthread_mutex_unlock(&cb_lock);
+    return found;
 }
 
-void run_callbacks(unsigned int gpio)
+void run_callbacks(unsigned int gpio, int level, unsigned long long timestamp)
 {
-    struct callback *cb = callbacks;
+    struct callback *cb;
+    struct callback *retired = NULL;
+    struct callback *temp;
+
+    pthread_mutex_lock(&cb_lock);
+    cb_readers++;
+    cb = callbacks;
     while (cb != NULL)
     {
-        if (cb->gpio == gpio)
-            cb->func(cb->gpio);
+        if (cb->gpio == gpio && !cb->removed) {
+            pthread_mutex_unlock(&cb_lock);
+            if (cb->func_ex)
+                cb->func_ex(cb->gpio, level, timestamp);
+            else
+                cb->func(cb->gpio);
+            pthread_mutex_lock(&cb_lock);
+        }
         cb = cb->next;
     }
+    if (--cb_readers == 0) {
+        retired = cb_retired;
+        cb_retired = NULL;
+    }
+    pthread_mutex_unlock(&cb_lock);
+
+    while (retired != NULL) {
+        temp = retired;
+        retired = retired->next_retired;
+        free(temp);
+    }
 }
 
 void remove_callbacks(unsigned int gpio)
 {
-    struct callback *cb = callbacks;
+    struct callback *cb;
     struct callback *temp;
     struct callback *prev = NULL;
 
+    pthread_mutex_lock(&cb_lock);
+    cb = callbacks;
     while (cb != NULL)
     {
         if (cb->gpio == gpio)
@@ -313,44 +518,78 @@ void remove_callbacks(unsigned int gpio)
                 prev->next = cb->next;
             temp = cb;
             cb = cb->next;
-            free(temp);
+            // a run_callbacks() in progress may still step through it
+            temp->removed = 1;
+            if (cb_readers) {
+                temp->next_retired = cb_retired;
+                cb_retired = temp;
+            } else {
+                free(temp);
+            }
         } else {
             prev = cb;
             cb = cb->next;
         }
     }
+    pthread_mutex_unlock(&cb_lock);
+}
+
+void event_inject(unsigned int gpio, int level, unsigned long long timestamp)
+{
+    if (gpio >= 54)
+        return;
+    __sync_fetch_and_or(&event_occurred[gpio], 1);
+    event_fd_record(gpio, level, timestamp);
+    run_callbacks(gpio, level, timestamp);
 }
 
 void *poll_thread(void *threadarg)
 {
     struct epoll_event events;
     char buf;
-    struct timeval tv_timenow;
-    unsigned long long timenow;
+    unsigned long long timestamp, timenow;
     struct gpios *g;
-    int n;
+    unsigned int gpio;
+    int n, fire;
 
+    thread_sched_enter(THREAD_EVENT);
     thread_running = 1;
     while (thread_running) {
         n = epoll_wait(epfd_thread, &events, 1, -1);
         if (n > 0) {
+            pthread_mutex_lock(&list_lock);
+            if ((g = get_gpio_from_value_fd(events.data.fd)) == NULL) {
+                // removed since epoll_wait() returned
+                pthread_mutex_unlock(&list_lock);
+                continue;
+            }
             lseek(events.data.fd, 0, SEEK_SET);
             if (read(events.data.fd, &buf, 1) != 1) {
+                pthread_mutex_unlock(&list_lock);
                 thread_running = 0;
+                thread_sched_exit(THREAD_EVENT);
                 pthread_exit(NULL);
             }
-            g = get_gpio_from_value_fd(events.data.fd);
+            fire = 0;
+            gpio = g->gpio;
+            timestamp = time_ns();
             if (g->initial_thread) {     // ignore first epoll trigger
                 g->initial_thread = 0;
             } else {
-                gettimeofday(&tv_timenow, NULL);
-                timenow = tv_timenow.tv_sec*1E6 + tv_timenow.tv_usec;
+                timenow = timestamp / 1000;
                 if (g->bouncetime == -666 || timenow - g->lastcall > g->bouncetime*1000 || g->lastcall == 0 || g->lastcall > timenow) {
                     g->lastcall = timenow;
-                    event_occurred[g->gpio] = 1;
-                    run_callbacks(g->gpio);
+                    fire = 1;
                 }
             }
+            pthread_mutex_unlock(&list_lock);
+
+            if (fire) {
+                __sync_fetch_and_or(&event_occurred[gpio], 1);
+                trace_record(gpio, buf == '1', timestamp);
+                event_fd_record(gpio, buf == '1', timestamp);
+                run_callbacks(gpio, buf == '1', timestamp);
+            }
         } else if (n == -1) {
             /*  If a signal is received while we are waiting,
                 epoll_wait will return with an EINTR error.
@@ -359,17 +598,21 @@ void *poll_thread(void *threadarg)
                 continue;
             }
             thread_running = 0;
+            thread_sched_exit(THREAD_EVENT);
             pthread_exit(NULL);
         }
     }
     thread_running = 0;
+    thread_sched_exit(THREAD_EVENT);
     pthread_exit(NULL);
 }
 
-void remove_edge_detect(unsigned int gpio)
+// call holding event_lock
+static void remove_line(unsigned int gpio)
 {
     struct epoll_event ev;
     struct gpios *g = get_gpio(gpio);
+    int exported;
 
     if (g == NULL)
         return;
@@ -382,63 +625,76 @@ void remove_edge_detect(unsigned int gpio)
 
     // delete callbacks for gpio
     remove_callbacks(gpio);
+    event_fd_unwatch(gpio);
 
     // btc fixme - check return result??
     gpio_set_edge(gpio, NO_EDGE);
     g->edge = NO_EDGE;
 
-    if (g->value_fd != -1)
+    exported = !g->pooled && g->exported;
+    pthread_mutex_lock(&list_lock);
+    if (g->pooled) {
+        // keep the line exported and open for next time
+        line_pool[gpio].in_use = 0;
+    } else if (g->value_fd != -1) {
         close(g->value_fd);
+    }
+    delete_gpio(gpio);
+    pthread_mutex_unlock(&list_lock);
 
     // btc fixme - check return result??
-    gpio_unexport(gpio);
-    event_occurred[gpio] = 0;
+    if (exported)
+        gpio_unexport(gpio);
+    __sync_fetch_and_and(&event_occurred[gpio], 0);
+}
 
-    delete_gpio(gpio);
+void remove_edge_detect(unsigned int gpio)
+{
+    pthread_mutex_lock(&event_lock);
+    remove_line(gpio);
+    pthread_mutex_unlock(&event_lock);
 }
 
 int event_detected(unsigned int gpio)
 {
-    if (event_occurred[gpio]) {
-        event_occurred[gpio] = 0;
-        return 1;
-    } else {
-        return 0;
-    }
+    // test and clear in one step, so an edge arriving meanwhile is kept
+    return __sync_fetch_and_and(&event_occurred[gpio], 0) != 0;
 }
 
 void event_cleanup(unsigned int gpio)
 // gpio of -666 means clean every channel used
 {
-    struct gpios *g = gpio_list;
+    struct gpios *g;
     struct gpios *temp = NULL;
 
+    pthread_mutex_lock(&event_lock);
+    g = gpio_list;
     while (g != NULL) {
+        temp = g->next;
         if ((gpio == -666) || (g->gpio == gpio))
-            temp = g->next;
-            remove_edge_detect(g->gpio);
-            g = temp;
-    }
-    if (gpio_list == NULL)
-        if (epfd_blocking != -1)
-            close(epfd_blocking);
-            epfd_blocking = -1;
-        if (epfd_thread != -1)
+            remove_line(g->gpio);
+        g = temp;
+    }
+    if (gpio_list == NULL) {
+        if (epfd_thread != -1) {
             close(epfd_thread);
             epfd_thread = -1;
+        }
         thread_running = 0;
+    }
+    pthread_mutex_unlock(&event_lock);
 }
 
 void event_cleanup_all(void)
 {
+   trace_stop();
+   event_fd_close_all();
    event_cleanup(-666);
+   event_pool_release();
 }
 
-int add_edge_detect(unsigned int gpio, unsigned int edge, int bouncetime)
-// return values:
-// 0 - Success
-// 1 - Edge detection already added
-// 2 - Other error
+static int add_line(unsigned int gpio, unsigned int edge, int bouncetime)
+// call holding event_lock, return values as add_edge_detect()
 {
     pthread_t threads;
     struct epoll_event ev;
@@ -471,21 +727,38 @@ int add_edge_detect(unsigned int gpio, unsigned int edge, int bouncetime)
     ev.events = EPOLLIN | EPOLLET | EPOLLPRI;
     ev.data.fd = g->value_fd;
     if (epoll_ctl(epfd_thread, EPOLL_CTL_ADD, g->value_fd, &ev) == -1) {
-        remove_edge_detect(gpio);
+        remove_line(gpio);
         return 2;
     }
     g->thread_added = 1;
 
     // start poll thread if it is not already running
     if (!thread_running) {
+        thread_running = 1;
         if (pthread_create(&threads, NULL, poll_thread, (void *)t) != 0) {
-           remove_edge_detect(gpio);
+           thread_running = 0;
+           remove_line(gpio);
            return 2;
         }
+        pthread_detach(threads);
     }
     return 0;
 }
 
+int add_edge_detect(unsigned int gpio, unsigned int edge, int bouncetime)
+// return values:
+// 0 - Success
+// 1 - Edge detection already added
+// 2 - Other error
+{
+    int result;
+
+    pthread_mutex_lock(&event_lock);
+    result = add_line(gpio, edge, bouncetime);
+    pthread_mutex_unlock(&event_lock);
+    return result;
+}
+
 int blocking_wait_for_edge(unsigned int gpio, unsigned int edge, int bouncetime, int timeout)
 // return values:
 //    1 - Success (edge detected)
@@ -493,11 +766,10 @@ int blocking_wait_for_edge(unsigned int gpio, unsigned int edge, int bouncetime,
 //   -1 - Edge detection already added
 //   -2 - Other error
 {
-    int n, ed;
+    int n, ed, fd, epfd;
     struct epoll_event events, ev;
     char buf;
     struct gpios *g = NULL;
-    struct timeval tv_timenow;
     unsigned long long timenow;
     int finished = 0;
     int initial_edge = 1;
@@ -505,15 +777,19 @@ int blocking_wait_for_edge(unsigned int gpio, unsigned int edge, int bouncetime,
     if (callback_exists(gpio))
         return -1;
 
+    pthread_mutex_lock(&event_lock);
+
     // add gpio if it has not been added already
     ed = gpio_event_added(gpio);
     if (ed == edge) {   // get existing record
         g = get_gpio(gpio);
         if (g->bouncetime != -666 && g->bouncetime != bouncetime) {
+            pthread_mutex_unlock(&event_lock);
             return -1;
         }
     } else if (ed == NO_EDGE) {   // not found so add event
         if ((g = new_gpio(gpio)) == NULL) {
+            pthread_mutex_unlock(&event_lock);
             return -2;
         }
         gpio_set_edge(gpio, edge);
@@ -522,26 +798,34 @@ int blocking_wait_for_edge(unsigned int gpio, unsigned int edge, int bouncetime,
     } else {    // ed != edge - event for a different edge
         g = get_gpio(gpio);
         gpio_set_edge(gpio, edge);
+        pthread_mutex_lock(&list_lock);
         g->edge = edge;
         g->bouncetime = bouncetime;
         g->initial_wait = 1;
+        pthread_mutex_unlock(&list_lock);
     }
+    fd = g->value_fd;
 
-    // create epfd_blocking if not already open
-    if ((epfd_blocking == -1) && ((epfd_blocking = epoll_create(1)) == -1)) {
+    // each wait has its own epoll fd, so waits on other lines in other
+    // threads do not see its edges
+    if ((epfd = epoll_create(1)) == -1) {
+        pthread_mutex_unlock(&event_lock);
         return -2;
     }
 
     // add to epoll fd
     ev.events = EPOLLIN | EPOLLET | EPOLLPRI;
-    ev.data.fd = g->value_fd;
-    if (epoll_ctl(epfd_blocking, EPOLL_CTL_ADD, g->value_fd, &ev) == -1) {
+    ev.data.fd = fd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        pthread_mutex_unlock(&event_lock);
+        close(epfd);
         return -2;
     }
+    pthread_mutex_unlock(&event_lock);
 
     // wait for edge
     while (!finished) {
-        n = epoll_wait(epfd_blocking, &events, 1, timeout);
+        n = epoll_wait(epfd, &events, 1, timeout);
         if (n == -1) {
             /*  If a signal is received while we are waiting,
                 epoll_wait will return with an EINTR error.
@@ -549,34 +833,130 @@ int blocking_wait_for_edge(unsigned int gpio, unsigned int edge, int bouncetime,
             if (errno == EINTR) {
                 continue;
             }
-            epoll_ctl(epfd_blocking, EPOLL_CTL_DEL, g->value_fd, &ev);
+            close(epfd);
             return -2;
         }
         if (initial_edge) {    // first time triggers with current state, so ignore
             initial_edge = 0;
         } else {
-            gettimeofday(&tv_timenow, NULL);
-            timenow = tv_timenow.tv_sec*1E6 + tv_timenow.tv_usec;
+            // the line may have been removed by another thread meanwhile
+            pthread_mutex_lock(&list_lock);
+            if ((g = get_gpio(gpio)) == NULL || g->value_fd != fd) {
+                pthread_mutex_unlock(&list_lock);
+                close(epfd);
+                return -2;
+            }
+            timenow = time_ns() / 1000;
             if (g->bouncetime == -666 || timenow - g->lastcall > g->bouncetime*1000 || g->lastcall == 0 || g->lastcall > timenow) {
                 g->lastcall = timenow;
                 finished = 1;
             }
+            pthread_mutex_unlock(&list_lock);
         }
     }
 
     // check event was valid
     if (n > 0) {
-        lseek(events.data.fd, 0, SEEK_SET);
-        if ((read(events.data.fd, &buf, 1) != 1) || (events.data.fd != g->value_fd)) {
-            epoll_ctl(epfd_blocking, EPOLL_CTL_DEL, g->value_fd, &ev);
+        pthread_mutex_lock(&list_lock);
+        if ((g = get_gpio(gpio)) == NULL || events.data.fd != g->value_fd ||
+            lseek(fd, 0, SEEK_SET) == -1 || read(fd, &buf, 1) != 1) {
+            pthread_mutex_unlock(&list_lock);
+            close(epfd);
             return -2;
         }
+        pthread_mutex_unlock(&list_lock);
     }
 
-    epoll_ctl(epfd_blocking, EPOLL_CTL_DEL, g->value_fd, &ev);
+    close(epfd);
     if (n == 0) {
        return 0; // timeout
     } else {
        return 1; // edge found
     }
 }
+
+/* Non-blocking waits, for callers with their own event loop.  Each wait
+   opens its own value file, so any number of waits on a line can be
+   polled for POLLPRI at once. */
+int edge_wait_open(unsigned int gpio, unsigned int edge, int bouncetime)
+// return values:
+//  >=0 - Value file descriptor to poll for POLLPRI
+//   -1 - Conflicting edge detection already added
+//   -2 - Other error
+{
+    int fd, ed;
+    char buf;
+    struct gpios *g;
+
+    if (callback_exists(gpio))
+        return -1;
+
+    pthread_mutex_lock(&event_lock);
+    ed = gpio_event_added(gpio);
+    if (ed == edge) {   // get existing record
+        g = get_gpio(gpio);
+        if (g->bouncetime != -666 && g->bouncetime != bouncetime) {
+            pthread_mutex_unlock(&event_lock);
+            return -1;
+        }
+    } else if (ed == NO_EDGE) {   // not found so add event
+        if ((g = new_gpio(gpio)) == NULL) {
+            pthread_mutex_unlock(&event_lock);
+            return -2;
+        }
+        gpio_set_edge(gpio, edge);
+        g->edge = edge;
+        g->bouncetime = bouncetime;
+    } else {    // other waits may be using a different edge
+        pthread_mutex_unlock(&event_lock);
+        return -1;
+    }
+    pthread_mutex_unlock(&event_lock);
+
+    if ((fd = open_value_file(gpio)) == -1)
+        return -2;
+
+    // the first read clears the current state, so only new edges wake us
+    if (read(fd, &buf, 1) != 1) {
+        close(fd);
+        return -2;
+    }
+    return fd;
+}
+
+int edge_wait_ready(unsigned int gpio, int fd, unsigned long long *lastcall, int *level)
+// call when fd reports POLLPRI, *lastcall is the wait's own bounce state
+// and starts at 0
+// return values:
+//    1 - Edge accepted, *level holds the level after the edge
+//    0 - Edge ignored by the bounce time
+//   -2 - Error
+{
+    struct gpios *g;
+    unsigned long long timenow;
+    char buf;
+    int result = 0;
+
+    lseek(fd, 0, SEEK_SET);
+    if (read(fd, &buf, 1) != 1)
+        return -2;
+
+    pthread_mutex_lock(&list_lock);
+    if ((g = get_gpio(gpio)) == NULL) {
+        result = -2;
+    } else {
+        timenow = time_ns() / 1000;
+        if (g->bouncetime == -666 || timenow - *lastcall > g->bouncetime*1000 || *lastcall == 0 || *lastcall > timenow) {
+            *lastcall = timenow;
+            *level = buf == '1';
+            result = 1;
+        }
+    }
+    pthread_mutex_unlock(&list_lock);
+    return result;
+}
+
+void edge_wait_close(int fd)
+{
+    close(fd);
+}
@@ -28,9 +28,17 @@ SOFTWARE.
 int add_edge_detect(unsigned int gpio, unsigned int edge, int bouncetime);
 void remove_edge_detect(unsigned int gpio);
 int add_edge_callback(unsigned int gpio, void (*func)(unsigned int gpio));
+int add_edge_callback_ex(unsigned int gpio, void (*func)(unsigned int gpio, int level, unsigned long long timestamp));
+int callback_exists(unsigned int gpio);
 int event_detected(unsigned int gpio);
 int gpio_event_added(unsigned int gpio);
 int event_initialise(void);
 void event_cleanup(unsigned int gpio);
 void event_cleanup_all(void);
 int blocking_wait_for_edge(unsigned int gpio, unsigned int edge, int bouncetime, int timeout);
+int edge_wait_open(unsigned int gpio, unsigned int edge, int bouncetime);
+int edge_wait_ready(unsigned int gpio, int fd, unsigned long long *lastcall, int *level);
+void edge_wait_close(int fd);
+int event_pool_prepare(const unsigned int *gpios, int count);
+void event_pool_release(void);
+void event_inject(unsigned int gpio, int level, unsigned long long timestamp);
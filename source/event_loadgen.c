@@ -0,0 +1,230 @@
+/*
+Based on RPi.GPIO by Ben Croston
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "event_gpio.h"
+#include "event_loadgen.h"
+#include "thread_sched.h"
+#include "timing.h"
+
+struct loadgen_event
+{
+    unsigned int gpio;
+    int level;
+    unsigned long long injected;
+};
+
+static struct loadgen_event queue[LOADGEN_QUEUE_SIZE];
+static volatile unsigned int queue_head = 0;   // written by the injector
+static volatile unsigned int queue_tail = 0;   // written by the dispatcher
+static volatile int injecting = 0;
+static volatile int loadgen_running = 0;     // the dispatcher is delivering
+
+// one run at a time: the queue, samples and counters are shared
+static pthread_mutex_t run_lock = PTHREAD_MUTEX_INITIALIZER;
+static int run_busy = 0;
+
+static unsigned long long *samples = NULL;
+static unsigned long sample_count = 0;   // slots taken, may pass sample_max
+static unsigned long sample_max = 0;
+static unsigned long delivered = 0;
+static volatile int markers = 0;         // loadgen_mark() calls in progress
+
+static void add_sample(unsigned long long latency)
+{
+    unsigned long i = __sync_fetch_and_add(&sample_count, 1);
+
+    if (i < sample_max)
+        samples[i] = latency;
+}
+
+// timestamp is the edge's, which is its injection time for injected edges
+void loadgen_mark(unsigned long long timestamp)
+{
+    unsigned long long now;
+
+    __sync_fetch_and_add(&markers, 1);
+    if (__atomic_load_n(&loadgen_running, __ATOMIC_ACQUIRE)) {
+        now = time_ns();
+        if (now >= timestamp)
+            add_sample(now - timestamp);
+    }
+    __sync_fetch_and_sub(&markers, 1);
+}
+
+static void *dispatch_thread(void *threadarg)
+{
+    struct loadgen_event *e;
+    struct timespec delay = {0, 50000L};  // 50us
+
+    // run like the poll thread would
+    thread_sched_enter(THREAD_EVENT);
+    while (injecting || queue_tail != queue_head) {
+        if (queue_tail == queue_head) {
+            nanosleep(&delay, NULL);
+            continue;
+        }
+        __sync_synchronize();
+        e = &queue[queue_tail % LOADGEN_QUEUE_SIZE];
+
+        event_inject(e->gpio, e->level, e->injected);
+        delivered++;
+
+        __sync_synchronize();
+        queue_tail++;
+    }
+    thread_sched_exit(THREAD_EVENT);
+    pthread_exit(NULL);
+}
+
+static int compare_ull(const void *a, const void *b)
+{
+    unsigned long long x = *(const unsigned long long *)a;
+    unsigned long long y = *(const unsigned long long *)b;
+    return (x > y) - (x < y);
+}
+
+static unsigned long long percentile(int pct)
+{
+    if (sample_count == 0)
+        return 0;
+    return samples[(sample_count - 1) * pct / 100];
+}
+
+static void end_run(void)
+{
+    pthread_mutex_lock(&run_lock);
+    run_busy = 0;
+    pthread_mutex_unlock(&run_lock);
+}
+
+int loadgen_run(const unsigned int *gpios, int count, double rate, double duration, struct loadgen_stats *stats)
+// return values:
+// 0 - Success
+// 1 - A gpio has no callback to deliver to
+// 2 - Invalid arguments
+// 3 - Out of memory
+// 4 - Unable to start the dispatch thread
+// 5 - Another run is in progress
+{
+    pthread_t thread;
+    struct loadgen_event *e;
+    unsigned long long start, period, deadline, now, end;
+    unsigned long k;
+    int levels[54] = { 0 };
+    int i;
+
+    if (count <= 0 || rate <= 0.0 || duration <= 0.0)
+        return 2;
+
+    for (i=0; i<count; i++) {
+        if (gpios[i] >= 54)
+            return 2;
+        if (!callback_exists(gpios[i]))
+            return 1;
+    }
+
+    pthread_mutex_lock(&run_lock);
+    if (run_busy) {
+        pthread_mutex_unlock(&run_lock);
+        return 5;
+    }
+    run_busy = 1;
+    pthread_mutex_unlock(&run_lock);
+
+    sample_max = (unsigned long)(rate * duration) + 1;
+    if (sample_max > LOADGEN_MAX_SAMPLES)
+        sample_max = LOADGEN_MAX_SAMPLES;
+    if ((samples = malloc(sample_max * sizeof(unsigned long long))) == NULL) {
+        end_run();
+        return 3;
+    }
+
+    memset(stats, 0, sizeof(struct loadgen_stats));
+    sample_count = 0;
+    delivered = 0;
+    queue_head = queue_tail = 0;
+    injecting = 1;
+    loadgen_running = 1;
+
+    if (pthread_create(&thread, NULL, dispatch_thread, NULL) != 0) {
+        injecting = 0;
+        loadgen_running = 0;
+        free(samples);
+        samples = NULL;
+        end_run();
+        return 4;
+    }
+
+    period = (unsigned long long)(1e9 / rate);
+    start = time_ns();
+    end = start + (unsigned long long)(duration * 1e9);
+    for (k=0; ; k++) {
+        deadline = start + k * period;
+        if (deadline >= end)
+            break;
+        now = time_ns();
+        if (deadline > now)
+            sleep_until_ns(deadline, 0);
+
+        i = k % count;
+        stats->injected++;
+        if (queue_head - queue_tail >= LOADGEN_QUEUE_SIZE) {
+            stats->dropped++;
+            continue;
+        }
+        levels[gpios[i]] = !levels[gpios[i]];
+        e = &queue[queue_head % LOADGEN_QUEUE_SIZE];
+        e->gpio = gpios[i];
+        e->level = levels[gpios[i]];
+        e->injected = time_ns();
+        __sync_synchronize();
+        queue_head++;
+    }
+
+    // let the dispatcher drain what is queued
+    injecting = 0;
+    pthread_join(thread, NULL);
+    loadgen_running = 0;
+    __sync_synchronize();
+    while (__atomic_load_n(&markers, __ATOMIC_ACQUIRE))    // a bridge on another thread may be adding a sample
+        sched_yield();
+    if (sample_count > sample_max)
+        sample_count = sample_max;
+
+    stats->elapsed = time_ns() - start;
+    stats->delivered = delivered;
+    qsort(samples, sample_count, sizeof(unsigned long long), compare_ull);
+    stats->latency_p50 = percentile(50);
+    stats->latency_p90 = percentile(90);
+    stats->latency_p99 = percentile(99);
+    stats->latency_max = percentile(100);
+
+    free(samples);
+    samples = NULL;
+    end_run();
+    return 0;
+}
@@ -0,0 +1,51 @@
+/*
+Based on RPi.GPIO by Ben Croston
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* Synthetic edge load generator
+
+   Injects edges on a set of gpios at a fixed rate into the event dispatch
+   path, without any hardware, and measures how quickly the registered
+   callbacks keep up.  Injected edges go through a bounded queue to a
+   separate dispatch thread; an edge that finds the queue full is dropped.
+
+   Latency is measured from injection to callback entry.  Injected edges
+   carry their injection time as the edge timestamp, and callback bridges
+   (Python, Node) call loadgen_mark() with it once per edge when they are
+   about to enter user code, from whichever thread runs that code. */
+
+#define LOADGEN_QUEUE_SIZE   4096
+#define LOADGEN_MAX_SAMPLES  (1 << 20)
+
+struct loadgen_stats
+{
+    unsigned long injected;
+    unsigned long delivered;
+    unsigned long dropped;
+    unsigned long long elapsed;     // ns
+    unsigned long long latency_p50; // ns
+    unsigned long long latency_p90;
+    unsigned long long latency_p99;
+    unsigned long long latency_max;
+};
+
+int loadgen_run(const unsigned int *gpios, int count, double rate, double duration, struct loadgen_stats *stats);
+void loadgen_mark(unsigned long long timestamp);
@@ -0,0 +1,197 @@
+/*
+Based on RPi.GPIO by Ben Croston
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "event_gpio.h"
+#include "event_trace.h"
+#include "timing.h"
+
+/* trace_fp and trace_last are guarded by trace_lock.  trace_fp and
+   trace_mask are also loaded atomically without it, for the checks made on
+   every edge; trace_record() only writes to trace_fp under the lock.  The
+   mask is kept per bank, as 64 bit atomics are not lock free on the Pi 1. */
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *trace_fp = NULL;
+static uint32_t trace_mask[2] = {0, 0};
+static unsigned long long trace_last = 0;
+
+int trace_start(const char *filename, unsigned long long gpio_mask)
+// return values:
+// 0 - Success
+// 1 - Trace already being recorded
+// 2 - Unable to create file
+{
+    struct trace_header hdr;
+    FILE *fp;
+
+    pthread_mutex_lock(&trace_lock);
+    if (trace_fp != NULL) {
+        pthread_mutex_unlock(&trace_lock);
+        return 1;
+    }
+
+    if ((fp = fopen(filename, "wb")) == NULL) {
+        pthread_mutex_unlock(&trace_lock);
+        return 2;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    strncpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+    hdr.version = TRACE_VERSION;
+    hdr.record_size = sizeof(struct trace_record);
+    hdr.gpio_mask = gpio_mask;
+    hdr.start = time_ns();
+
+    if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1) {
+        fclose(fp);
+        pthread_mutex_unlock(&trace_lock);
+        return 2;
+    }
+
+    trace_last = hdr.start;
+    __atomic_store_n(&trace_fp, fp, __ATOMIC_RELEASE);
+    __atomic_store_n(&trace_mask[0], (uint32_t)gpio_mask, __ATOMIC_RELEASE);
+    __atomic_store_n(&trace_mask[1], (uint32_t)(gpio_mask >> 32), __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&trace_lock);
+    return 0;
+}
+
+void trace_stop(void)
+{
+    pthread_mutex_lock(&trace_lock);
+    __atomic_store_n(&trace_mask[0], 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&trace_mask[1], 0, __ATOMIC_RELEASE);
+    if (trace_fp != NULL) {
+        fclose(trace_fp);
+        __atomic_store_n(&trace_fp, NULL, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&trace_lock);
+}
+
+int trace_active(void)
+{
+    return __atomic_load_n(&trace_fp, __ATOMIC_ACQUIRE) != NULL;
+}
+
+void trace_record(unsigned int gpio, int level, unsigned long long timestamp)
+{
+    struct trace_record rec;
+    unsigned long long delta;
+
+    // cheap check first - this is called from the poll thread for every edge
+    if (gpio >= 54 || !(__atomic_load_n(&trace_mask[gpio/32], __ATOMIC_ACQUIRE) & (1U << (gpio%32))))
+        return;
+
+    pthread_mutex_lock(&trace_lock);
+    if (trace_fp == NULL) {
+        pthread_mutex_unlock(&trace_lock);
+        return;
+    }
+
+    delta = timestamp > trace_last ? timestamp - trace_last : 0;
+    trace_last = timestamp;
+
+    memset(&rec, 0, sizeof(rec));
+    if (delta >> 32) {
+        rec.gpio = TRACE_GAP;
+        rec.delta = (uint32_t)(delta >> 32);
+        fwrite(&rec, sizeof(rec), 1, trace_fp);
+    }
+    rec.gpio = gpio;
+    rec.level = level ? 1 : 0;
+    rec.delta = (uint32_t)delta;
+    fwrite(&rec, sizeof(rec), 1, trace_fp);
+    pthread_mutex_unlock(&trace_lock);
+}
+
+long trace_replay(const char *filename, int realtime, unsigned long long *elapsed)
+// return values:
+// >= 0 - Number of events injected
+//   -1 - Unable to open or map file
+//   -2 - Not a valid trace file
+{
+    int fd;
+    struct stat st;
+    unsigned char *map;
+    struct trace_header *hdr;
+    struct trace_record *rec;
+    size_t count, i;
+    unsigned long long start, when, high = 0;
+    long events = 0;
+
+    if ((fd = open(filename, O_RDONLY)) < 0)
+        return -1;
+
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    if (st.st_size < (off_t)sizeof(struct trace_header)) {
+        close(fd);
+        return -2;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+
+    hdr = (struct trace_header *)map;
+    if (strncmp(hdr->magic, TRACE_MAGIC, sizeof(hdr->magic)) != 0 ||
+        hdr->version != TRACE_VERSION ||
+        hdr->record_size != sizeof(struct trace_record)) {
+        munmap(map, st.st_size);
+        return -2;
+    }
+
+    rec = (struct trace_record *)(map + sizeof(struct trace_header));
+    count = (st.st_size - sizeof(struct trace_header)) / sizeof(struct trace_record);
+    madvise(rec, count * sizeof(struct trace_record), MADV_SEQUENTIAL);
+
+    start = when = time_ns();
+    for (i=0; i<count; i++) {
+        if (rec[i].gpio == TRACE_GAP) {
+            high = (unsigned long long)rec[i].delta << 32;
+            continue;
+        }
+        when += high | rec[i].delta;
+        high = 0;
+        if (rec[i].gpio >= 54)
+            continue;
+        if (realtime)
+            sleep_until_ns(when, 0);
+        event_inject(rec[i].gpio, rec[i].level, realtime ? when : time_ns());
+        events++;
+    }
+
+    if (elapsed != NULL)
+        *elapsed = time_ns() - start;
+    munmap(map, st.st_size);
+    return events;
+}
@@ -0,0 +1,69 @@
+/*
+Based on RPi.GPIO by Ben Croston
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* Edge trace recording and replay
+
+   A trace file is a 32 byte header followed by fixed size 8 byte records,
+   so it can be mmap()ed and indexed directly.  All fields are little endian
+   (native on the Pi).
+
+   header:  char     magic[8]       "RPIOTRC"
+            uint32_t version        TRACE_VERSION
+            uint32_t record_size    sizeof(struct trace_record)
+            uint64_t gpio_mask      bit n set if gpio n was recorded
+            uint64_t start          monotonic time (ns) the trace started
+
+   record:  uint32_t delta          ns since the previous record (or start)
+            uint8_t  gpio           gpio number, or TRACE_GAP
+            uint8_t  level          level read when the edge was detected
+            uint16_t reserved
+
+   A TRACE_GAP record holds bits 32-63 of the delta of the record after it. */
+
+#include <stdint.h>
+
+#define TRACE_MAGIC   "RPIOTRC"
+#define TRACE_VERSION 1
+#define TRACE_GAP     0xff
+
+struct trace_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t gpio_mask;
+    uint64_t start;
+};
+
+struct trace_record
+{
+    uint32_t delta;
+    uint8_t gpio;
+    uint8_t level;
+    uint16_t reserved;
+};
+
+int trace_start(const char *filename, unsigned long long gpio_mask);
+void trace_stop(void);
+int trace_active(void);
+void trace_record(unsigned int gpio, int level, unsigned long long timestamp);
+long trace_replay(const char *filename, int realtime, unsigned long long *elapsed);
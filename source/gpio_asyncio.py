@@ -0,0 +1,94 @@
+# Based on RPi.GPIO by Ben Croston
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy of
+# this software and associated documentation files (the "Software"), to deal in
+# the Software without restriction, including without limitation the rights to
+# use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+# of the Software, and to permit persons to whom the Software is furnished to do
+# so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+"""Edge events for asyncio, read from the event fd of the GPIO module
+
+    GPIO.add_event_detect(17, GPIO.BOTH)
+    async with EdgeEvents(17) as events:
+        async for batch in events:
+            for channel, level, timestamp in batch:
+                ...
+
+Edges are queued by the edge detection thread and read on the loop, so no
+Python thread or GIL handoff is involved per edge.  Every EdgeEvents has its
+own event fd and queue, so any number of them can be open at once.
+"""
+
+import asyncio
+
+from RPi import _GPIO as GPIO
+
+
+class EdgeEvents(object):
+    """Async iterator over lists of (channel, level, timestamp) tuples
+
+    channel    - channel or list of channels, with edge detection added
+    max_events - most edges in one batch
+    loop       - loop to wait on, by default the running loop on first use
+    """
+
+    def __init__(self, channel, max_events=4096, loop=None):
+        self._loop = loop
+        self._max = max_events
+        self._fd = GPIO.event_fd(channel)
+        self._waiter = None
+        self._closed = False
+
+    def _readable(self):
+        # level triggered, so stop watching until the next wait
+        self._loop.remove_reader(self._fd)
+        if self._waiter is not None and not self._waiter.done():
+            self._waiter.set_result(None)
+
+    def __aiter__(self):
+        return self
+
+    async def __anext__(self):
+        if self._loop is None:
+            self._loop = asyncio.get_running_loop()
+        while not self._closed:
+            batch = GPIO.drain_events(self._fd, self._max)
+            if batch:
+                return batch
+            self._waiter = self._loop.create_future()
+            self._loop.add_reader(self._fd, self._readable)
+            try:
+                await self._waiter
+            finally:
+                self._loop.remove_reader(self._fd)
+                self._waiter = None
+        raise StopAsyncIteration
+
+    def close(self):
+        """Stop queueing edges and end the iteration"""
+        if self._closed:
+            return
+        self._closed = True
+        if self._loop is not None:
+            self._loop.remove_reader(self._fd)
+        if self._waiter is not None and not self._waiter.done():
+            self._waiter.set_result(None)
+        GPIO.close_event_fd(self._fd)
+
+    async def __aenter__(self):
+        return self
+
+    async def __aexit__(self, *exc):
+        self.close()
@@ -1,3 +1,265 @@
 'use strict';
+var EventEmitter = require('events');
+var stream = require('stream');
 var rpio = require("../build/Release/rpio.node")
+
+// The addon is also an EventEmitter:
+//   'edge'  (channel, level, timestamp) for each edge
+//   'edges' (channels, levels, timestamps) once per batch
+//   'overflow' (dropped) when edges were lost because the loop fell behind
+// Timestamps are nanoseconds on the monotonic clock used by process.hrtime().
+Object.setPrototypeOf(rpio, EventEmitter.prototype);
+EventEmitter.call(rpio);
+
+var callbacks = {};
+var detected = {};
+var edge_streams = [];
+
+var EDGE_RECORD_SIZE = 16;
+var FRAME_RECORD_SIZE = 24;
+var STREAM_QUEUE_MAX = 65536;
+
+// the native side calls this once per event loop turn with every edge
+// queued since the last call
+rpio.setEdgeHandler(function (channels, levels, timestamps, dropped) {
+  if (dropped) {
+    rpio.emit('overflow', dropped);
+    edge_streams.forEach(function (s) { s.stream.emit('overflow', dropped); });
+  }
+  if (channels.length === 0)
+    return;
+  push_edges(channels, levels, timestamps);
+  rpio.emit('edges', channels, levels, timestamps);
+  for (var i = 0; i < channels.length; i++) {
+    var cbs = callbacks[channels[i]];
+    if (cbs) {
+      for (var j = 0; j < cbs.length; j++)
+        cbs[j](channels[i], levels[i], timestamps[i]);
+    }
+    rpio.emit('edge', channels[i], levels[i], timestamps[i]);
+  }
+});
+
+function push_edges(channels, levels, timestamps) {
+  edge_streams.forEach(function (s) {
+    var dropped = 0;
+
+    for (var i = 0; i < channels.length; i++) {
+      if (s.channels && s.channels.indexOf(channels[i]) === -1)
+        continue;
+      if (s.pending.length - s.head >= s.limit)
+        dropped++;
+      else
+        s.pending.push({channel: channels[i], level: levels[i], timestamp: timestamps[i]});
+    }
+    if (dropped)
+      s.stream.emit('overflow', dropped);
+    flush_edges(s);
+  });
+}
+
+// hand a stream its pending edges until it is over its high water mark;
+// the rest wait in s.pending from s.head on, so a slow stream never holds
+// up the others
+function flush_edges(s) {
+  var i, n, record;
+
+  if (s.full || s.head === s.pending.length)
+    return;
+  if (s.objectMode) {
+    while (s.head < s.pending.length && !s.full)
+      s.full = !s.stream.push(s.pending[s.head++]);
+    if (s.head === s.pending.length) {
+      s.pending = [];
+      s.head = 0;
+    } else if (s.head >= 1024 && s.head * 2 >= s.pending.length) {
+      // drop what has been read once it is most of the array
+      s.pending = s.pending.slice(s.head);
+      s.head = 0;
+    }
+    return;
+  }
+  // binary records: uint32 channel, uint32 level, double timestamp
+  n = s.pending.length - s.head;
+  record = Buffer.alloc(n * EDGE_RECORD_SIZE);
+  for (i = 0; i < n; i++) {
+    record.writeUInt32LE(s.pending[s.head + i].channel, i * EDGE_RECORD_SIZE);
+    record.writeUInt32LE(s.pending[s.head + i].level, i * EDGE_RECORD_SIZE + 4);
+    record.writeDoubleLE(s.pending[s.head + i].timestamp, i * EDGE_RECORD_SIZE + 8);
+  }
+  s.pending = [];
+  s.head = 0;
+  s.full = !s.stream.push(record);
+}
+
+// createEdgeStream({channels, objectMode = true, highWaterMark, queueLimit = 65536})
+// a Readable of {channel, level, timestamp} objects, or of 16 byte records
+// when objectMode is false.  Edges are only queued for channels with event
+// detection added.  While the stream is not being read up to queueLimit
+// edges wait for it, edges beyond that are dropped for this stream alone and
+// reported with an 'overflow' event on it.
+rpio.createEdgeStream = function (options) {
+  options = options || {};
+  var entry = {
+    channels: options.channels === undefined ? null : [].concat(options.channels),
+    objectMode: options.objectMode !== false,
+    limit: options.queueLimit === undefined ? STREAM_QUEUE_MAX : options.queueLimit,
+    pending: [],
+    head: 0,
+    full: false
+  };
+
+  if (typeof entry.limit !== 'number' || !(entry.limit >= 1))
+    throw new RangeError('queueLimit must be at least 1');
+  entry.stream = new stream.Readable({
+    objectMode: entry.objectMode,
+    highWaterMark: options.highWaterMark,
+    read: function () {
+      entry.full = false;
+      flush_edges(entry);
+    },
+    destroy: function (err, callback) {
+      edge_streams.splice(edge_streams.indexOf(entry), 1);
+      entry.pending = [];
+      entry.head = 0;
+      callback(err);
+    }
+  });
+  edge_streams.push(entry);
+  return entry.stream;
+};
+
+function frame_buffer(chunk) {
+  var buf;
+
+  if (Buffer.isBuffer(chunk))
+    return chunk;
+  buf = Buffer.alloc(FRAME_RECORD_SIZE);
+  buf.writeUInt32LE(chunk.bank || 0, 0);
+  buf.writeUInt32LE(chunk.set || 0, 4);
+  buf.writeUInt32LE(chunk.clear || 0, 8);
+  buf.writeDoubleLE(chunk.time || 0, 16);
+  return buf;
+}
+
+// createFrameStream({objectMode = true, highWaterMark})
+// a Writable of {bank, set, clear, time} frames, or of Buffers holding whole
+// 24 byte records (uint32 bank, set, clear, zero, double time).  Each frame
+// is written at its time in nanoseconds on the process.hrtime() clock, or
+// at once when time is 0 or has passed.  Writes complete when the frames
+// are out, so the stream's buffering limits how far ahead a writer can get.
+rpio.createFrameStream = function (options) {
+  options = options || {};
+
+  var writev = function (chunks, callback) {
+    var buf = Buffer.concat(chunks.map(function (c) { return frame_buffer(c.chunk); }));
+    var promise;
+    try {
+      promise = rpio.writeFrames(buf);
+    } catch (err) {
+      return callback(err);
+    }
+    promise.then(function () { callback(); }, callback);
+  };
+
+  return new stream.Writable({
+    objectMode: options.objectMode !== false,
+    highWaterMark: options.highWaterMark,
+    write: function (chunk, encoding, callback) {
+      writev([{chunk: chunk}], callback);
+    },
+    writev: writev
+  });
+};
+
+var native_play_waveform = rpio.playWaveform;
+
+function step_buffer(step) {
+  var buf = Buffer.alloc(FRAME_RECORD_SIZE);
+
+  buf.writeUInt32LE(step.bank || 0, 0);
+  buf.writeUInt32LE(step.set || 0, 4);
+  buf.writeUInt32LE(step.clear || 0, 8);
+  buf.writeDoubleLE(step.delta || 0, 16);
+  return buf;
+}
+
+// playWaveform(steps, repeat = 1)
+// steps is an array of {delta, set, clear, bank} or a Buffer of 24 byte
+// records (uint32 bank, set, clear, zero, double delta), delta being the
+// nanoseconds (up to 1e9) after the previous step.  The steps are played
+// repeat times from a real time thread (WAVE_THREAD); the promise resolves
+// to how late each step was written in ns, the worst over the repeats.
+rpio.playWaveform = function (steps, repeat) {
+  if (Array.isArray(steps))
+    steps = Buffer.concat(steps.map(step_buffer));
+  return native_play_waveform(steps, repeat);
+};
+
+var native_add_event_detect = rpio.add_event_detect;
+var native_remove_event_detect = rpio.remove_event_detect;
+var native_cleanup = rpio.cleanup;
+var native_setup_async = rpio.setupAsync;
+
+// add_event_detect(channel, edge, callback?, bouncetime?)
+// callbacks are called as callback(channel, level, timestamp), with the level
+// and timestamp sampled on the edge detection thread when the edge was seen;
+// callbacks that only take the channel can ignore the rest
+rpio.add_event_detect = function (channel, edge, callback, bouncetime) {
+  if (typeof callback === 'number' && bouncetime === undefined) {
+    bouncetime = callback;
+    callback = undefined;
+  }
+  if (callback !== undefined && typeof callback !== 'function')
+    throw new TypeError('callback must be a function');
+  native_add_event_detect(channel, edge, bouncetime);
+  detected[channel] = true;
+  if (callback)
+    (callbacks[channel] = callbacks[channel] || []).push(callback);
+};
+
+// add_event_callback(channel, callback)
+rpio.add_event_callback = function (channel, callback) {
+  if (typeof callback !== 'function')
+    throw new TypeError('callback must be a function');
+  if (!detected[channel])
+    throw new Error('Add event detection using add_event_detect first before adding a callback');
+  (callbacks[channel] = callbacks[channel] || []).push(callback);
+};
+
+// setupAsync(channels, {direction, pull_up_down, initial, edge, bouncetime, callback})
+// configures the channels on the thread pool; with an edge, edge detection
+// is added to each of them before the promise resolves
+rpio.setupAsync = function (channels, options) {
+  var callback = options && options.callback;
+  if (callback !== undefined && typeof callback !== 'function')
+    throw new TypeError('callback must be a function');
+  return native_setup_async(channels, options).then(function () {
+    if (options.edge === undefined)
+      return;
+    [].concat(channels).forEach(function (channel) {
+      detected[channel] = true;
+      if (callback)
+        (callbacks[channel] = callbacks[channel] || []).push(callback);
+    });
+  });
+};
+
+rpio.remove_event_detect = function (channel) {
+  native_remove_event_detect(channel);
+  delete detected[channel];
+  delete callbacks[channel];
+};
+
+rpio.cleanup = function (channel) {
+  native_cleanup(channel);
+  if (channel === undefined) {
+    callbacks = {};
+    detected = {};
+  } else {
+    delete callbacks[channel];
+    delete detected[channel];
+  }
+};
+
 module.exports = rpio;
@@ -21,6 +21,7 @@ SOFTWARE.
 */
 
 #include <node.h>
+#include <uv.h>
 
 #include "node_common.hh"
 
@@ -30,8 +31,11 @@ extern "C" {
 
 using v8::String;
 using v8::Exception;
+using v8::External;
+using v8::Function;
+using v8::FunctionTemplate;
+using v8::Local;
 
-int gpio_mode = MODE_UNKNOWN;
 const int pin_to_gpio_rev1[41] = {-1, -1, -1, 0, -1, 1, -1, 4, 14, -1, 15, 17, 18, 21, -1, 22, 23, -1, 24, 10, -1, 9, 25, 11, 8, -1, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 };
 const int pin_to_gpio_rev2[41] = {-1, -1, -1, 2, -1, 3, -1, 4, 14, -1, 15, 17, 18, 27, -1, 22, 23, -1, 24, 10, -1, 9, 25, 11, 8, -1, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 };
 const int pin_to_gpio_rev3[41] = {-1, -1, -1, 2, -1, 3, -1, 4, 14, -1, 15, 17, 18, 27, -1, 22, 23, -1, 24, 10, -1, 9, 25, 11, 8, -1, 7, -1, -1, 5, -1, 6, 12, 13, -1, 19, 16, 26, 20, -1, 21 };
@@ -39,9 +43,65 @@ int setup_error = 0;
 int module_setup = 0;
 
 const int (*pin_to_gpio)[41];
-int gpio_direction[54];
 rpi_info rpiinfo;
 
+static uv_once_t core_once = UV_ONCE_INIT;
+static uv_mutex_t core_mutex;
+static AddonData* pin_owner[54];
+
+static void init_core_lock(void)
+{
+    uv_mutex_init(&core_mutex);
+}
+
+void core_lock(void)
+{
+    uv_once(&core_once, init_core_lock);
+    uv_mutex_lock(&core_mutex);
+}
+
+void core_unlock(void)
+{
+    uv_mutex_unlock(&core_mutex);
+}
+
+// returns 1 if another instance of the addon has set up the gpio
+int gpio_in_use(AddonData* addon, int gpio)
+{
+    return pin_owner[gpio] != NULL && pin_owner[gpio] != addon;
+}
+
+void claim_gpio(AddonData* addon, int gpio)
+{
+    pin_owner[gpio] = addon;
+}
+
+void release_gpio(AddonData* addon, int gpio)
+{
+    if (pin_owner[gpio] == addon)
+        pin_owner[gpio] = NULL;
+}
+
+AddonData* get_addon_data(const v8::FunctionCallbackInfo<v8::Value>& args)
+{
+    return static_cast<AddonData*>(args.Data().As<External>()->Value());
+}
+
+// like NODE_SET_METHOD, but the function carries the addon instance data
+void set_method(Local<v8::Object> exports, const char* name,
+                v8::FunctionCallback callback, AddonData* addon)
+{
+    v8::Isolate* isolate = exports->GetIsolate();
+    Local<v8::Context> context = isolate->GetCurrentContext();
+    Local<FunctionTemplate> tpl =
+        FunctionTemplate::New(isolate, callback, External::New(isolate, addon));
+    Local<Function> fn = tpl->GetFunction(context).ToLocalChecked();
+    Local<String> fn_name = String::NewFromUtf8(isolate, name);
+
+    fn->SetName(fn_name);
+    exports->Set(context, fn_name, fn).FromJust();
+}
+
 int check_gpio_priv(v8::Isolate* isolate)
 {
     // check module has been imported cleanly
@@ -60,26 +120,26 @@ int check_gpio_priv(v8::Isolate* isolate)
     return 0;
 }
 
-int get_gpio_number(v8::Isolate* isolate, int channel, int *gpio)
+int get_gpio_number(v8::Isolate* isolate, AddonData* addon, int channel, int *gpio)
 {
     // check setmode() has been run
-    if (gpio_mode != BOARD && gpio_mode != BCM)
+    if (addon->gpio_mode != BOARD && addon->gpio_mode != BCM)
     {
         isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "Please set pin numbering mode using GPIO.setmode(GPIO.BOARD) or GPIO.setmode(GPIO.BCM)")));
         return 3;
     }
 
     // check channel number is in range
-    if ( (gpio_mode == BCM && (channel < 0 || channel > 53))
-      || (gpio_mode == BOARD && (channel < 1 || channel > 26) && rpiinfo.p1_revision != 3)
-      || (gpio_mode == BOARD && (channel < 1 || channel > 40) && rpiinfo.p1_revision == 3) )
+    if ( (addon->gpio_mode == BCM && (channel < 0 || channel > 53))
+      || (addon->gpio_mode == BOARD && (channel < 1 || channel > 26) && rpiinfo.p1_revision != 3)
+      || (addon->gpio_mode == BOARD && (channel < 1 || channel > 40) && rpiinfo.p1_revision == 3) )
     {
         isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "The channel sent is invalid on a Raspberry Pi")));
         return 4;
     }
 
     // convert channel to gpio
-    if (gpio_mode == BOARD)
+    if (addon->gpio_mode == BOARD)
     {
         if (*(*pin_to_gpio+channel) == -1)
         {
@@ -89,10 +149,67 @@ int get_gpio_number(v8::Isolate* isolate, int channel, int *gpio)
             *gpio = *(*pin_to_gpio+channel);
         }
     }
-    else // gpio_mode == BCM
+    else // addon->gpio_mode == BCM
     {
         *gpio = channel;
     }
 
     return 0;
 }
+
+int chan_from_gpio(AddonData* addon, int gpio)
+{
+   int chan;
+   int chans;
+
+   if (addon->gpio_mode == BCM)
+      return gpio;
+   if (rpiinfo.p1_revision == 0)   // not applicable for compute module
+      return -1;
+   else if (rpiinfo.p1_revision == 1 || rpiinfo.p1_revision == 2)
+      chans = 26;
+   else
+      chans = 40;
+   for (chan=1; chan<=chans; chan++)
+      if (*(*pin_to_gpio+chan) == gpio)
+         return chan;
+   return -1;
+}
+
+// convert a channel or array of channels into gpio numbers
+// returns the number of gpios stored, or -1 with an exception thrown
+int get_gpio_list(v8::Isolate* isolate, AddonData* addon, Local<v8::Value> chanlist,
+                  unsigned int *gpios, int max)
+{
+    Local<v8::Array> list;
+    int gpio;
+
+    if (chanlist->IsNumber()) {
+        if (get_gpio_number(isolate, addon, chanlist->NumberValue(), &gpio))
+            return -1;
+        gpios[0] = gpio;
+        return 1;
+    }
+
+    if (!chanlist->IsArray()) {
+        isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Channel must be a number or an array of numbers")));
+        return -1;
+    }
+
+    list = Local<v8::Array>::Cast(chanlist);
+    if ((int)list->Length() > max) {
+        isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Too many channels")));
+        return -1;
+    }
+    for (uint32_t i=0; i<list->Length(); i++) {
+        Local<v8::Value> channel = list->Get(i);
+        if (!channel->IsNumber()) {
+            isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Channel must be a number")));
+            return -1;
+        }
+        if (get_gpio_number(isolate, addon, channel->NumberValue(), &gpio))
+            return -1;
+        gpios[i] = gpio;
+    }
+    return list->Length();
+}
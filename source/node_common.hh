@@ -34,15 +34,47 @@ extern "C" {
 #define I2C          42
 #define PWM          43
 
-extern int gpio_mode;
 extern const int pin_to_gpio_rev1[41];
 extern const int pin_to_gpio_rev2[41];
 extern const int pin_to_gpio_rev3[41];
 extern const int (*pin_to_gpio)[41];
-extern int gpio_direction[54];
 extern rpi_info rpiinfo;
 extern int setup_error;
 extern int module_setup;
 
+struct EventQueue;
+
+// pin state held by each instance of the addon, one per Node environment
+struct AddonData {
+  int gpio_mode;
+  int gpio_direction[54];
+  int gpio_warnings;
+  v8::Persistent<v8::Function> pwm_constructor;
+  EventQueue* events;
+};
+
+AddonData* get_addon_data(const v8::FunctionCallbackInfo<v8::Value>& args);
+void set_method(v8::Local<v8::Object> exports, const char* name,
+                v8::FunctionCallback callback, AddonData* addon);
 int check_gpio_priv(v8::Isolate* isolate);
-int get_gpio_number(v8::Isolate* isolate, int channel, int *gpio);
+int get_gpio_number(v8::Isolate* isolate, AddonData* addon, int channel, int *gpio);
+int get_gpio_list(v8::Isolate* isolate, AddonData* addon, v8::Local<v8::Value> chanlist,
+                  unsigned int *gpios, int max);
+int chan_from_gpio(AddonData* addon, int gpio);
+
+// every worker thread loads its own instance of the addon, but they share
+// one register mapping, the edge detection thread and the soft PWM threads.
+// Register read-modify-write sequences and the event_gpio and soft_pwm lists
+// are only touched while holding the core lock.
+void core_lock(void);
+void core_unlock(void);
+
+struct CoreLock {
+  CoreLock() { core_lock(); }
+  ~CoreLock() { core_unlock(); }
+};
+
+// pin ownership between instances, call with the core lock held
+int gpio_in_use(AddonData* addon, int gpio);
+void claim_gpio(AddonData* addon, int gpio);
+void release_gpio(AddonData* addon, int gpio);
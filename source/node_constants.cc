@@ -28,6 +28,7 @@ SOFTWARE.
 extern "C" {
 #include "c_gpio.h"
 #include "event_gpio.h"
+#include "thread_sched.h"
 }
 
 int high;
@@ -47,6 +48,12 @@ int pud_down;
 int rising_edge;
 int falling_edge;
 int both_edge;
+int event_thread_class;
+int pwm_thread_class;
+int wave_thread_class;
+int sched_other;
+int sched_fifo;
+int sched_rr;
 
 // adapted from node.h
 #define MY_DEFINE_CONSTANT(target, constant, str)                             \
@@ -118,4 +125,22 @@ void define_constants(const v8::Local<v8::Object>& exports)
 
    both_edge = BOTH_EDGE + PY_EVENT_CONST_OFFSET;
    MY_DEFINE_CONSTANT(exports, both_edge, "BOTH_EDGE");
+
+   event_thread_class = THREAD_EVENT;
+   MY_DEFINE_CONSTANT(exports, event_thread_class, "EVENT_THREAD");
+
+   pwm_thread_class = THREAD_PWM;
+   MY_DEFINE_CONSTANT(exports, pwm_thread_class, "PWM_THREAD");
+
+   wave_thread_class = THREAD_WAVE;
+   MY_DEFINE_CONSTANT(exports, wave_thread_class, "WAVE_THREAD");
+
+   sched_other = SCHED_OTHER;
+   MY_DEFINE_CONSTANT(exports, sched_other, "SCHED_OTHER");
+
+   sched_fifo = SCHED_FIFO;
+   MY_DEFINE_CONSTANT(exports, sched_fifo, "SCHED_FIFO");
+
+   sched_rr = SCHED_RR;
+   MY_DEFINE_CONSTANT(exports, sched_rr, "SCHED_RR");
 }
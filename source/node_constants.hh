@@ -42,5 +42,11 @@ extern int pud_down;
 extern int rising_edge;
 extern int falling_edge;
 extern int both_edge;
+extern int event_thread_class;
+extern int pwm_thread_class;
+extern int wave_thread_class;
+extern int sched_other;
+extern int sched_fifo;
+extern int sched_rr;
 
 void define_constants(const v8::Local<v8::Object>& exports);
@@ -0,0 +1,879 @@
+/*
+Based on RPi.GPIO by Ben Croston
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* Edge events for Node.  The poll thread queues each edge with its level
+   and timestamp, and one uv_async_t per addon instance drains everything
+   queued in a single call into JavaScript per event loop turn. */
+
+#include <node.h>
+#include <uv.h>
+#include <errno.h>
+#include <string.h>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "node_constants.hh"
+#include "node_common.hh"
+#include "node_event.hh"
+
+extern "C" {
+#include "c_gpio.h"
+#include "event_gpio.h"
+#include "event_loadgen.h"
+#include "event_trace.h"
+}
+
+using v8::FunctionCallbackInfo;
+using v8::Isolate;
+using v8::Object;
+using v8::Local;
+using v8::String;
+using v8::Number;
+using v8::Value;
+using v8::Exception;
+using v8::Context;
+using v8::Array;
+using v8::Boolean;
+using v8::Function;
+using v8::HandleScope;
+using v8::Promise;
+
+// queued edges beyond the queue limit are dropped and counted until the
+// loop catches up
+#define EVENT_QUEUE_MAX 65536
+
+struct edge_event
+{
+  unsigned int gpio;
+  int level;
+  unsigned long long timestamp;
+};
+
+struct EdgeWait;
+
+struct EventQueue {
+  AddonData* addon;
+  Isolate* isolate;
+  uv_async_t async;
+  std::vector<edge_event> pending;   // guarded by queue_lock
+  unsigned long dropped;             // guarded by queue_lock
+  size_t limit;                      // guarded by queue_lock
+  int watched;                       // channels delivering to this queue
+  v8::Persistent<Function> handler;
+  node::AsyncResource* resource;
+  std::set<EdgeWait*> waits;         // pending waitForEdge() calls
+};
+
+static uv_mutex_t queue_lock;
+static uv_once_t queue_lock_once = UV_ONCE_INIT;
+static EventQueue* event_owner[54];    // guarded by queue_lock
+
+static void init_queue_lock(void)
+{
+  uv_mutex_init(&queue_lock);
+}
+
+// edge callback, run on the poll thread
+static void queue_edge(unsigned int gpio, int level, unsigned long long timestamp)
+{
+  EventQueue* q;
+
+  uv_mutex_lock(&queue_lock);
+  if ((q = event_owner[gpio]) != NULL) {
+    if (q->pending.size() < q->limit) {
+      edge_event e = {gpio, level, timestamp};
+      q->pending.push_back(e);
+    } else {
+      q->dropped++;
+    }
+    uv_async_send(&q->async);
+  }
+  uv_mutex_unlock(&queue_lock);
+}
+
+// runs on the event loop: hand every queued edge to the handler in one call
+static void drain_edges(uv_async_t* handle)
+{
+  EventQueue* q = static_cast<EventQueue*>(handle->data);
+  std::vector<edge_event> events;
+  unsigned long dropped;
+
+  uv_mutex_lock(&queue_lock);
+  events.swap(q->pending);
+  dropped = q->dropped;
+  q->dropped = 0;
+  uv_mutex_unlock(&queue_lock);
+
+  if ((events.empty() && !dropped) || q->handler.IsEmpty())
+    return;
+
+  Isolate* isolate = q->isolate;
+  HandleScope scope(isolate);
+  Local<Context> context = isolate->GetCurrentContext();
+  Local<Array> channels = Array::New(isolate, events.size());
+  Local<Array> levels = Array::New(isolate, events.size());
+  Local<Array> timestamps = Array::New(isolate, events.size());
+
+  for (size_t i=0; i<events.size(); i++) {
+    channels->Set(context, i, Number::New(isolate, chan_from_gpio(q->addon, events[i].gpio))).FromJust();
+    levels->Set(context, i, Number::New(isolate, events[i].level)).FromJust();
+    timestamps->Set(context, i, Number::New(isolate, (double)events[i].timestamp)).FromJust();
+  }
+
+  // event load latency runs up to the handler
+  for (size_t i=0; i<events.size(); i++)
+    loadgen_mark(events[i].timestamp);
+
+  Local<Value> argv[] = { channels, levels, timestamps, Number::New(isolate, dropped) };
+  q->resource->MakeCallback(Local<Function>::New(isolate, q->handler), 4, argv);
+}
+
+// start or stop delivering a gpio's edges to this instance; the handle
+// only keeps the loop alive while some channel is delivering.  Call from
+// the instance's own loop thread.
+// return values:
+// 0 - Success
+// 1 - Another instance is watching the gpio
+static int watch_gpio(EventQueue* q, unsigned int gpio, int watch)
+{
+  int result = 0;
+
+  uv_mutex_lock(&queue_lock);
+  if (watch && event_owner[gpio] == NULL) {
+    event_owner[gpio] = q;
+    q->watched++;
+  } else if (watch && event_owner[gpio] != q) {
+    result = 1;
+  } else if (!watch && event_owner[gpio] == q) {
+    event_owner[gpio] = NULL;
+    q->watched--;
+  }
+
+  if (q->watched)
+    uv_ref(reinterpret_cast<uv_handle_t*>(&q->async));
+  else
+    uv_unref(reinterpret_cast<uv_handle_t*>(&q->async));
+  uv_mutex_unlock(&queue_lock);
+  return result;
+}
+
+int check_edge(Isolate* isolate, int& edge)
+{
+  edge -= PY_EVENT_CONST_OFFSET;
+  if (edge != RISING_EDGE && edge != FALLING_EDGE && edge != BOTH_EDGE)
+  {
+    isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "The edge must be set to RISING_EDGE, FALLING_EDGE or BOTH_EDGE")));
+    return 1;
+  }
+  return 0;
+}
+
+// start edge detection on a line and deliver its edges to this instance,
+// call with the core lock held
+// return values:
+// 0 - Success
+// 1 - Conflicting edge detection already enabled, or another instance has the line
+// 2 - Failed to add edge detection
+// 3 - No memory
+int events_add_detect(AddonData* addon, unsigned int gpio, int edge, int bouncetime)
+{
+  int result;
+
+  // another worker thread's line
+  if (gpio_in_use(addon, gpio))
+    return 1;
+  if ((result = add_edge_detect(gpio, edge, bouncetime)) != 0)   // starts a thread
+    return result;
+  if (!callback_exists(gpio) && add_edge_callback_ex(gpio, queue_edge) != 0)
+    return 3;
+  return watch_gpio(addon->events, gpio, 1);
+}
+
+// stop delivering a line's edges to this instance, so its handle no
+// longer keeps the loop alive once nothing else is watched
+void events_unwatch(AddonData* addon, unsigned int gpio)
+{
+  watch_gpio(addon->events, gpio, 0);
+}
+
+// node function add_event_detect(channel, edge, bouncetime?)
+static void
+export_add_event_detect(const FunctionCallbackInfo<Value>& args)
+{
+  int gpio, channel, edge, result;
+  int bouncetime = -666;
+
+  Isolate* isolate = args.GetIsolate();
+  AddonData* addon = get_addon_data(args);
+
+  if (args.Length() < 2 || !args[0]->IsNumber() || !args[1]->IsNumber()) {
+    isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "add_event_detect() expected a channel and an edge")));
+    return;
+  }
+  channel = args[0]->NumberValue();
+  edge = args[1]->NumberValue();
+
+  if (args.Length() > 2 && !args[2]->IsUndefined() && !args[2]->IsNull()) {
+    if (!args[2]->IsNumber()) {
+      isolate->ThrowException(Exception::TypeError(
+          String::NewFromUtf8(isolate, "bouncetime must be a number")));
+      return;
+    }
+    bouncetime = args[2]->NumberValue();
+    if (bouncetime <= 0) {
+      isolate->ThrowException(Exception::Error(
+          String::NewFromUtf8(isolate, "Bouncetime must be greater than 0")));
+      return;
+    }
+  }
+
+  if (get_gpio_number(isolate, addon, channel, &gpio))
+    return;
+
+  // check channel is set up as an input
+  if (addon->gpio_direction[gpio] != INPUT)
+  {
+    isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "You must setup() the GPIO channel as an input first")));
+    return;
+  }
+
+  if (check_edge(isolate, edge))
+    return;
+
+  if (check_gpio_priv(isolate))
+    return;
+
+  CoreLock lock;
+  result = events_add_detect(addon, gpio, edge, bouncetime);
+  if (result == 1)
+    isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "Conflicting edge detection already enabled for this GPIO channel")));
+  else if (result == 2)
+    isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "Failed to add edge detection")));
+  else if (result == 3)
+    isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "No memory")));
+}
+
+// node function remove_event_detect(channel)
+static void
+export_remove_event_detect(const FunctionCallbackInfo<Value>& args)
+{
+  int gpio;
+
+  Isolate* isolate = args.GetIsolate();
+  AddonData* addon = get_addon_data(args);
+
+  if (args.Length() < 1 || !args[0]->IsNumber()) {
+    isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "channel must be a number")));
+    return;
+  }
+
+  if (get_gpio_number(isolate, addon, args[0]->NumberValue(), &gpio))
+    return;
+
+  if (check_gpio_priv(isolate))
+    return;
+
+  // leave lines another worker thread is watching alone
+  CoreLock lock;
+  if (gpio_in_use(addon, gpio))
+    return;
+
+  watch_gpio(addon->events, gpio, 0);
+  remove_edge_detect(gpio);   // also drops the bridge callback
+}
+
+// node function value = event_detected(channel)
+static void
+export_event_detected(const FunctionCallbackInfo<Value>& args)
+{
+  int gpio;
+
+  Isolate* isolate = args.GetIsolate();
+  AddonData* addon = get_addon_data(args);
+
+  if (args.Length() < 1 || !args[0]->IsNumber()) {
+    isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "channel must be a number")));
+    return;
+  }
+
+  if (get_gpio_number(isolate, addon, args[0]->NumberValue(), &gpio))
+    return;
+
+  args.GetReturnValue().Set(Boolean::New(isolate, event_detected(gpio)));
+}
+
+// node function channel = wait_for_edge(channel, edge, bouncetime?, timeout?)
+static void
+export_wait_for_edge(const FunctionCallbackInfo<Value>& args)
+{
+  int gpio, channel, edge, result;
+  int bouncetime = -666;
+  int timeout = -1;
+
+  Isolate* isolate = args.GetIsolate();
+  AddonData* addon = get_addon_data(args);
+
+  if (args.Length() < 2 || !args[0]->IsNumber() || !args[1]->IsNumber()) {
+    isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "wait_for_edge() expected a channel and an edge")));
+    return;
+  }
+  channel = args[0]->NumberValue();
+  edge = args[1]->NumberValue();
+  if (args.Length() > 2 && args[2]->IsNumber())
+    bouncetime = args[2]->NumberValue();
+  if (args.Length() > 3 && args[3]->IsNumber())
+    timeout = args[3]->NumberValue();
+
+  if (get_gpio_number(isolate, addon, channel, &gpio))
+    return;
+
+  // check channel is setup as an input
+  if (addon->gpio_direction[gpio] != INPUT)
+  {
+    isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "You must setup() the GPIO channel as an input first")));
+    return;
+  }
+
+  if (check_edge(isolate, edge))
+    return;
+
+  if (bouncetime <= 0 && bouncetime != -666)
+  {
+    isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "Bouncetime must be greater than 0")));
+    return;
+  }
+
+  if (timeout <= 0 && timeout != -1)
+  {
+    isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "Timeout must be greater than 0")));
+    return;
+  }
+
+  if (check_gpio_priv(isolate))
+    return;
+
+  result = blocking_wait_for_edge(gpio, edge, bouncetime, timeout);
+  if (result == 0) {
+    args.GetReturnValue().Set(v8::Null(isolate));
+  } else if (result == -1) {
+    isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "Conflicting edge detection events already exist for this GPIO channel")));
+  } else if (result == -2) {
+    isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "Error waiting for edge")));
+  } else {
+    args.GetReturnValue().Set(Number::New(isolate, channel));
+  }
+}
+
+/* waitForEdge(): each wait watches its own value file with a uv_poll_t,
+   plus a uv_timer_t for the timeout, so a pending wait costs one fd in the
+   loop's epoll set and no thread */
+struct EdgeWait {
+  EventQueue* queue;
+  Isolate* isolate;
+  uv_poll_t poll;
+  uv_timer_t timer;
+  int fd;
+  unsigned int gpio;
+  int channel;
+  unsigned long long lastcall;    // bounce state of this wait alone
+  int closing;    // handles still to close
+  v8::Persistent<Promise::Resolver> resolver;
+};
+
+static void free_wait(uv_handle_t* handle)
+{
+  EdgeWait* wait = static_cast<EdgeWait*>(handle->data);
+
+  if (--wait->closing == 0) {
+    edge_wait_close(wait->fd);
+    wait->resolver.Reset();
+    delete wait;
+  }
+}
+
+static void end_wait(EdgeWait* wait)
+{
+  wait->queue->waits.erase(wait);
+  wait->closing = 2;
+  uv_close(reinterpret_cast<uv_handle_t*>(&wait->poll), free_wait);
+  uv_close(reinterpret_cast<uv_handle_t*>(&wait->timer), free_wait);
+}
+
+// settle the wait's Promise with the channel, null on timeout, or an error
+static void settle_wait(EdgeWait* wait, int found, const char* error)
+{
+  Isolate* isolate = wait->isolate;
+  HandleScope scope(isolate);
+  Local<Context> context = isolate->GetCurrentContext();
+  Local<Promise::Resolver> resolver = Local<Promise::Resolver>::New(isolate, wait->resolver);
+  node::CallbackScope callback_scope(isolate, Object::New(isolate), node::async_context{0, 0});
+
+  end_wait(wait);
+  if (error)
+    resolver->Reject(context, Exception::Error(String::NewFromUtf8(isolate, error))).FromJust();
+  else if (found)
+    resolver->Resolve(context, Number::New(isolate, wait->channel)).FromJust();
+  else
+    resolver->Resolve(context, v8::Null(isolate)).FromJust();
+}
+
+static void wait_edge_ready(uv_poll_t* handle, int status, int events)
+{
+  EdgeWait* wait = static_cast<EdgeWait*>(handle->data);
+  int level, result;
+
+  if (status < 0) {
+    settle_wait(wait, 0, "Error waiting for edge");
+    return;
+  }
+
+  core_lock();
+  result = edge_wait_ready(wait->gpio, wait->fd, &wait->lastcall, &level);
+  core_unlock();
+  if (result == 1)
+    settle_wait(wait, 1, NULL);
+  else if (result < 0)
+    settle_wait(wait, 0, "Error waiting for edge");
+  // else a bounce, keep waiting
+}
+
+static void wait_edge_timeout(uv_timer_t* handle)
+{
+  settle_wait(static_cast<EdgeWait*>(handle->data), 0, NULL);
+}
+
+// node function promise = waitForEdge(channel, edge, {timeout, bouncetime})
+static void
+export_wait_for_edge_async(const FunctionCallbackInfo<Value>& args)
+{
+  int gpio, channel, edge, fd;
+  int bouncetime = -666;
+  int timeout = -1;
+
+  Isolate* isolate = args.GetIsolate();
+  AddonData* addon = get_addon_data(args);
+  Local<Context> context = isolate->GetCurrentContext();
+
+  if (args.Length() < 2 || !args[0]->IsNumber() || !args[1]->IsNumber()) {
+    isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "waitForEdge() expected a channel and an edge")));
+    return;
+  }
+  channel = args[0]->NumberValue();
+  edge = args[1]->NumberValue();
+
+  if (args.Length() > 2 && args[2]->IsObject()) {
+    Local<Object> options = args[2]->ToObject();
+    Local<Value> value;
+
+    value = options->Get(context, String::NewFromUtf8(isolate, "timeout")).ToLocalChecked();
+    if (value->IsNumber())
+      timeout = value->NumberValue();
+    value = options->Get(context, String::NewFromUtf8(isolate, "bouncetime")).ToLocalChecked();
+    if (value->IsNumber())
+      bouncetime = value->NumberValue();
+  }
+
+  if (get_gpio_number(isolate, addon, channel, &gpio))
+    return;
+
+  // check channel is setup as an input
+  if (addon->gpio_direction[gpio] != INPUT)
+  {
+    isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "You must setup() the GPIO channel as an input first")));
+    return;
+  }
+
+  if (check_edge(isolate, edge))
+    return;
+
+  if (bouncetime <= 0 && bouncetime != -666)
+  {
+    isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "Bouncetime must be greater than 0")));
+    return;
+  }
+
+  if (timeout <= 0 && timeout != -1)
+  {
+    isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "Timeout must be greater than 0")));
+    return;
+  }
+
+  if (check_gpio_priv(isolate))
+    return;
+
+  core_lock();
+  fd = edge_wait_open(gpio, edge, bouncetime);
+  core_unlock();
+  if (fd < 0) {
+    if (fd == -1)
+      isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "Conflicting edge detection events already exist for this GPIO channel")));
+    else
+      isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "Error waiting for edge")));
+    return;
+  }
+
+  uv_loop_t* loop = node::GetCurrentEventLoop(isolate);
+  Local<Promise::Resolver> resolver = Promise::Resolver::New(context).ToLocalChecked();
+  EdgeWait* wait = new EdgeWait();
+
+  wait->queue = addon->events;
+  wait->isolate = isolate;
+  wait->fd = fd;
+  wait->gpio = gpio;
+  wait->channel = channel;
+  wait->lastcall = 0;
+  wait->resolver.Reset(isolate, resolver);
+  wait->poll.data = wait;
+  wait->timer.data = wait;
+  uv_poll_init(loop, &wait->poll, fd);
+  uv_timer_init(loop, &wait->timer);
+  uv_poll_start(&wait->poll, UV_PRIORITIZED, wait_edge_ready);
+  if (timeout != -1)
+    uv_timer_start(&wait->timer, wait_edge_timeout, timeout, 0);
+  addon->events->waits.insert(wait);
+
+  args.GetReturnValue().Set(resolver->GetPromise());
+}
+
+// node function setEdgeHandler(function(channels, levels, timestamps, dropped))
+static void
+export_set_edge_handler(const FunctionCallbackInfo<Value>& args)
+{
+  Isolate* isolate = args.GetIsolate();
+  AddonData* addon = get_addon_data(args);
+
+  if (args.Length() < 1 || !args[0]->IsFunction()) {
+    isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "setEdgeHandler() expected a function")));
+    return;
+  }
+  addon->events->handler.Reset(isolate, Local<Function>::Cast(args[0]));
+}
+
+// node function setEdgeQueueLimit(limit)
+static void
+export_set_edge_queue_limit(const FunctionCallbackInfo<Value>& args)
+{
+  Isolate* isolate = args.GetIsolate();
+  EventQueue* q = get_addon_data(args)->events;
+  double limit;
+
+  if (args.Length() < 1 || !args[0]->IsNumber() ||
+      (limit = args[0]->NumberValue()) < 1 || limit > EVENT_QUEUE_MAX) {
+    isolate->ThrowException(Exception::Error(
+        String::NewFromUtf8(isolate, "The queue limit must be from 1 to 65536 edges")));
+    return;
+  }
+
+  uv_mutex_lock(&queue_lock);
+  q->limit = (size_t)limit;
+  uv_mutex_unlock(&queue_lock);
+}
+
+// node function startTrace(filename, channels)
+static void
+export_start_trace(const FunctionCallbackInfo<Value>& args)
+{
+  unsigned int gpios[54];
+  unsigned long long mask = 0;
+  int count, result;
+
+  Isolate* isolate = args.GetIsolate();
+  AddonData* addon = get_addon_data(args);
+
+  if (args.Length() < 2 || !args[0]->IsString()) {
+    isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "startTrace() expected a filename and channels")));
+    return;
+  }
+  String::Utf8Value filename(isolate, args[0]);
+
+  if ((count = get_gpio_list(isolate, addon, args[1], gpios, 54)) < 0)
+    return;
+  for (int i=0; i<count; i++)
+    mask |= 1ULL << gpios[i];
+
+  if ((result = trace_start(*filename, mask)) != 0) {
+    if (result == 1)
+      isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "A trace is already being recorded")));
+    else
+      isolate->ThrowException(node::ErrnoException(isolate, errno, "open", NULL, *filename));
+  }
+}
+
+// node function stopTrace()
+static void
+export_stop_trace(const FunctionCallbackInfo<Value>& args)
+{
+  trace_stop();
+}
+
+/* Preparing lines, trace replay and the load generator block for as long
+   as they run, so they run on the libuv thread pool and settle a Promise,
+   leaving the event loop free to deliver the edges they inject */
+struct EventWork {
+  uv_work_t req;
+  Isolate* isolate;
+  v8::Persistent<Promise::Resolver> resolver;
+  std::string filename;
+  int realtime;
+  long events;
+  unsigned int gpios[54];
+  int count;
+  double rate;
+  double duration;
+  int result;
+  int error;
+  unsigned long long elapsed;
+  struct loadgen_stats stats;
+};
+
+// event_pool_prepare() has its own lock, so the core lock is not held
+// while it waits for udev
+static void prepare_work(uv_work_t* req)
+{
+  EventWork* work = static_cast<EventWork*>(req->data);
+  work->result = event_pool_prepare(work->gpios, work->count);
+}
+
+static void replay_work(uv_work_t* req)
+{
+  EventWork* work = static_cast<EventWork*>(req->data);
+  work->events = trace_replay(work->filename.c_str(), work->realtime, &work->elapsed);
+  work->error = errno;
+}
+
+static void loadgen_work(uv_work_t* req)
+{
+  EventWork* work = static_cast<EventWork*>(req->data);
+  work->result = loadgen_run(work->gpios, work->count, work->rate, work->duration, &work->stats);
+}
+
+static void set_field(Isolate* isolate, Local<Object> obj, const char* name, double value)
+{
+  obj->Set(isolate->GetCurrentContext(), String::NewFromUtf8(isolate, name),
+           Number::New(isolate, value)).FromJust();
+}
+
+static void settle_work(uv_work_t* req, int status)
+{
+  EventWork* work = static_cast<EventWork*>(req->data);
+  Isolate* isolate = work->isolate;
+  HandleScope scope(isolate);
+  Local<Context> context = isolate->GetCurrentContext();
+  Local<Promise::Resolver> resolver = Local<Promise::Resolver>::New(isolate, work->resolver);
+  node::CallbackScope callback_scope(isolate, Object::New(isolate), node::async_context{0, 0});
+  Local<Object> result = Object::New(isolate);
+
+  if (req->work_cb == prepare_work) {
+    if (work->result != 0)
+      resolver->Reject(context, Exception::Error(String::NewFromUtf8(isolate, "Failed to prepare edge detection for all channels"))).FromJust();
+    else
+      resolver->Resolve(context, Undefined(isolate)).FromJust();
+  } else if (req->work_cb == replay_work) {
+    if (work->events == -1) {
+      resolver->Reject(context, node::ErrnoException(isolate, work->error, "open", NULL, work->filename.c_str())).FromJust();
+    } else if (work->events == -2) {
+      resolver->Reject(context, Exception::Error(String::NewFromUtf8(isolate, "Not a valid trace file"))).FromJust();
+    } else {
+      set_field(isolate, result, "events", work->events);
+      set_field(isolate, result, "seconds", work->elapsed / 1e9);
+      resolver->Resolve(context, result).FromJust();
+    }
+  } else if (work->result == 1) {
+    resolver->Reject(context, Exception::Error(String::NewFromUtf8(isolate, "Add a callback to every channel using add_event_detect() or add_event_callback() first"))).FromJust();
+  } else if (work->result == 2) {
+    resolver->Reject(context, Exception::Error(String::NewFromUtf8(isolate, "Invalid load parameters"))).FromJust();
+  } else if (work->result == 3) {
+    resolver->Reject(context, Exception::Error(String::NewFromUtf8(isolate, "No memory"))).FromJust();
+  } else if (work->result == 5) {
+    resolver->Reject(context, Exception::Error(String::NewFromUtf8(isolate, "Another eventLoad() is already running"))).FromJust();
+  } else if (work->result != 0) {
+    resolver->Reject(context, Exception::Error(String::NewFromUtf8(isolate, "Failed to start the load generator"))).FromJust();
+  } else {
+    struct loadgen_stats* stats = &work->stats;
+    set_field(isolate, result, "injected", stats->injected);
+    set_field(isolate, result, "delivered", stats->delivered);
+    set_field(isolate, result, "dropped", stats->dropped);
+    set_field(isolate, result, "seconds", stats->elapsed / 1e9);
+    set_field(isolate, result, "rate", stats->elapsed ? stats->delivered * 1e9 / stats->elapsed : 0.0);
+    set_field(isolate, result, "latencyP50", stats->latency_p50 / 1e9);
+    set_field(isolate, result, "latencyP90", stats->latency_p90 / 1e9);
+    set_field(isolate, result, "latencyP99", stats->latency_p99 / 1e9);
+    set_field(isolate, result, "latencyMax", stats->latency_max / 1e9);
+    resolver->Resolve(context, result).FromJust();
+  }
+
+  work->resolver.Reset();
+  delete work;
+}
+
+static void queue_event_work(const FunctionCallbackInfo<Value>& args, EventWork* work, uv_work_cb cb)
+{
+  Isolate* isolate = args.GetIsolate();
+  Local<Promise::Resolver> resolver =
+      Promise::Resolver::New(isolate->GetCurrentContext()).ToLocalChecked();
+
+  work->isolate = isolate;
+  work->resolver.Reset(isolate, resolver);
+  work->req.data = work;
+  uv_queue_work(node::GetCurrentEventLoop(isolate), &work->req, cb, settle_work);
+  args.GetReturnValue().Set(resolver->GetPromise());
+}
+
+// node function promise = prepareEventDetect(channels)
+static void
+export_prepare_event_detect(const FunctionCallbackInfo<Value>& args)
+{
+  unsigned int gpios[54];
+  int count;
+
+  Isolate* isolate = args.GetIsolate();
+  AddonData* addon = get_addon_data(args);
+
+  if ((count = get_gpio_list(isolate, addon, args[0], gpios, 54)) < 0)
+    return;
+
+  if (check_gpio_priv(isolate))
+    return;
+
+  EventWork* work = new EventWork();
+  memcpy(work->gpios, gpios, sizeof(gpios));
+  work->count = count;
+  queue_event_work(args, work, prepare_work);
+}
+
+// node function promise = replayTrace(filename, realtime=true)
+static void
+export_replay_trace(const FunctionCallbackInfo<Value>& args)
+{
+  Isolate* isolate = args.GetIsolate();
+
+  if (args.Length() < 1 || !args[0]->IsString()) {
+    isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "replayTrace() expected a filename")));
+    return;
+  }
+
+  EventWork* work = new EventWork();
+  work->filename = *String::Utf8Value(isolate, args[0]);
+  work->realtime = args.Length() < 2 || args[1]->IsUndefined() || args[1]->BooleanValue();
+  queue_event_work(args, work, replay_work);
+}
+
+// node function promise = eventLoad(channels, rate, duration=1.0)
+static void
+export_event_load(const FunctionCallbackInfo<Value>& args)
+{
+  unsigned int gpios[54];
+  int count;
+
+  Isolate* isolate = args.GetIsolate();
+  AddonData* addon = get_addon_data(args);
+
+  if (args.Length() < 2 || !args[1]->IsNumber()) {
+    isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "eventLoad() expected channels and a rate")));
+    return;
+  }
+
+  if ((count = get_gpio_list(isolate, addon, args[0], gpios, 54)) < 0)
+    return;
+
+  EventWork* work = new EventWork();
+  memcpy(work->gpios, gpios, sizeof(gpios));
+  work->count = count;
+  work->rate = args[1]->NumberValue();
+  work->duration = args.Length() > 2 && args[2]->IsNumber() ? args[2]->NumberValue() : 1.0;
+  if (work->rate <= 0.0 || work->duration <= 0.0) {
+    delete work;
+    isolate->ThrowException(Exception::Error(
+        String::NewFromUtf8(isolate, "rate and duration must be greater than 0")));
+    return;
+  }
+  queue_event_work(args, work, loadgen_work);
+}
+
+void events_init(Local<Object> exports, AddonData* addon)
+{
+  Isolate* isolate = exports->GetIsolate();
+  EventQueue* q = new EventQueue();
+
+  uv_once(&queue_lock_once, init_queue_lock);
+
+  q->addon = addon;
+  q->isolate = isolate;
+  q->dropped = 0;
+  q->limit = EVENT_QUEUE_MAX;
+  q->watched = 0;
+  q->resource = new node::AsyncResource(isolate, Object::New(isolate), "RPIO_EDGE");
+  q->async.data = q;
+  uv_async_init(node::GetCurrentEventLoop(isolate), &q->async, drain_edges);
+  uv_unref(reinterpret_cast<uv_handle_t*>(&q->async));
+  addon->events = q;
+
+  set_method(exports, "add_event_detect", export_add_event_detect, addon);
+  set_method(exports, "remove_event_detect", export_remove_event_detect, addon);
+  set_method(exports, "event_detected", export_event_detected, addon);
+  set_method(exports, "wait_for_edge", export_wait_for_edge, addon);
+  set_method(exports, "waitForEdge", export_wait_for_edge_async, addon);
+  set_method(exports, "setEdgeHandler", export_set_edge_handler, addon);
+  set_method(exports, "setEdgeQueueLimit", export_set_edge_queue_limit, addon);
+  set_method(exports, "prepareEventDetect", export_prepare_event_detect, addon);
+  set_method(exports, "startTrace", export_start_trace, addon);
+  NODE_SET_METHOD(exports, "stopTrace", export_stop_trace);
+  NODE_SET_METHOD(exports, "replayTrace", export_replay_trace);
+  set_method(exports, "eventLoad", export_event_load, addon);
+}
+
+static void free_queue(uv_handle_t* handle)
+{
+  delete static_cast<EventQueue*>(handle->data);
+}
+
+// stop delivering to an instance that is going away
+void events_cleanup(AddonData* addon)
+{
+  EventQueue* q = addon->events;
+
+  uv_mutex_lock(&queue_lock);
+  for (int i=0; i<54; i++)
+    if (event_owner[i] == q)
+      event_owner[i] = NULL;
+  uv_mutex_unlock(&queue_lock);
+
+  // pending waits are dropped unsettled, their loop is going away
+  while (!q->waits.empty())
+    end_wait(*q->waits.begin());
+
+  q->handler.Reset();
+  delete q->resource;
+  q->resource = NULL;
+  addon->events = NULL;
+  uv_close(reinterpret_cast<uv_handle_t*>(&q->async), free_queue);
+}
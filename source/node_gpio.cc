@@ -21,14 +21,22 @@ SOFTWARE.
 */
 
 #include <node.h>
+#include <node_buffer.h>
+#include <uv.h>
+#include <string.h>
 
 #include "node_constants.hh"
 #include "node_common.hh"
 #include "node_pwm.hh"
+#include "node_event.hh"
+#include "node_pin.hh"
+#include "node_sequence.hh"
 
 extern "C" {
 #include "c_gpio.h"
 #include "event_gpio.h"
+#include "soft_pwm.h"
+#include "thread_sched.h"
 }
 
 using v8::FunctionCallbackInfo;
@@ -41,14 +49,22 @@ using v8::Value;
 using v8::Exception;
 using v8::Object;
 using v8::Context;
+using v8::Array;
+using v8::Boolean;
+using v8::Null;
+using v8::HandleScope;
+using v8::Promise;
 
 static int rpi_revision; // deprecated
 static int board_info;
-static int gpio_warnings = 1;
+static int addon_instances = 0;   // under the core lock
+static uv_once_t board_once = UV_ONCE_INIT;
 
+// the register mapping is made once and shared by every instance
 static int mmap_gpio_mem(Isolate* isolate)
 {
    int result;
+   CoreLock lock;
 
    if (module_setup)
       return 0;
@@ -76,6 +92,25 @@ static int mmap_gpio_mem(Isolate* isolate)
    }
 }
 
+// restore every channel set up by this program to its state before
+// setup(), returns 1 if any channel was set up.  Call with the core lock held.
+static int restore_used_channels(AddonData* addon)
+{
+   uint32_t mask[2] = {0, 0};
+
+   for (int i=0; i<54; i++) {
+      if (addon->gpio_direction[i] != -1) {
+         mask[i/32] |= 1 << (i%32);
+         addon->gpio_direction[i] = -1;
+         release_gpio(addon, i);
+      }
+   }
+   if (!mask[0] && !mask[1])
+      return 0;
+   snapshot_restore(snapshot_boot(), mask[0], mask[1]);
+   return 1;
+}
+
 // node function cleanup(channel?)
 static void export_cleanup(const FunctionCallbackInfo<Value>& args)
 {
@@ -84,32 +119,39 @@ static void export_cleanup(const FunctionCallbackInfo<Value>& args)
    int gpio;
 
    Isolate* isolate = args.GetIsolate();
+   AddonData* addon = get_addon_data(args);
+   CoreLock lock;
 
    if (module_setup && !setup_error) {
       if (args[0]->IsUndefined()) {   // channel not set - cleanup everything
-         // clean up any /sys/class exports
-         event_cleanup_all();
-
-         // set everything back to input
+         // clean up the /sys/class exports of this instance only, other
+         // worker threads may still be using theirs
          for (i=0; i<54; i++) {
-            if (gpio_direction[i] != -1) {
-               setup_gpio(i, INPUT, PUD_OFF);
-               gpio_direction[i] = -1;
-               found = 1;
-            }
+            events_unwatch(addon, i);
+            if (addon->gpio_direction[i] != -1)
+               event_cleanup(i);
          }
-         gpio_mode = MODE_UNKNOWN;
+
+         // put every channel used back the way it was, in one pass
+         found = restore_used_channels(addon);
+         addon->gpio_mode = MODE_UNKNOWN;
       } else if (args[0]->IsNumber()) {    // channel was an int indicating single channel
-         if (get_gpio_number(isolate, args[0]->NumberValue(), &gpio))
+         if (get_gpio_number(isolate, addon, args[0]->NumberValue(), &gpio))
             return;
 
         // clean up any /sys/class exports
-        event_cleanup(gpio);
-
-        // set everything back to input
-        if (gpio_direction[gpio] != -1) {
-           setup_gpio(gpio, INPUT, PUD_OFF);
-           gpio_direction[gpio] = -1;
+        events_unwatch(addon, gpio);
+        if (!gpio_in_use(addon, gpio))
+           event_cleanup(gpio);
+
+        // put the channel back the way it was before this program used it
+        if (addon->gpio_direction[gpio] != -1) {
+           if (gpio < 32)
+              snapshot_restore(snapshot_boot(), 1 << gpio, 0);
+           else
+              snapshot_restore(snapshot_boot(), 0, 1 << (gpio-32));
+           addon->gpio_direction[gpio] = -1;
+           release_gpio(addon, gpio);
            found = 1;
         }
       } else {
@@ -118,26 +160,40 @@ static void export_cleanup(const FunctionCallbackInfo<Value>& args)
       }
     }
 
-    if (!found && gpio_warnings) {
+    if (!found && addon->gpio_warnings) {
       fprintf(stderr, "No channels have been set up yet - nothing to clean up!  Try cleaning up at the end of your program instead!\n");
     }
 }
 
-void gc_cleanup(Isolate *isolate, v8::GCType type, v8::GCCallbackFlags flags)
+// environment cleanup hook, run when the Node environment that loaded
+// this instance of the addon exits
+static void addon_cleanup(void* arg)
 {
-  event_cleanup_all();
+  AddonData* addon = static_cast<AddonData*>(arg);
 
-  // set everything back to input
-  for (int i=0; i<54; i++) {
-     if (gpio_direction[i] != -1) {
-        setup_gpio(i, INPUT, PUD_OFF);
-        gpio_direction[i] = -1;
-     }
+  events_cleanup(addon);
+
+  CoreLock lock;
+  if (module_setup && !setup_error) {
+    for (int i=0; i<54; i++) {
+      if (addon->gpio_direction[i] == OUTPUT)
+        pwm_stop(i);
+      if (addon->gpio_direction[i] != -1)
+        event_cleanup(i);
+    }
+    restore_used_channels(addon);
   }
-  gpio_mode = MODE_UNKNOWN;
+
+  // the edge detection thread and sysfs exports are shared by every instance,
+  // the register mapping stays until the process exits
+  if (--addon_instances == 0)
+    event_cleanup_all();
+
+  addon->pwm_constructor.Reset();
+  delete addon;
 }
 
-int process_args_setup_channel(int& channel, int& direction, int& pud, int& initial,
+int process_args_setup_channel(int* channels, int& count, int& direction, int& pud, int& initial,
                             const FunctionCallbackInfo<Value>& args)
 {
   Isolate* isolate = args.GetIsolate();
@@ -148,13 +204,33 @@ int process_args_setup_channel(int& channel, int& direction, int& pud, int& init
     return 1;
   }
 
-  if (!args[0]->IsNumber() || !args[1]->IsNumber()) {
+  if (!(args[0]->IsNumber() || args[0]->IsArray()) || !args[1]->IsNumber()) {
     isolate->ThrowException(Exception::TypeError(
         String::NewFromUtf8(isolate, "setup() expected a number")));
     return 1;
   }
 
-  channel = args[0]->NumberValue();
+  if (args[0]->IsArray()) {
+    Local<Array> chanlist = Local<Array>::Cast(args[0]);
+    if (chanlist->Length() > 54) {
+      isolate->ThrowException(Exception::TypeError(
+          String::NewFromUtf8(isolate, "Too many channels")));
+      return 1;
+    }
+    count = chanlist->Length();
+    for (int i=0; i<count; i++) {
+      Local<Value> channel = chanlist->Get(i);
+      if (!channel->IsNumber()) {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "Channel must be a number")));
+        return 1;
+      }
+      channels[i] = channel->NumberValue();
+    }
+  } else {
+    channels[0] = args[0]->NumberValue();
+    count = 1;
+  }
   direction = args[1]->NumberValue();
 
   if (direction != INPUT && direction != OUTPUT) {
@@ -194,19 +270,98 @@ int process_args_setup_channel(int& channel, int& direction, int& pud, int& init
   return 0;
 }
 
-// node function setup(channel, direction, pull_up_down=PUD_OFF, initial=undefined)
+// check the direction, pull and initial value shared by setup() and
+// setupAsync(), converting pud from its exported constant
+// returns 1 with an exception thrown
+static int check_setup_options(Isolate* isolate, int direction, int& pud, int initial)
+{
+    if (direction != INPUT && direction != OUTPUT) {
+       isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "An invalid direction was passed to setup()")));
+       return 1;
+    }
+
+    if (direction == OUTPUT && pud != PUD_OFF + PY_PUD_CONST_OFFSET) {
+       isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "pull_up_down parameter is not valid for outputs")));
+       return 1;
+    }
+
+    if (direction == INPUT && initial != -1) {
+       isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "initial parameter is not valid for inputs")));
+       return 1;
+    }
+
+    if (direction == OUTPUT)
+       pud = PUD_OFF + PY_PUD_CONST_OFFSET;
+
+    pud -= PY_PUD_CONST_OFFSET;
+    if (pud != PUD_OFF && pud != PUD_DOWN && pud != PUD_UP) {
+       isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "Invalid value for pull_up_down - should be either PUD_OFF, PUD_UP or PUD_DOWN")));
+       return 1;
+    }
+    return 0;
+}
+
+// refuse channels set up by another worker thread and build one register
+// transaction for the whole list.  Call with the core lock held.
+// returns 1 with an exception thrown
+static int build_setup_txn(Isolate* isolate, AddonData* addon, struct gpio_txn* txn,
+                           const int* gpios, int count, int direction, int pud, int initial)
+{
+    int gpio, func;
+
+    for (int i=0; i<count; i++) {
+       if (gpio_in_use(addon, gpios[i])) {
+          isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "This channel is set up by another worker thread")));
+          return 1;
+       }
+    }
+
+    txn_begin(txn);
+    for (int i=0; i<count; i++) {
+       gpio = gpios[i];
+
+       func = gpio_function(gpio);
+       if (addon->gpio_warnings &&                             // warnings enabled and
+           ((func != 0 && func != 1) ||                        // (already one of the alt functions or
+           (addon->gpio_direction[gpio] == -1 && func == 1)))  // already an output not set from this program)
+       {
+          fprintf(stderr, "This channel is already in use, continuing anyway.  Use setwarnings(false) to disable warnings.\n");
+       }
+
+       // warn about pull/up down on i2c channels
+       if (addon->gpio_warnings) {
+          if (rpiinfo.p1_revision == 0) { // compute module - do nothing
+          } else if ((rpiinfo.p1_revision == 1 && (gpio == 0 || gpio == 1)) ||
+                     (gpio == 2 || gpio == 3)) {
+             if (pud == PUD_UP || pud == PUD_DOWN)
+                fprintf(stderr, "A physical pull up resistor is fitted on this channel!\n");
+          }
+       }
+
+       if (direction == OUTPUT && (initial == LOW || initial == HIGH)) {
+          txn_output_gpio(txn, gpio, initial);
+       }
+       txn_setup_gpio(txn, gpio, direction, pud);
+    }
+    return 0;
+}
+
+// node function setup(channel(s), direction, pull_up_down=PUD_OFF, initial=undefined)
 void
 export_setup_channel(const FunctionCallbackInfo<Value>& args)
 {
-    int gpio, channel, direction;
+    int direction;
+    int channels[54], gpios[54];
+    int count = 0;
     int pud = PUD_OFF;
     int initial = -1;
-    int func;
+    struct gpio_txn txn;
 
-    if(process_args_setup_channel(channel, direction, pud, initial, args))
+    if(process_args_setup_channel(channels, count, direction, pud, initial, args))
       return;
 
     Isolate* isolate = args.GetIsolate();
+    AddonData* addon = get_addon_data(args);
 
     // check module has been imported cleanly
     if (setup_error)
@@ -218,57 +373,200 @@ export_setup_channel(const FunctionCallbackInfo<Value>& args)
     if (mmap_gpio_mem(isolate))
        return;
 
-    if (direction != INPUT && direction != OUTPUT) {
-       isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "An invalid direction was passed to setup()")));
+    if (check_setup_options(isolate, direction, pud, initial))
        return;
-    }
 
-    if (direction == OUTPUT && pud != PUD_OFF + PY_PUD_CONST_OFFSET) {
-       isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "pull_up_down parameter is not valid for outputs")));
-       return;
+    // check every channel before changing anything
+    for (int i=0; i<count; i++) {
+       if (get_gpio_number(isolate, addon, channels[i], &gpios[i]))
+          return;
     }
 
-    if (direction == INPUT && initial != -1) {
-       isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "initial parameter is not valid for inputs")));
+    CoreLock lock;
+    if (build_setup_txn(isolate, addon, &txn, gpios, count, direction, pud, initial))
        return;
+
+    // one write per register for the whole list
+    txn_commit(&txn);
+    for (int i=0; i<count; i++) {
+       addon->gpio_direction[gpios[i]] = direction;
+       claim_gpio(addon, gpios[i]);
     }
+}
 
-    if (direction == OUTPUT)
-       pud = PUD_OFF + PY_PUD_CONST_OFFSET;
+struct SetupWork {
+  uv_work_t req;
+  Isolate* isolate;
+  AddonData* addon;
+  v8::Persistent<Promise::Resolver> resolver;
+  struct gpio_txn txn;
+  unsigned int gpios[54];
+  int count;
+  int direction;
+  int edge;         // -1 when edge detection was not asked for
+  int bouncetime;
+  int prepared;     // event_pool_prepare() result
+};
+
+// runs on the libuv thread pool, where waiting for udev to set up the
+// sysfs lines does not hold up the event loop.  Only the register writes
+// need the core lock; event_pool_prepare() has its own lock, and holding
+// the core lock while it waits would stall every other instance.
+static void setup_work(uv_work_t* req)
+{
+  SetupWork* work = static_cast<SetupWork*>(req->data);
 
-    pud -= PY_PUD_CONST_OFFSET;
-    if (pud != PUD_OFF && pud != PUD_DOWN && pud != PUD_UP) {
-       isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "Invalid value for pull_up_down - should be either PUD_OFF, PUD_UP or PUD_DOWN")));
-       return;
-    }
+  {
+    CoreLock lock;
+    txn_commit(&work->txn);
+  }
+  if (work->edge != -1)
+    work->prepared = event_pool_prepare(work->gpios, work->count);
+}
 
-    if (get_gpio_number(isolate, channel, &gpio))
-       return;
+static void settle_setup(uv_work_t* req, int status)
+{
+  SetupWork* work = static_cast<SetupWork*>(req->data);
+  AddonData* addon = work->addon;
+  Isolate* isolate = work->isolate;
+  HandleScope scope(isolate);
+  Local<Context> context = isolate->GetCurrentContext();
+  Local<Promise::Resolver> resolver = Local<Promise::Resolver>::New(isolate, work->resolver);
+  node::CallbackScope callback_scope(isolate, Object::New(isolate), node::async_context{0, 0});
+  const char* error = NULL;
+  int result;
 
-    func = gpio_function(gpio);
-    if (gpio_warnings &&                             // warnings enabled and
-        ((func != 0 && func != 1) ||                 // (already one of the alt functions or
-        (gpio_direction[gpio] == -1 && func == 1)))  // already an output not set from this program)
-    {
-       fprintf(stderr, "This channel is already in use, continuing anyway.  Use setwarnings(false) to disable warnings.\n");
+  {
+    CoreLock lock;
+
+    for (int i=0; i<work->count; i++)
+      addon->gpio_direction[work->gpios[i]] = work->direction;
+
+    // the lines are exported already, so adding detection is quick
+    if (work->edge != -1 && work->prepared != 0)
+      error = "Failed to prepare edge detection for all channels";
+    for (int i=0; i<work->count && work->edge != -1 && error == NULL; i++) {
+      result = events_add_detect(addon, work->gpios[i], work->edge, work->bouncetime);
+      if (result == 1)
+        error = "Conflicting edge detection already enabled for this GPIO channel";
+      else if (result == 2)
+        error = "Failed to add edge detection";
+      else if (result == 3)
+        error = "No memory";
     }
+  }
 
-    // warn about pull/up down on i2c channels
-    if (gpio_warnings) {
-       if (rpiinfo.p1_revision == 0) { // compute module - do nothing
-       } else if ((rpiinfo.p1_revision == 1 && (gpio == 0 || gpio == 1)) ||
-                  (gpio == 2 || gpio == 3)) {
-          if (pud == PUD_UP || pud == PUD_DOWN)
-             fprintf(stderr, "A physical pull up resistor is fitted on this channel!\n");
-       }
+  if (error == NULL)
+    resolver->Resolve(context, v8::Undefined(isolate)).FromJust();
+  else
+    resolver->Reject(context, Exception::Error(String::NewFromUtf8(isolate, error))).FromJust();
+
+  work->resolver.Reset();
+  delete work;
+}
+
+// node function promise = setupAsync(channel(s), {direction, pull_up_down, initial, edge, bouncetime})
+static void
+export_setup_async(const FunctionCallbackInfo<Value>& args)
+{
+  int gpios[54];
+  int direction, count;
+  int pud = PUD_OFF + PY_PUD_CONST_OFFSET;
+  int initial = -1;
+  int edge = -1;
+  int bouncetime = -666;
+
+  Isolate* isolate = args.GetIsolate();
+  AddonData* addon = get_addon_data(args);
+  Local<Context> context = isolate->GetCurrentContext();
+
+  if (args.Length() < 2 || !args[1]->IsObject()) {
+    isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "setupAsync() expected channels and an options object")));
+    return;
+  }
+
+  Local<Object> options = args[1]->ToObject();
+  Local<Value> value;
+
+  value = options->Get(context, String::NewFromUtf8(isolate, "direction")).ToLocalChecked();
+  if (!value->IsNumber()) {
+    isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "setupAsync() expected a direction")));
+    return;
+  }
+  direction = value->NumberValue();
+  value = options->Get(context, String::NewFromUtf8(isolate, "pull_up_down")).ToLocalChecked();
+  if (value->IsNumber())
+    pud = value->NumberValue();
+  value = options->Get(context, String::NewFromUtf8(isolate, "initial")).ToLocalChecked();
+  if (value->IsNumber()) {
+    initial = value->NumberValue();
+    if (initial != 0 && initial != 1) {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Invalid value for initial")));
+      return;
+    }
+  }
+  value = options->Get(context, String::NewFromUtf8(isolate, "bouncetime")).ToLocalChecked();
+  if (value->IsNumber()) {
+    bouncetime = value->NumberValue();
+    if (bouncetime <= 0) {
+      isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "Bouncetime must be greater than 0")));
+      return;
+    }
+  }
+  value = options->Get(context, String::NewFromUtf8(isolate, "edge")).ToLocalChecked();
+  if (value->IsNumber()) {
+    edge = value->NumberValue();
+    if (check_edge(isolate, edge))
+      return;
+    if (direction != INPUT) {
+      isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "Edge detection needs the channels set up as inputs")));
+      return;
     }
+  }
+
+  if (setup_error)
+  {
+    isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "Module not imported correctly!")));
+    return;
+  }
+
+  if (check_setup_options(isolate, direction, pud, initial))
+    return;
 
-    if (direction == OUTPUT && (initial == LOW || initial == HIGH)) {
-       output_gpio(gpio, initial);
+  SetupWork* work = new SetupWork();
+  if ((count = get_gpio_list(isolate, addon, args[0], work->gpios, 54)) < 0 ||
+      mmap_gpio_mem(isolate)) {
+    delete work;
+    return;
+  }
+  for (int i=0; i<count; i++)
+    gpios[i] = work->gpios[i];
+
+  {
+    // claim the channels now so no other worker thread takes them while
+    // the work is queued
+    CoreLock lock;
+    if (build_setup_txn(isolate, addon, &work->txn, gpios, count, direction, pud, initial)) {
+      delete work;
+      return;
     }
-    setup_gpio(gpio, direction, pud);
-    gpio_direction[gpio] = direction;
+    for (int i=0; i<count; i++)
+      claim_gpio(addon, gpios[i]);
+  }
 
+  Local<Promise::Resolver> resolver = Promise::Resolver::New(context).ToLocalChecked();
+  work->isolate = isolate;
+  work->addon = addon;
+  work->resolver.Reset(isolate, resolver);
+  work->count = count;
+  work->direction = direction;
+  work->edge = edge;
+  work->bouncetime = bouncetime;
+  work->req.data = work;
+  uv_queue_work(node::GetCurrentEventLoop(isolate), &work->req, setup_work, settle_setup);
+  args.GetReturnValue().Set(resolver->GetPromise());
 }
 
 int process_args_output_gpio(int& channel, int& value, const FunctionCallbackInfo<Value>& args)
@@ -300,15 +598,16 @@ export_output_gpio(const FunctionCallbackInfo<Value>& args)
     int gpio, channel, value;
 
     Isolate* isolate = args.GetIsolate();
+    AddonData* addon = get_addon_data(args);
 
     if(process_args_output_gpio(channel, value, args))
       return;
 
     //    printf("Output GPIO %d value %d\n", gpio, value);
-    if (get_gpio_number(isolate, channel, &gpio))
+    if (get_gpio_number(isolate, addon, channel, &gpio))
         return;
 
-    if (gpio_direction[gpio] != OUTPUT)
+    if (addon->gpio_direction[gpio] != OUTPUT)
     {
        isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "The GPIO channel has not been set up as an OUTPUT")));
        return;
@@ -348,15 +647,16 @@ export_input_gpio(const FunctionCallbackInfo<Value>& args)
     int gpio, channel;
 
     Isolate* isolate = args.GetIsolate();
+    AddonData* addon = get_addon_data(args);
 
     if(process_args_input_gpio(channel, args))
       return;
 
-    if (get_gpio_number(isolate, channel, &gpio))
+    if (get_gpio_number(isolate, addon, channel, &gpio))
         return;
 
     // check channel is set up as an input or output
-    if (gpio_direction[gpio] != INPUT && gpio_direction[gpio] != OUTPUT)
+    if (addon->gpio_direction[gpio] != INPUT && addon->gpio_direction[gpio] != OUTPUT)
     {
        isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "You must setup() the GPIO channel first")));
        return;
@@ -371,11 +671,163 @@ export_input_gpio(const FunctionCallbackInfo<Value>& args)
       args.GetReturnValue().Set(Number::New(isolate, 0));
 }
 
+// collect gpios per bank, checking each is set up as an output
+static int output_masks(Isolate* isolate, AddonData* addon, unsigned int *gpios, int count, uint32_t *mask)
+{
+  mask[0] = mask[1] = 0;
+  for (int i=0; i<count; i++) {
+    if (addon->gpio_direction[gpios[i]] != OUTPUT) {
+      isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "The GPIO channel has not been set up as an OUTPUT")));
+      return 0;
+    }
+    mask[gpios[i]/32] |= 1 << (gpios[i]%32);
+  }
+  return 1;
+}
+
+// node function toggle(channel(s))
+static void
+export_toggle(const FunctionCallbackInfo<Value>& args)
+{
+    unsigned int gpios[54];
+    uint32_t mask[2];
+    int count;
+
+    Isolate* isolate = args.GetIsolate();
+    AddonData* addon = get_addon_data(args);
+
+    if ((count = get_gpio_list(isolate, addon, args[0], gpios, 54)) < 0)
+        return;
+
+    if (!output_masks(isolate, addon, gpios, count, mask))
+        return;
+
+    if (check_gpio_priv(isolate))
+        return;
+
+    if (mask[0])
+        toggle_gpio_bank(0, mask[0]);
+    if (mask[1])
+        toggle_gpio_bank(1, mask[1]);
+}
+
+// node function toggleMask(mask, bank = 0)
+static void
+export_toggle_mask(const FunctionCallbackInfo<Value>& args)
+{
+    Isolate* isolate = args.GetIsolate();
+    AddonData* addon = get_addon_data(args);
+    uint32_t mask;
+    int bank = 0;
+
+    if (!args[0]->IsNumber() || (args.Length() > 1 && !args[1]->IsUndefined() && !args[1]->IsNumber())) {
+        isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "toggleMask() expected a number")));
+        return;
+    }
+    mask = args[0]->Uint32Value();
+    if (args.Length() > 1 && args[1]->IsNumber())
+        bank = args[1]->Int32Value();
+
+    if (bank != 0 && bank != 1) {
+        isolate->ThrowException(Exception::RangeError(String::NewFromUtf8(isolate, "bank must be 0 or 1")));
+        return;
+    }
+    if (bank == 1 && (mask >> 22)) {
+        isolate->ThrowException(Exception::RangeError(String::NewFromUtf8(isolate, "The mask has bits for GPIOs that do not exist")));
+        return;
+    }
+
+    for (int gpio=0; gpio<32; gpio++) {
+        if ((mask & (1u << gpio)) && addon->gpio_direction[bank*32 + gpio] != OUTPUT) {
+            isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "The GPIO channel has not been set up as an OUTPUT")));
+            return;
+        }
+    }
+
+    if (check_gpio_priv(isolate))
+        return;
+
+    if (mask)
+        toggle_gpio_bank(bank, mask);
+}
+
+// node function value(s) = outputState(channel(s))
+static void
+export_output_state(const FunctionCallbackInfo<Value>& args)
+{
+    unsigned int gpios[54];
+    uint32_t mask[2];
+    uint32_t state[2];
+    int count;
+
+    Isolate* isolate = args.GetIsolate();
+    Local<Context> context = isolate->GetCurrentContext();
+    AddonData* addon = get_addon_data(args);
+
+    if ((count = get_gpio_list(isolate, addon, args[0], gpios, 54)) < 0)
+        return;
+
+    if (!output_masks(isolate, addon, gpios, count, mask))
+        return;
+
+    if (check_gpio_priv(isolate))
+        return;
+
+    state[0] = output_state_bank(0);
+    state[1] = output_state_bank(1);
+
+    if (!args[0]->IsArray()) {
+        args.GetReturnValue().Set(Number::New(isolate, (state[gpios[0]/32] >> (gpios[0]%32)) & 1));
+        return;
+    }
+
+    Local<Array> levels = Array::New(isolate, count);
+    for (int i=0; i<count; i++)
+        levels->Set(context, i, Number::New(isolate, (state[gpios[i]/32] >> (gpios[i]%32)) & 1)).FromJust();
+    args.GetReturnValue().Set(levels);
+}
+
+// node function channels = verifyOutputs(resync = false)
+static void
+export_verify_outputs(const FunctionCallbackInfo<Value>& args)
+{
+    uint32_t differ[2] = {0, 0};
+    uint32_t outputs[2] = {0, 0};
+    int gpio, n = 0;
+
+    Isolate* isolate = args.GetIsolate();
+    Local<Context> context = isolate->GetCurrentContext();
+    AddonData* addon = get_addon_data(args);
+    bool resync = args.Length() > 0 && args[0]->BooleanValue();
+
+    if (check_gpio_priv(isolate))
+        return;
+
+    for (gpio=0; gpio<54; gpio++)
+        if (addon->gpio_direction[gpio] == OUTPUT)
+            outputs[gpio/32] |= 1 << (gpio%32);
+
+    for (int i=0; i<2; i++) {
+        if (!outputs[i])
+            continue;
+        differ[i] = verify_output_bank(i) & outputs[i];
+        if (resync && differ[i])
+            sync_output_state(i, differ[i]);
+    }
+
+    Local<Array> channels = Array::New(isolate);
+    for (gpio=0; gpio<54; gpio++)
+        if (differ[gpio/32] & (1 << (gpio%32)))
+            channels->Set(context, n++, Number::New(isolate, chan_from_gpio(addon, gpio))).FromJust();
+    args.GetReturnValue().Set(channels);
+}
+
 // node function setmode(mode)
 static void
 export_setmode(const FunctionCallbackInfo<Value>& args)
 {
   Isolate* isolate = args.GetIsolate();
+  AddonData* addon = get_addon_data(args);
 
   if(args.Length() < 1) {
     isolate->ThrowException(Exception::TypeError(
@@ -391,7 +843,7 @@ export_setmode(const FunctionCallbackInfo<Value>& args)
 
   int new_mode = args[0]->NumberValue();
 
-  if (gpio_mode != MODE_UNKNOWN && new_mode != gpio_mode)
+  if (addon->gpio_mode != MODE_UNKNOWN && new_mode != addon->gpio_mode)
   {
      isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "A different mode has already been set!")));
      return;
@@ -415,7 +867,7 @@ export_setmode(const FunctionCallbackInfo<Value>& args)
      return;
   }
 
-  gpio_mode = new_mode;
+  addon->gpio_mode = new_mode;
 
 }
 
@@ -423,6 +875,7 @@ export_setmode(const FunctionCallbackInfo<Value>& args)
 void export_getmode(const FunctionCallbackInfo<Value>& args)
 {
   Isolate* isolate = args.GetIsolate();
+  AddonData* addon = get_addon_data(args);
 
    if (setup_error)
    {
@@ -430,10 +883,10 @@ void export_getmode(const FunctionCallbackInfo<Value>& args)
       return;
    }
 
-   if (gpio_mode == MODE_UNKNOWN)
+   if (addon->gpio_mode == MODE_UNKNOWN)
       return;
 
-   args.GetReturnValue().Set(Number::New(isolate, gpio_mode));
+   args.GetReturnValue().Set(Number::New(isolate, addon->gpio_mode));
 }
 
 // node function value = gpio_function(channel)
@@ -443,6 +896,7 @@ export_gpio_function(const FunctionCallbackInfo<Value>& args)
     int gpio, channel, f;
 
     Isolate* isolate = args.GetIsolate();
+    AddonData* addon = get_addon_data(args);
 
     if(args.Length() < 1) {
       isolate->ThrowException(Exception::TypeError(
@@ -458,7 +912,7 @@ export_gpio_function(const FunctionCallbackInfo<Value>& args)
 
     channel = args[0]->NumberValue();
 
-    if (get_gpio_number(isolate, channel, &gpio))
+    if (get_gpio_number(isolate, addon, channel, &gpio))
         return;
 
     if (mmap_gpio_mem(isolate))
@@ -527,6 +981,7 @@ static void
 export_setwarnings(const FunctionCallbackInfo<Value>& args)
 {
   Isolate* isolate = args.GetIsolate();
+  AddonData* addon = get_addon_data(args);
 
   if(args.Length() < 1) {
     isolate->ThrowException(Exception::TypeError(
@@ -546,61 +1001,225 @@ export_setwarnings(const FunctionCallbackInfo<Value>& args)
      return;
   }
 
-  gpio_warnings = static_cast<int>(args[0]->BooleanValue());
+  addon->gpio_warnings = static_cast<int>(args[0]->BooleanValue());
 }
 
-static int chan_from_gpio(int gpio)
+static Local<Value> sched_status_value(Isolate* isolate, int applied)
 {
-   int chan;
-   int chans;
+   if (applied == THREAD_NOT_APPLIED)
+      return Null(isolate);
+   return Boolean::New(isolate, applied != 0);
+}
 
-   if (gpio_mode == BCM)
-      return gpio;
-   if (rpiinfo.p1_revision == 0)   // not applicable for compute module
-      return -1;
-   else if (rpiinfo.p1_revision == 1 || rpiinfo.p1_revision == 2)
-      chans = 26;
-   else
-      chans = 40;
-   for (chan=1; chan<=chans; chan++)
-      if (*(*pin_to_gpio+chan) == gpio)
-         return chan;
-   return -1;
+static Local<Object> build_sched_status(Isolate* isolate, int thread_class)
+{
+   struct thread_sched sched;
+   struct thread_sched_status status;
+   Local<Context> context = isolate->GetCurrentContext();
+   Local<Object> result = Object::New(isolate);
+   Local<Array> cpus = Array::New(isolate);
+   int i, n = 0;
+
+   thread_sched_get(thread_class, &sched, &status);
+
+   for (i=0; i<64; i++)
+      if (sched.cpus & (1ULL << i))
+         cpus->Set(context, n++, Number::New(isolate, i)).FromJust();
+
+   result->Set(context, String::NewFromUtf8(isolate, "policy"), Number::New(isolate, sched.policy)).FromJust();
+   result->Set(context, String::NewFromUtf8(isolate, "priority"), Number::New(isolate, sched.priority)).FromJust();
+   result->Set(context, String::NewFromUtf8(isolate, "cpus"), cpus).FromJust();
+   result->Set(context, String::NewFromUtf8(isolate, "lockMemory"), Boolean::New(isolate, sched.lock_memory != 0)).FromJust();
+   result->Set(context, String::NewFromUtf8(isolate, "policyApplied"), sched_status_value(isolate, status.policy)).FromJust();
+   result->Set(context, String::NewFromUtf8(isolate, "affinityApplied"), sched_status_value(isolate, status.affinity)).FromJust();
+   result->Set(context, String::NewFromUtf8(isolate, "lockMemoryApplied"), sched_status_value(isolate, status.lock_memory)).FromJust();
+   result->Set(context, String::NewFromUtf8(isolate, "error"), Number::New(isolate, status.error)).FromJust();
+   return result;
 }
 
-// TODO transcribe edge / event methods
+// node function status = setThreadScheduling(thread, {policy, priority, cpus, lockMemory})
+static void
+export_set_thread_scheduling(const FunctionCallbackInfo<Value>& args)
+{
+  struct thread_sched sched;
+  int thread_class;
 
+  Isolate* isolate = args.GetIsolate();
 
+  if(args.Length() < 1 || !args[0]->IsNumber()) {
+    isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "setThreadScheduling() expected a thread class")));
+    return;
+  }
 
-void init(Local<Object> exports, Local<Value> module, Local<Context> context) {
-  Isolate* isolate = context->GetIsolate();
+  thread_class = args[0]->NumberValue();
+  if (thread_class < 0 || thread_class >= THREAD_CLASSES) {
+    isolate->ThrowException(Exception::Error(
+        String::NewFromUtf8(isolate, "thread must be EVENT_THREAD, PWM_THREAD or WAVE_THREAD")));
+    return;
+  }
 
-  isolate->AddGCPrologueCallback(gc_cleanup);
+  memset(&sched, 0, sizeof(sched));
+  sched.policy = SCHED_OTHER;
+
+  if (args.Length() > 1 && args[1]->IsObject()) {
+    Local<Object> options = args[1]->ToObject();
+    Local<Value> policy = options->Get(String::NewFromUtf8(isolate, "policy"));
+    Local<Value> priority = options->Get(String::NewFromUtf8(isolate, "priority"));
+    Local<Value> cpus = options->Get(String::NewFromUtf8(isolate, "cpus"));
+    Local<Value> lock_memory = options->Get(String::NewFromUtf8(isolate, "lockMemory"));
+
+    if (policy->IsNumber())
+      sched.policy = policy->NumberValue();
+    if (priority->IsNumber())
+      sched.priority = priority->NumberValue();
+    if (lock_memory->IsBoolean())
+      sched.lock_memory = lock_memory->BooleanValue();
+    if (cpus->IsArray()) {
+      Local<Array> cpulist = Local<Array>::Cast(cpus);
+      for (unsigned int i=0; i<cpulist->Length(); i++) {
+        int cpu = cpulist->Get(i)->NumberValue();
+        if (cpu < 0 || cpu > 63) {
+          isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "Invalid cpu number")));
+          return;
+        }
+        sched.cpus |= 1ULL << cpu;
+      }
+    }
+  }
 
-  PWMClass::Init(exports);
+  if (thread_sched_set(thread_class, &sched) == 2) {
+    isolate->ThrowException(Exception::Error(
+        String::NewFromUtf8(isolate, "policy must be SCHED_OTHER, SCHED_FIFO or SCHED_RR")));
+    return;
+  }
 
-  NODE_SET_METHOD(exports, "cleanup", export_cleanup);
-  NODE_SET_METHOD(exports, "setup", export_setup_channel);
-  NODE_SET_METHOD(exports, "output", export_output_gpio);
-  NODE_SET_METHOD(exports, "input", export_input_gpio);
-  NODE_SET_METHOD(exports, "setmode", export_setmode);
-  NODE_SET_METHOD(exports, "getmode", export_getmode);
-  NODE_SET_METHOD(exports, "gpio_function", export_gpio_function);
-  NODE_SET_METHOD(exports, "setwarnings", export_setwarnings);
+  args.GetReturnValue().Set(build_sched_status(isolate, thread_class));
+}
 
-  define_constants(exports);
+// node function status = getThreadScheduling(thread)
+static void
+export_get_thread_scheduling(const FunctionCallbackInfo<Value>& args)
+{
+  int thread_class;
+
+  Isolate* isolate = args.GetIsolate();
+
+  if(args.Length() < 1 || !args[0]->IsNumber()) {
+    isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "getThreadScheduling() expected a thread class")));
+    return;
+  }
+
+  thread_class = args[0]->NumberValue();
+  if (thread_class < 0 || thread_class >= THREAD_CLASSES) {
+    isolate->ThrowException(Exception::Error(
+        String::NewFromUtf8(isolate, "thread must be EVENT_THREAD, PWM_THREAD or WAVE_THREAD")));
+    return;
+  }
+
+  args.GetReturnValue().Set(build_sched_status(isolate, thread_class));
+}
+
+// node function buffer = snapshot()
+static void
+export_snapshot(const FunctionCallbackInfo<Value>& args)
+{
+  struct gpio_snapshot snap;
+
+  Isolate* isolate = args.GetIsolate();
+
+  if (mmap_gpio_mem(isolate))
+    return;
+
+  snapshot_take(&snap);
+  args.GetReturnValue().Set(
+      node::Buffer::Copy(isolate, (const char *)&snap, sizeof(snap)).ToLocalChecked());
+}
+
+// node function restore(buffer, channels?)
+static void
+export_restore(const FunctionCallbackInfo<Value>& args)
+{
+  struct gpio_snapshot snap;
+  uint32_t mask[2] = {0, 0};
+  int gpio, f;
+
+  Isolate* isolate = args.GetIsolate();
+  AddonData* addon = get_addon_data(args);
+
+  if (args.Length() < 1 || !node::Buffer::HasInstance(args[0]) ||
+      node::Buffer::Length(args[0]) != sizeof(snap)) {
+    isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "restore() expected a buffer from snapshot()")));
+    return;
+  }
+  memcpy(&snap, node::Buffer::Data(args[0]), sizeof(snap));
+  if (snap.magic != SNAPSHOT_MAGIC) {
+    isolate->ThrowException(Exception::Error(
+        String::NewFromUtf8(isolate, "Not a GPIO snapshot")));
+    return;
+  }
+
+  if (args.Length() < 2 || args[1]->IsUndefined()) {   // every channel set up
+    for (int i=0; i<54; i++)
+      if (addon->gpio_direction[i] != -1)
+        mask[i/32] |= 1 << (i%32);
+  } else if (args[1]->IsNumber() || args[1]->IsArray()) {
+    Local<Array> chanlist;
+    if (args[1]->IsArray()) {
+      chanlist = Local<Array>::Cast(args[1]);
+    } else {
+      chanlist = Array::New(isolate, 1);
+      chanlist->Set(0, args[1]);
+    }
+    for (uint32_t i=0; i<chanlist->Length(); i++) {
+      Local<Value> channel = chanlist->Get(i);
+      if (!channel->IsNumber()) {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "Channel must be a number")));
+        return;
+      }
+      if (get_gpio_number(isolate, addon, channel->NumberValue(), &gpio))
+        return;
+      mask[gpio/32] |= 1 << (gpio%32);
+    }
+  } else {
+    isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "Channel must be a number or an array of numbers")));
+    return;
+  }
+
+  if (mmap_gpio_mem(isolate))
+    return;
+
+  CoreLock lock;
 
+  // channels set up by other worker threads are left alone
   for (int i=0; i<54; i++)
-     gpio_direction[i] = -1;
+    if (gpio_in_use(addon, i))
+      mask[i/32] &= ~(1 << (i%32));
 
-  // detect board revision and set up accordingly
-  if (get_rpi_info(&rpiinfo))
-  {
-     isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "This module can only be run on a Raspberry Pi!")));
-     setup_error = 1;
-     return;
+  snapshot_restore(&snap, mask[0], mask[1]);
+
+  // keep the direction of channels this program has set up in step
+  for (int i=0; i<54; i++) {
+    if (addon->gpio_direction[i] != -1 && (mask[i/32] & (1 << (i%32)))) {
+      f = (snap.fsel[i/10] >> ((i%10)*3)) & 7;
+      addon->gpio_direction[i] = f == 1 ? OUTPUT : f == 0 ? INPUT : -1;
+      if (addon->gpio_direction[i] == -1)
+        release_gpio(addon, i);
+    }
   }
+}
 
+static void detect_board(void)
+{
+   if (get_rpi_info(&rpiinfo))
+   {
+      setup_error = 1;
+      return;
+   }
 
    if (rpiinfo.p1_revision == 1) {
       pin_to_gpio = &pin_to_gpio_rev1;
@@ -609,6 +1228,56 @@ void init(Local<Object> exports, Local<Value> module, Local<Context> context) {
    } else { // assume model B+ or A+ or 2B
       pin_to_gpio = &pin_to_gpio_rev3;
    }
+}
+
+void init(Local<Object> exports, Local<Value> module, Local<Context> context) {
+  Isolate* isolate = context->GetIsolate();
+
+  // pin state is held per instance and released with the environment,
+  // never from a GC callback
+  AddonData* addon = new AddonData();
+  addon->gpio_mode = MODE_UNKNOWN;
+  addon->gpio_warnings = 1;
+  for (int i=0; i<54; i++)
+     addon->gpio_direction[i] = -1;
+  core_lock();
+  addon_instances++;
+  core_unlock();
+  node::AddEnvironmentCleanupHook(isolate, addon_cleanup, addon);
+
+  PWMClass::Init(exports, addon);
+  events_init(exports, addon);
+  PinClass::Init(exports, addon);
+  PinGroupClass::Init(exports, addon);
+  sequence_init(exports, addon);
+
+  set_method(exports, "cleanup", export_cleanup, addon);
+  set_method(exports, "setup", export_setup_channel, addon);
+  set_method(exports, "setupAsync", export_setup_async, addon);
+  set_method(exports, "output", export_output_gpio, addon);
+  set_method(exports, "input", export_input_gpio, addon);
+  set_method(exports, "toggle", export_toggle, addon);
+  set_method(exports, "toggleMask", export_toggle_mask, addon);
+  set_method(exports, "outputState", export_output_state, addon);
+  set_method(exports, "verifyOutputs", export_verify_outputs, addon);
+  set_method(exports, "setmode", export_setmode, addon);
+  set_method(exports, "getmode", export_getmode, addon);
+  set_method(exports, "gpio_function", export_gpio_function, addon);
+  set_method(exports, "setwarnings", export_setwarnings, addon);
+  NODE_SET_METHOD(exports, "setThreadScheduling", export_set_thread_scheduling);
+  NODE_SET_METHOD(exports, "getThreadScheduling", export_get_thread_scheduling);
+  NODE_SET_METHOD(exports, "snapshot", export_snapshot);
+  set_method(exports, "restore", export_restore, addon);
+
+  define_constants(exports);
+
+  // detect board revision once, for every worker thread
+  uv_once(&board_once, detect_board);
+  if (setup_error)
+  {
+     isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "This module can only be run on a Raspberry Pi!")));
+     return;
+  }
 
   int rpi_revision = rpiinfo.p1_revision;
   NODE_DEFINE_CONSTANT(exports, rpi_revision);
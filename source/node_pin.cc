@@ -0,0 +1,251 @@
+/*
+Based on RPi.GPIO by Ben Croston
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "node_common.hh"
+#include "node_pin.hh"
+
+extern "C" {
+#include "c_gpio.h"
+}
+
+using v8::String;
+using v8::Local;
+using v8::Object;
+using v8::Isolate;
+using v8::Exception;
+using v8::FunctionTemplate;
+using v8::Value;
+using v8::Context;
+using v8::Function;
+using v8::External;
+using v8::Number;
+using v8::Array;
+
+PinClass::PinClass()
+{
+}
+
+PinClass::~PinClass()
+{
+}
+
+void PinClass::Init(Local<Object> exports, AddonData* addon) {
+  Isolate* isolate = exports->GetIsolate();
+
+  // Prepare constructor template
+  Local<FunctionTemplate> tpl =
+      FunctionTemplate::New(isolate, New, External::New(isolate, addon));
+  tpl->SetClassName(String::NewFromUtf8(isolate, "Pin"));
+  tpl->InstanceTemplate()->SetInternalFieldCount(1);
+
+  // Prototype
+  NODE_SET_PROTOTYPE_METHOD(tpl, "write", Write);
+  NODE_SET_PROTOTYPE_METHOD(tpl, "read", Read);
+  NODE_SET_PROTOTYPE_METHOD(tpl, "toggle", Toggle);
+
+  exports->Set(String::NewFromUtf8(isolate, "Pin"),
+               tpl->GetFunction());
+}
+
+// js function Pin(channel)
+void PinClass::New(const v8::FunctionCallbackInfo<v8::Value>& args)
+{
+  int channel, gpio;
+
+  Isolate* isolate = args.GetIsolate();
+  AddonData* addon = get_addon_data(args);
+
+  if (!args.IsConstructCall()) {
+    isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "Pin() must be called with new")));
+    return;
+  }
+
+  if (args.Length() < 1 || !args[0]->IsNumber()) {
+    isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "Pin() expected a channel")));
+    return;
+  }
+
+  channel = args[0]->NumberValue();
+  if (get_gpio_number(isolate, addon, channel, &gpio))
+    return;
+
+  // check channel is set up as an input or output
+  if (addon->gpio_direction[gpio] != INPUT && addon->gpio_direction[gpio] != OUTPUT)
+  {
+    isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "You must setup() the GPIO channel first")));
+    return;
+  }
+
+  if (check_gpio_priv(isolate))
+    return;
+
+  PinClass* obj = new PinClass();
+  obj->addon_ = addon;
+  obj->channel_ = channel;
+  obj->gpio_ = gpio;
+  obj->bank_ = gpio / 32;
+  obj->mask_ = 1 << (gpio % 32);
+  obj->Wrap(args.This());
+  args.GetReturnValue().Set(args.This());
+}
+
+// node method write(value)
+void PinClass::Write(const v8::FunctionCallbackInfo<v8::Value>& args)
+{
+  PinClass* obj = ObjectWrap::Unwrap<PinClass>(args.Holder());
+
+  // setup() or cleanup() may have changed the channel since
+  if (obj->addon_->gpio_direction[obj->gpio_] != OUTPUT) {
+    Isolate* isolate = args.GetIsolate();
+    isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "The GPIO channel has not been set up as an OUTPUT")));
+    return;
+  }
+
+  if (args[0]->BooleanValue())
+    output_gpio_bank(obj->bank_, obj->mask_, 0);
+  else
+    output_gpio_bank(obj->bank_, 0, obj->mask_);
+}
+
+// node method value = read()
+void PinClass::Read(const v8::FunctionCallbackInfo<v8::Value>& args)
+{
+  PinClass* obj = ObjectWrap::Unwrap<PinClass>(args.Holder());
+
+  args.GetReturnValue().Set((input_gpio_bank(obj->bank_) & obj->mask_) ? 1 : 0);
+}
+
+// node method value = toggle(), returns the new level
+void PinClass::Toggle(const v8::FunctionCallbackInfo<v8::Value>& args)
+{
+  PinClass* obj = ObjectWrap::Unwrap<PinClass>(args.Holder());
+
+  if (obj->addon_->gpio_direction[obj->gpio_] != OUTPUT) {
+    Isolate* isolate = args.GetIsolate();
+    isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "The GPIO channel has not been set up as an OUTPUT")));
+    return;
+  }
+
+  // from the level last written, so no read of the pins
+  args.GetReturnValue().Set((toggle_gpio_bank(obj->bank_, obj->mask_) & obj->mask_) ? 1 : 0);
+}
+
+PinGroupClass::PinGroupClass()
+{
+}
+
+PinGroupClass::~PinGroupClass()
+{
+}
+
+void PinGroupClass::Init(Local<Object> exports, AddonData* addon) {
+  Isolate* isolate = exports->GetIsolate();
+
+  // Prepare constructor template
+  Local<FunctionTemplate> tpl =
+      FunctionTemplate::New(isolate, New, External::New(isolate, addon));
+  tpl->SetClassName(String::NewFromUtf8(isolate, "PinGroup"));
+  tpl->InstanceTemplate()->SetInternalFieldCount(1);
+
+  // Prototype
+  NODE_SET_PROTOTYPE_METHOD(tpl, "write", Write);
+  NODE_SET_PROTOTYPE_METHOD(tpl, "read", Read);
+
+  exports->Set(String::NewFromUtf8(isolate, "PinGroup"),
+               tpl->GetFunction());
+}
+
+// js function PinGroup(channels)
+void PinGroupClass::New(const v8::FunctionCallbackInfo<v8::Value>& args)
+{
+  unsigned int gpios[32];
+  int count;
+
+  Isolate* isolate = args.GetIsolate();
+  AddonData* addon = get_addon_data(args);
+
+  if (!args.IsConstructCall()) {
+    isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "PinGroup() must be called with new")));
+    return;
+  }
+
+  if (args.Length() < 1 || !args[0]->IsArray()) {
+    isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "PinGroup() expected an array of channels")));
+    return;
+  }
+
+  if ((count = get_gpio_list(isolate, addon, args[0], gpios, 32)) < 0)
+    return;
+  if (count == 0) {
+    isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "PinGroup() needs at least one channel")));
+    return;
+  }
+
+  for (int i=0; i<count; i++) {
+    if (addon->gpio_direction[gpios[i]] != INPUT && addon->gpio_direction[gpios[i]] != OUTPUT) {
+      isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "You must setup() every GPIO channel first")));
+      return;
+    }
+  }
+
+  if (check_gpio_priv(isolate))
+    return;
+
+  PinGroupClass* obj = new PinGroupClass();
+  obj->addon_ = addon;
+  if (bank_map_init(&obj->map_, gpios, count) != 0) {
+    delete obj;
+    isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "All channels of a PinGroup must be in the same GPIO bank (0-31 or 32-53)")));
+    return;
+  }
+
+  obj->Wrap(args.This());
+  args.GetReturnValue().Set(args.This());
+}
+
+// node method write(value), bit n of value drives the nth channel
+void PinGroupClass::Write(const v8::FunctionCallbackInfo<v8::Value>& args)
+{
+  PinGroupClass* obj = ObjectWrap::Unwrap<PinGroupClass>(args.Holder());
+
+  for (int i=0; i<obj->map_.count; i++) {
+    if (obj->addon_->gpio_direction[obj->map_.gpios[i]] != OUTPUT) {
+      Isolate* isolate = args.GetIsolate();
+      isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "Every GPIO channel must be set up as an OUTPUT")));
+      return;
+    }
+  }
+
+  bank_map_write(&obj->map_, args[0]->Uint32Value());
+}
+
+// node method value = read()
+void PinGroupClass::Read(const v8::FunctionCallbackInfo<v8::Value>& args)
+{
+  PinGroupClass* obj = ObjectWrap::Unwrap<PinGroupClass>(args.Holder());
+
+  args.GetReturnValue().Set(bank_map_read(&obj->map_));
+}
@@ -0,0 +1,76 @@
+/*
+Based on RPi.GPIO by Ben Croston
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <node.h>
+#include <node_object_wrap.h>
+#include <stdint.h>
+
+extern "C" {
+#include "sequence.h"
+}
+
+struct AddonData;
+
+// a channel validated once, with its bank and mask cached for fast access
+class PinClass : public node::ObjectWrap {
+public:
+  static void Init(v8::Local<v8::Object> exports, AddonData* addon);
+
+private:
+  PinClass();
+  ~PinClass();
+
+  // js function Pin(channel)
+  static void New(const v8::FunctionCallbackInfo<v8::Value>& args);
+
+  // object methods
+  static void Write(const v8::FunctionCallbackInfo<v8::Value>& args);
+  static void Read(const v8::FunctionCallbackInfo<v8::Value>& args);
+  static void Toggle(const v8::FunctionCallbackInfo<v8::Value>& args);
+
+  AddonData* addon_;
+  int channel_;
+  int gpio_;
+  int bank_;
+  uint32_t mask_;
+};
+
+// channels in one bank written or read as the bits of an integer, bit 0
+// being the first channel
+class PinGroupClass : public node::ObjectWrap {
+public:
+  static void Init(v8::Local<v8::Object> exports, AddonData* addon);
+
+private:
+  PinGroupClass();
+  ~PinGroupClass();
+
+  // js function PinGroup(channels)
+  static void New(const v8::FunctionCallbackInfo<v8::Value>& args);
+
+  // object methods
+  static void Write(const v8::FunctionCallbackInfo<v8::Value>& args);
+  static void Read(const v8::FunctionCallbackInfo<v8::Value>& args);
+
+  AddonData* addon_;
+  struct bank_map map_;
+};
@@ -37,8 +37,7 @@ using v8::FunctionTemplate;
 using v8::Value;
 using v8::Context;
 using v8::Function;
-
-v8::Persistent<v8::Function> PWMClass::constructor;
+using v8::External;
 
 PWMClass::PWMClass()
 {
@@ -46,14 +45,16 @@ PWMClass::PWMClass()
 
 PWMClass::~PWMClass()
 {
+  CoreLock lock;
   pwm_stop(this->gpio_);
 }
 
-void PWMClass::Init(Local<Object> exports) {
+void PWMClass::Init(Local<Object> exports, AddonData* addon) {
   Isolate* isolate = exports->GetIsolate();
 
   // Prepare constructor template
-  Local<FunctionTemplate> tpl = FunctionTemplate::New(isolate, New);
+  Local<FunctionTemplate> tpl =
+      FunctionTemplate::New(isolate, New, External::New(isolate, addon));
   tpl->SetClassName(String::NewFromUtf8(isolate, "PWM"));
   tpl->InstanceTemplate()->SetInternalFieldCount(3);
 
@@ -63,7 +64,7 @@ void PWMClass::Init(Local<Object> exports) {
   NODE_SET_PROTOTYPE_METHOD(tpl, "changeFrequency", ChangeFrequency);
   NODE_SET_PROTOTYPE_METHOD(tpl, "stop", Stop);
 
-  constructor.Reset(isolate, tpl->GetFunction());
+  addon->pwm_constructor.Reset(isolate, tpl->GetFunction());
   exports->Set(String::NewFromUtf8(isolate, "PWM"),
                tpl->GetFunction());
 }
@@ -76,6 +77,7 @@ void PWMClass::New(const v8::FunctionCallbackInfo<v8::Value>& args)
   int gpio;
 
   Isolate* isolate = args.GetIsolate();
+  AddonData* addon = get_addon_data(args);
 
   if(args.Length() < 2) {
     isolate->ThrowException(Exception::TypeError(
@@ -93,11 +95,11 @@ void PWMClass::New(const v8::FunctionCallbackInfo<v8::Value>& args)
   frequency = args[1]->NumberValue();
 
   // convert channel to gpio
-  if (get_gpio_number(isolate, channel, &gpio))
+  if (get_gpio_number(isolate, addon, channel, &gpio))
       return;
 
   // ensure channel set as output
-  if (gpio_direction[gpio] != OUTPUT)
+  if (addon->gpio_direction[gpio] != OUTPUT)
   {
     isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate,
       "You must setup() the GPIO channel as an output first")));
@@ -120,13 +122,14 @@ void PWMClass::New(const v8::FunctionCallbackInfo<v8::Value>& args)
     obj->gpio_ = gpio;
     obj->freq_ = frequency;
 
+    CoreLock lock;
     pwm_set_frequency(gpio, frequency);
   } else {
     // Invoked as plain function `PWM(...)`, turn into construct call.
     const int argc = 2;
     Local<Value> argv[argc] = { args[0], args[1] };
     Local<Context> context = isolate->GetCurrentContext();
-    Local<Function> cons = Local<Function>::New(isolate, constructor);
+    Local<Function> cons = Local<Function>::New(isolate, addon->pwm_constructor);
     Local<Object> result =
        cons->NewInstance(context, argc, argv).ToLocalChecked();
     args.GetReturnValue().Set(result);
@@ -163,6 +166,8 @@ void PWMClass::Start(const v8::FunctionCallbackInfo<v8::Value>& args)
 
   PWMClass* obj = ObjectWrap::Unwrap<PWMClass>(args.Holder());
   obj->dutycycle_ = dutycycle;
+
+  CoreLock lock;
   pwm_set_duty_cycle(obj->gpio_, obj->dutycycle_);
   pwm_start(obj->gpio_);
 }
@@ -196,6 +201,8 @@ void PWMClass::ChangeDutyCycle(const v8::FunctionCallbackInfo<v8::Value>& args)
 
     PWMClass* obj = ObjectWrap::Unwrap<PWMClass>(args.Holder());
     obj->dutycycle_ = dutycycle;
+
+    CoreLock lock;
     pwm_set_duty_cycle(obj->gpio_, obj->dutycycle_);
 }
 
@@ -230,6 +237,7 @@ void PWMClass::ChangeFrequency(const v8::FunctionCallbackInfo<v8::Value>& args)
 
   obj->freq_ = frequency;
 
+  CoreLock lock;
   pwm_set_frequency(obj->gpio_, obj->freq_);
 }
 
@@ -237,5 +245,6 @@ void PWMClass::ChangeFrequency(const v8::FunctionCallbackInfo<v8::Value>& args)
 void PWMClass::Stop(const v8::FunctionCallbackInfo<v8::Value>& args)
 {
     PWMClass* obj = ObjectWrap::Unwrap<PWMClass>(args.Holder());
+    CoreLock lock;
     pwm_stop(obj->gpio_);
 }
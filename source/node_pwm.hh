@@ -23,10 +23,12 @@ SOFTWARE.
 #include <node.h>
 #include <node_object_wrap.h>
 
+struct AddonData;
+
 class PWMClass : public node::ObjectWrap {
 public:
   // method used to export class
-  static void Init(v8::Local<v8::Object> exports);
+  static void Init(v8::Local<v8::Object> exports, AddonData* addon);
 
 private:
   PWMClass();
@@ -44,6 +46,4 @@ private:
   unsigned int gpio_;
   float freq_;
   float dutycycle_;
-
-  static v8::Persistent<v8::Function> constructor;
 };
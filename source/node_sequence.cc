@@ -0,0 +1,469 @@
+/*
+Based on RPi.GPIO by Ben Croston
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* Timed sequences of bank writes and reads.  The loop runs on the libuv
+   thread pool and settles a Promise when it is done.  Writes run on a copy
+   of the caller's values, reads straight into a new Uint32Array that is
+   only handed out once the Promise settles. */
+
+#include <node.h>
+#include <node_buffer.h>
+#include <uv.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "node_common.hh"
+#include "node_sequence.hh"
+
+extern "C" {
+#include "c_gpio.h"
+#include "sequence.h"
+}
+
+using v8::FunctionCallbackInfo;
+using v8::Isolate;
+using v8::Object;
+using v8::Local;
+using v8::String;
+using v8::Value;
+using v8::Exception;
+using v8::Context;
+using v8::HandleScope;
+using v8::Promise;
+using v8::Uint32Array;
+using v8::ArrayBuffer;
+
+// longest step between two values or samples, one second
+#define MAX_INTERVAL_NS 1e9
+// most values or samples in one sequence, the largest Uint32Array
+#define MAX_SEQUENCE (node::Buffer::kMaxLength / sizeof(uint32_t))
+
+struct SequenceWork {
+  uv_work_t req;
+  Isolate* isolate;
+  v8::Persistent<Promise::Resolver> resolver;
+  v8::Persistent<Uint32Array> array;   // readSamples() result
+  std::vector<uint32_t> values;        // writeSequence() copy
+  struct bank_map map;
+  uint32_t* data;
+  size_t count;
+  unsigned long long interval;
+};
+
+static void write_work(uv_work_t* req)
+{
+  SequenceWork* work = static_cast<SequenceWork*>(req->data);
+  write_sequence(&work->map, work->data, work->count, work->interval);
+}
+
+static void read_work(uv_work_t* req)
+{
+  SequenceWork* work = static_cast<SequenceWork*>(req->data);
+  read_samples(&work->map, work->data, work->count, work->interval);
+}
+
+static void settle_sequence(uv_work_t* req, int status)
+{
+  SequenceWork* work = static_cast<SequenceWork*>(req->data);
+  Isolate* isolate = work->isolate;
+  HandleScope scope(isolate);
+  Local<Context> context = isolate->GetCurrentContext();
+  Local<Promise::Resolver> resolver = Local<Promise::Resolver>::New(isolate, work->resolver);
+  node::CallbackScope callback_scope(isolate, Object::New(isolate), node::async_context{0, 0});
+
+  if (req->work_cb == read_work)
+    resolver->Resolve(context, Local<Uint32Array>::New(isolate, work->array)).FromJust();
+  else
+    resolver->Resolve(context, v8::Undefined(isolate)).FromJust();
+
+  work->resolver.Reset();
+  work->array.Reset();
+  delete work;
+}
+
+// check the pins and interval shared by writeSequence() and readSamples()
+static SequenceWork* new_sequence(const FunctionCallbackInfo<Value>& args, const char* name, int direction)
+{
+  unsigned int gpios[32];
+  int count;
+  double interval;
+
+  Isolate* isolate = args.GetIsolate();
+  AddonData* addon = get_addon_data(args);
+
+  if ((count = get_gpio_list(isolate, addon, args[0], gpios, 32)) < 0)
+    return NULL;
+
+  for (int i=0; i<count; i++) {
+    if (addon->gpio_direction[gpios[i]] != direction &&
+        (direction == OUTPUT || addon->gpio_direction[gpios[i]] != OUTPUT)) {
+      isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate,
+          direction == OUTPUT ? "Every GPIO channel must be set up as an OUTPUT"
+                              : "You must setup() every GPIO channel first")));
+      return NULL;
+    }
+  }
+
+  if (!args[2]->IsNumber()) {
+    isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate,
+        (std::string(name) + "() expected an interval in nanoseconds").c_str())));
+    return NULL;
+  }
+
+  interval = args[2]->NumberValue();
+  if (!(interval >= 0 && interval <= MAX_INTERVAL_NS)) {   // also catches NaN
+    isolate->ThrowException(Exception::RangeError(String::NewFromUtf8(isolate,
+        "The interval must be from 0 to 1000000000 nanoseconds")));
+    return NULL;
+  }
+
+  if (check_gpio_priv(isolate))
+    return NULL;
+
+  SequenceWork* work = new SequenceWork();
+  if (bank_map_init(&work->map, gpios, count) != 0) {
+    delete work;
+    isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "All channels must be in the same GPIO bank (0-31 or 32-53)")));
+    return NULL;
+  }
+  work->isolate = isolate;
+  work->interval = (unsigned long long)interval;
+  return work;
+}
+
+static void queue_sequence(const FunctionCallbackInfo<Value>& args, SequenceWork* work, uv_work_cb cb)
+{
+  Isolate* isolate = args.GetIsolate();
+  Local<Promise::Resolver> resolver =
+      Promise::Resolver::New(isolate->GetCurrentContext()).ToLocalChecked();
+
+  work->resolver.Reset(isolate, resolver);
+  work->req.data = work;
+  uv_queue_work(node::GetCurrentEventLoop(isolate), &work->req, cb, settle_sequence);
+  args.GetReturnValue().Set(resolver->GetPromise());
+}
+
+// node function promise = writeSequence(channels, values, intervalNs)
+static void
+export_write_sequence(const FunctionCallbackInfo<Value>& args)
+{
+  Isolate* isolate = args.GetIsolate();
+
+  if (args.Length() < 3 || !args[1]->IsUint32Array()) {
+    isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "writeSequence() expected channels, a Uint32Array and an interval")));
+    return;
+  }
+
+  SequenceWork* work = new_sequence(args, "writeSequence", OUTPUT);
+  if (work == NULL)
+    return;
+
+  // copied, so the caller may reuse or transfer its array as soon as this returns
+  Local<Uint32Array> values = Local<Uint32Array>::Cast(args[1]);
+  work->count = values->Length();
+  work->values.resize(work->count);
+  if (work->count)
+    values->CopyContents(work->values.data(), work->count * sizeof(uint32_t));
+  work->data = work->values.data();
+  queue_sequence(args, work, write_work);
+}
+
+// node function promise = readSamples(channels, count, intervalNs), resolves to a Uint32Array
+static void
+export_read_samples(const FunctionCallbackInfo<Value>& args)
+{
+  Isolate* isolate = args.GetIsolate();
+  double count;
+
+  if (args.Length() < 3 || !args[1]->IsNumber()) {
+    isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "readSamples() expected channels, a count and an interval")));
+    return;
+  }
+
+  count = args[1]->NumberValue();
+  if (!(count >= 0 && count <= MAX_SEQUENCE) || count != (size_t)count) {
+    isolate->ThrowException(Exception::RangeError(
+        String::NewFromUtf8(isolate, "The count must be a whole number of samples that fits in a Uint32Array")));
+    return;
+  }
+
+  SequenceWork* work = new_sequence(args, "readSamples", INPUT);
+  if (work == NULL)
+    return;
+
+  Local<ArrayBuffer> buffer = ArrayBuffer::New(isolate, (size_t)count * sizeof(uint32_t));
+  Local<Uint32Array> samples = Uint32Array::New(buffer, 0, (size_t)count);
+  work->array.Reset(isolate, samples);
+  work->data = static_cast<uint32_t*>(buffer->GetContents().Data());
+  work->count = (size_t)count;
+  queue_sequence(args, work, read_work);
+}
+
+struct FrameWork {
+  uv_work_t req;
+  Isolate* isolate;
+  v8::Persistent<Promise::Resolver> resolver;
+  std::vector<output_frame> frames;
+};
+
+static void frame_work(uv_work_t* req)
+{
+  FrameWork* work = static_cast<FrameWork*>(req->data);
+  write_frames(work->frames.data(), work->frames.size());
+}
+
+static void settle_frames(uv_work_t* req, int status)
+{
+  FrameWork* work = static_cast<FrameWork*>(req->data);
+  Isolate* isolate = work->isolate;
+  HandleScope scope(isolate);
+  Local<Context> context = isolate->GetCurrentContext();
+  Local<Promise::Resolver> resolver = Local<Promise::Resolver>::New(isolate, work->resolver);
+  node::CallbackScope callback_scope(isolate, Object::New(isolate), node::async_context{0, 0});
+
+  resolver->Resolve(context, v8::Undefined(isolate)).FromJust();
+  work->resolver.Reset();
+  delete work;
+}
+
+// node function promise = writeFrames(buffer)
+// the buffer holds 24 byte records: uint32 bank, set mask, clear mask, zero,
+// then a double time in nanoseconds on the process.hrtime() clock
+static void
+export_write_frames(const FunctionCallbackInfo<Value>& args)
+{
+  uint32_t outputs[2] = {0, 0};
+  size_t count;
+
+  Isolate* isolate = args.GetIsolate();
+  AddonData* addon = get_addon_data(args);
+
+  if (args.Length() < 1 || !node::Buffer::HasInstance(args[0]) ||
+      node::Buffer::Length(args[0]) % sizeof(output_frame) != 0) {
+    isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate,
+        "writeFrames() expected a buffer of 24 byte frames")));
+    return;
+  }
+
+  if (check_gpio_priv(isolate))
+    return;
+
+  // copied, so the caller may reuse its buffer as soon as this returns
+  FrameWork* work = new FrameWork();
+  count = node::Buffer::Length(args[0]) / sizeof(output_frame);
+  work->frames.resize(count);
+  if (count)
+    memcpy(work->frames.data(), node::Buffer::Data(args[0]), count * sizeof(output_frame));
+
+  for (int i=0; i<54; i++)
+    if (addon->gpio_direction[i] == OUTPUT)
+      outputs[i/32] |= 1 << (i%32);
+  for (size_t i=0; i<count; i++) {
+    const output_frame& f = work->frames[i];
+    if (f.bank > 1 || ((f.set | f.clr) & ~outputs[f.bank])) {
+      delete work;
+      isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate,
+          "Every GPIO in a frame must be set up as an OUTPUT")));
+      return;
+    }
+  }
+
+  Local<Promise::Resolver> resolver =
+      Promise::Resolver::New(isolate->GetCurrentContext()).ToLocalChecked();
+  work->isolate = isolate;
+  work->resolver.Reset(isolate, resolver);
+  work->req.data = work;
+  uv_queue_work(node::GetCurrentEventLoop(isolate), &work->req, frame_work, settle_frames);
+  args.GetReturnValue().Set(resolver->GetPromise());
+}
+
+struct WaveWork {
+  uv_work_t req;
+  Isolate* isolate;
+  v8::Persistent<Promise::Resolver> resolver;
+  std::vector<wave_step> steps;
+  std::vector<long long> errors;
+  unsigned int repeat;
+  unsigned int gpio;          // pulse() only
+  unsigned long long width;
+  int level;
+  int result;
+};
+
+static void wave_work(uv_work_t* req)
+{
+  WaveWork* work = static_cast<WaveWork*>(req->data);
+  work->result = play_wave(work->steps.data(), work->steps.size(), work->repeat, work->errors.data());
+}
+
+static void pulse_work(uv_work_t* req)
+{
+  WaveWork* work = static_cast<WaveWork*>(req->data);
+  work->result = play_pulse(work->gpio, work->width, work->level, work->errors.data());
+}
+
+static void settle_wave(uv_work_t* req, int status)
+{
+  WaveWork* work = static_cast<WaveWork*>(req->data);
+  Isolate* isolate = work->isolate;
+  HandleScope scope(isolate);
+  Local<Context> context = isolate->GetCurrentContext();
+  Local<Promise::Resolver> resolver = Local<Promise::Resolver>::New(isolate, work->resolver);
+  node::CallbackScope callback_scope(isolate, Object::New(isolate), node::async_context{0, 0});
+
+  if (work->result != 0) {
+    resolver->Reject(context, Exception::Error(String::NewFromUtf8(isolate, "Failed to start the waveform thread"))).FromJust();
+  } else if (req->work_cb == pulse_work) {
+    resolver->Resolve(context, v8::Number::New(isolate, (double)work->errors[0])).FromJust();
+  } else {
+    Local<v8::Array> errors = v8::Array::New(isolate, work->steps.size());
+    for (size_t i=0; i<work->steps.size(); i++)
+      errors->Set(context, i, v8::Number::New(isolate, (double)work->errors[i])).FromJust();
+    resolver->Resolve(context, errors).FromJust();
+  }
+  work->resolver.Reset();
+  delete work;
+}
+
+static void queue_wave(const FunctionCallbackInfo<Value>& args, WaveWork* work, uv_work_cb cb)
+{
+  Isolate* isolate = args.GetIsolate();
+  Local<Promise::Resolver> resolver =
+      Promise::Resolver::New(isolate->GetCurrentContext()).ToLocalChecked();
+
+  work->isolate = isolate;
+  work->resolver.Reset(isolate, resolver);
+  work->req.data = work;
+  uv_queue_work(node::GetCurrentEventLoop(isolate), &work->req, cb, settle_wave);
+  args.GetReturnValue().Set(resolver->GetPromise());
+}
+
+// node function promise = playWaveform(buffer, repeat = 1), resolves to how
+// late each step was written in ns, the worst over the repeats.  The buffer
+// holds 24 byte records: uint32 bank, set mask, clear mask, zero, then a
+// double time in nanoseconds after the previous step.
+static void
+export_play_waveform(const FunctionCallbackInfo<Value>& args)
+{
+  uint32_t outputs[2] = {0, 0};
+  double repeat = 1;
+  size_t count;
+
+  Isolate* isolate = args.GetIsolate();
+  AddonData* addon = get_addon_data(args);
+
+  if (args.Length() < 1 || !node::Buffer::HasInstance(args[0]) ||
+      node::Buffer::Length(args[0]) % sizeof(wave_step) != 0) {
+    isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate,
+        "playWaveform() expected a buffer of 24 byte steps")));
+    return;
+  }
+
+  if (args.Length() > 1 && !args[1]->IsUndefined() &&
+      (!args[1]->IsNumber() || (repeat = args[1]->NumberValue()) < 1 || repeat > 0xffffffff)) {
+    isolate->ThrowException(Exception::RangeError(String::NewFromUtf8(isolate,
+        "repeat must be at least 1")));
+    return;
+  }
+
+  if (check_gpio_priv(isolate))
+    return;
+
+  // copied, so the caller may reuse its buffer as soon as this returns
+  WaveWork* work = new WaveWork();
+  count = node::Buffer::Length(args[0]) / sizeof(wave_step);
+  work->steps.resize(count);
+  work->errors.resize(count ? count : 1);
+  work->repeat = (unsigned int)repeat;
+  if (count)
+    memcpy(work->steps.data(), node::Buffer::Data(args[0]), count * sizeof(wave_step));
+
+  for (int i=0; i<54; i++)
+    if (addon->gpio_direction[i] == OUTPUT)
+      outputs[i/32] |= 1 << (i%32);
+  for (size_t i=0; i<count; i++) {
+    const wave_step& s = work->steps[i];
+    if (s.bank > 1 || ((s.set | s.clr) & ~outputs[s.bank]) || !(s.delta_ns >= 0 && s.delta_ns <= WAVE_MAX_DELTA_NS)) {
+      delete work;
+      isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate,
+          "Every GPIO in a step must be set up as an OUTPUT, with a time from 0 to 1000000000 ns")));
+      return;
+    }
+  }
+
+  queue_wave(args, work, wave_work);
+}
+
+// node function promise = pulse(channel, widthUs, level = 1), resolves to
+// the achieved width less widthUs in ns
+static void
+export_pulse(const FunctionCallbackInfo<Value>& args)
+{
+  int gpio;
+  double width;
+
+  Isolate* isolate = args.GetIsolate();
+  AddonData* addon = get_addon_data(args);
+
+  if (args.Length() < 2 || !args[0]->IsNumber() || !args[1]->IsNumber()) {
+    isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate,
+        "pulse() expected a channel and a width in microseconds")));
+    return;
+  }
+
+  width = args[1]->NumberValue();
+  if (!(width >= 0 && width * 1000.0 <= WAVE_MAX_DELTA_NS)) {
+    isolate->ThrowException(Exception::RangeError(String::NewFromUtf8(isolate,
+        "The width must be from 0 to 1000000 microseconds")));
+    return;
+  }
+
+  if (get_gpio_number(isolate, addon, args[0]->NumberValue(), &gpio))
+    return;
+
+  if (addon->gpio_direction[gpio] != OUTPUT) {
+    isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "The GPIO channel has not been set up as an OUTPUT")));
+    return;
+  }
+
+  if (check_gpio_priv(isolate))
+    return;
+
+  WaveWork* work = new WaveWork();
+  work->errors.resize(1);
+  work->gpio = gpio;
+  work->width = (unsigned long long)(width * 1000.0);
+  work->level = args.Length() > 2 && !args[2]->IsUndefined() ? args[2]->BooleanValue() : 1;
+  queue_wave(args, work, pulse_work);
+}
+
+void sequence_init(Local<Object> exports, AddonData* addon)
+{
+  set_method(exports, "writeSequence", export_write_sequence, addon);
+  set_method(exports, "readSamples", export_read_samples, addon);
+  set_method(exports, "writeFrames", export_write_frames, addon);
+  set_method(exports, "playWaveform", export_play_waveform, addon);
+  set_method(exports, "pulse", export_pulse, addon);
+}
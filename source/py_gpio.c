@@ -21,33 +21,113 @@ SOFTWARE.
 */
 
 #include "Python.h"
+#include <pthread.h>
 #include "c_gpio.h"
 #include "event_gpio.h"
+#include "event_trace.h"
+#include "event_fd.h"
+#include "event_loadgen.h"
+#include "thread_sched.h"
+#include "sequence.h"
+#include "soft_pwm.h"
 #include "py_pwm.h"
+#include "py_pin.h"
 #include "cpuinfo.h"
 #include "constants.h"
 #include "common.h"
 
-static PyObject *rpi_revision; // deprecated
-static PyObject *board_info;
-static int gpio_warnings = 1;
+// per gpio, NULL or a tuple of (callback, details) pairs, details meaning the
+// callback is called with (channel, level, timestamp).  The tuple is replaced
+// rather than changed, so a thread running the callbacks keeps a reference
+// to it instead of holding py_cb_mutex while they run.
+static PyObject *py_callbacks[54];
 
-struct py_callback
+// batched delivery: the poll thread only queues edges, and a delivery
+// thread runs the callbacks for everything queued under one GIL acquisition
+#define PY_QUEUE_SIZE 65536
+
+struct py_edge
 {
    unsigned int gpio;
-   PyObject *py_cb;
-   struct py_callback *next;
+   int level;
+   unsigned long long timestamp;
 };
-static struct py_callback *py_callbacks = NULL;
+
+static pthread_mutex_t py_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t py_queue_cond = PTHREAD_COND_INITIALIZER;
+static struct py_edge *py_queue = NULL;      // ring, guarded by py_queue_lock
+static unsigned int py_queue_head = 0;       // guarded by py_queue_lock
+static unsigned int py_queue_count = 0;      // guarded by py_queue_lock
+static unsigned long py_queue_dropped = 0;   // guarded by py_queue_lock
+static int py_batching = 0;                  // guarded by py_queue_lock
+static struct py_edge *py_drained = NULL;    // delivery thread's copy of the ring
+static pthread_t py_delivery_thread;         // guarded by py_queue_lock
+static pthread_mutex_t py_batching_lock = PTHREAD_MUTEX_INITIALIZER;   // held while batching is changed
+static PyObject *py_batch_cb = NULL;         // guarded by py_cb_mutex
+
+// py_callbacks and py_batch_cb are guarded by the GIL on a normal build
+#ifdef Py_GIL_DISABLED
+static PyMutex py_cb_mutex;
+
+static void py_cb_lock(void)
+{
+   PyMutex_Lock(&py_cb_mutex);
+}
+
+static void py_cb_unlock(void)
+{
+   PyMutex_Unlock(&py_cb_mutex);
+}
+#else
+static void py_cb_lock(void)
+{
+}
+
+static void py_cb_unlock(void)
+{
+}
+#endif
+
+// the main interpreter's module state, for the callback threads, or NULL
+// once that module is freed
+static struct module_state *main_state = NULL;
+
+// module objects alive in the process, one per interpreter that imported it
+static int module_states = 0;
+
+// the library threads run callbacks in the main interpreter, so other
+// interpreters cannot add them
+static int check_callback_interp(struct module_state *state)
+{
+   if (!state->main_interp)
+   {
+      PyErr_SetString(PyExc_RuntimeError, "Callbacks can only be added in the main interpreter, use event_fd() and drain_events() instead");
+      return 1;
+   }
+   return 0;
+}
+
+static void remove_py_callbacks(unsigned int gpio)
+{
+   PyObject *cbs;
+
+   py_cb_lock();
+   cbs = py_callbacks[gpio];
+   py_callbacks[gpio] = NULL;
+   py_cb_unlock();
+   Py_XDECREF(cbs);
+}
 
 static int mmap_gpio_mem(void)
 {
    int result;
 
-   if (module_setup)
-      return 0;
+   state_lock();
+   result = module_setup ? SETUP_OK : setup();
+   if (result == SETUP_OK)
+      module_setup = 1;
+   state_unlock();
 
-   result = setup();
    if (result == SETUP_DEVMEM_FAIL)
    {
       PyErr_SetString(PyExc_RuntimeError, "No access to /dev/mem.  Try running as root!");
@@ -65,7 +145,6 @@ static int mmap_gpio_mem(void)
       PyErr_SetString(PyExc_RuntimeError, "Not running on a RPi!");
       return 5;
    } else { // result == SETUP_OK
-      module_setup = 1;
       return 0;
    }
 }
@@ -73,11 +152,13 @@ static int mmap_gpio_mem(void)
 // python function cleanup(channel=None)
 static PyObject *py_cleanup(PyObject *self, PyObject *args, PyObject *kwargs)
 {
+   struct module_state *state = get_module_state(self);
    int i;
    int chancount = -666;
    int found = 0;
    int channel = -666;
    unsigned int gpio;
+   uint32_t mask[2] = {0, 0};
    PyObject *chanlist = NULL;
    PyObject *chantuple = NULL;
    PyObject *tempobj;
@@ -85,15 +166,29 @@ static PyObject *py_cleanup(PyObject *self, PyObject *args, PyObject *kwargs)
 
    void cleanup_one(void)
    {
-      // clean up any /sys/class exports
+      // clean up any /sys/class exports, unless another interpreter set
+      // the channel up
+      state_lock();
+      if (gpio_in_use(state, gpio)) {
+         state_unlock();
+         return;
+      }
+      state_unlock();
       event_cleanup(gpio);
+      remove_py_callbacks(gpio);
 
-      // set everything back to input
-      if (gpio_direction[gpio] != -1) {
-         setup_gpio(gpio, INPUT, PUD_OFF);
-         gpio_direction[gpio] = -1;
+      // put the channel back the way it was before this program used it
+      state_lock();
+      if (state->gpio_direction[gpio] != -1) {
+         if (gpio < 32)
+            snapshot_restore(snapshot_boot(), 1 << gpio, 0);
+         else
+            snapshot_restore(snapshot_boot(), 0, 1 << (gpio-32));
+         state->gpio_direction[gpio] = -1;
+         release_gpio(state, gpio);
          found = 1;
       }
+      state_unlock();
    }
 
    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|O", kwlist, &chanlist))
@@ -125,20 +220,37 @@ static PyObject *py_cleanup(PyObject *self, PyObject *args, PyObject *kwargs)
 
    if (module_setup && !setup_error) {
       if (channel == -666 && chancount == -666) {   // channel not set - cleanup everything
-         // clean up any /sys/class exports
-         event_cleanup_all();
+         // clean up any /sys/class exports, only this interpreter's while
+         // others are still using theirs
+         state_lock();
+         i = module_states;
+         state_unlock();
+         if (i <= 1) {
+            event_cleanup_all();
+         } else {
+            for (i=0; i<54; i++)
+               if (state->gpio_direction[i] != -1)
+                  event_cleanup(i);
+         }
+         for (i=0; i<54; i++)
+            remove_py_callbacks(i);
 
-         // set everything back to input
+         // put every channel used back the way it was, in one pass
+         state_lock();
          for (i=0; i<54; i++) {
-            if (gpio_direction[i] != -1) {
-               setup_gpio(i, INPUT, PUD_OFF);
-               gpio_direction[i] = -1;
+            if (state->gpio_direction[i] != -1) {
+               mask[i/32] |= 1 << (i%32);
+               state->gpio_direction[i] = -1;
+               release_gpio(state, i);
                found = 1;
             }
          }
-         gpio_mode = MODE_UNKNOWN;
+         if (found)
+            snapshot_restore(snapshot_boot(), mask[0], mask[1]);
+         state->gpio_mode = MODE_UNKNOWN;
+         state_unlock();
       } else if (channel != -666) {    // channel was an int indicating single channel
-         if (get_gpio_number(channel, &gpio))
+         if (get_gpio_number(state, channel, &gpio))
             return NULL;
          cleanup_one();
       } else {  // channel was a list/tuple
@@ -167,7 +279,7 @@ static PyObject *py_cleanup(PyObject *self, PyObject *args, PyObject *kwargs)
                return NULL;
             }
 
-            if (get_gpio_number(channel, &gpio))
+            if (get_gpio_number(state, channel, &gpio))
                return NULL;
             cleanup_one();
          }
@@ -175,7 +287,7 @@ static PyObject *py_cleanup(PyObject *self, PyObject *args, PyObject *kwargs)
    }
 
    // check if any channels set up - if not warn about misuse of GPIO.cleanup()
-   if (!found && gpio_warnings) {
+   if (!found && state->gpio_warnings) {
       PyErr_WarnEx(NULL, "No channels have been set up yet - nothing to clean up!  Try cleaning up at the end of your program instead!", 1);
    }
 
@@ -185,6 +297,7 @@ static PyObject *py_cleanup(PyObject *self, PyObject *args, PyObject *kwargs)
 // python function setup(channel(s), direction, pull_up_down=PUD_OFF, initial=None)
 static PyObject *py_setup_channel(PyObject *self, PyObject *args, PyObject *kwargs)
 {
+   struct module_state *state = get_module_state(self);
    unsigned int gpio;
    int channel = -1;
    int direction;
@@ -196,21 +309,32 @@ static PyObject *py_setup_channel(PyObject *self, PyObject *args, PyObject *kwar
    int initial = -1;
    static char *kwlist[] = {"channel", "direction", "pull_up_down", "initial", NULL};
    int func;
+   struct gpio_txn txn;
+   unsigned int gpios[54];
+   int count = 0;
 
    int setup_one(void) {
-      if (get_gpio_number(channel, &gpio))
+      if (get_gpio_number(state, channel, &gpio))
+         return 0;
+
+      state_lock();
+      if (gpio_in_use(state, gpio)) {
+         state_unlock();
+         PyErr_SetString(PyExc_RuntimeError, "This channel is set up by another interpreter");
          return 0;
+      }
+      state_unlock();
 
       func = gpio_function(gpio);
-      if (gpio_warnings &&                             // warnings enabled and
-          ((func != 0 && func != 1) ||                 // (already one of the alt functions or
-          (gpio_direction[gpio] == -1 && func == 1)))  // already an output not set from this program)
+      if (state->gpio_warnings &&                             // warnings enabled and
+          ((func != 0 && func != 1) ||                        // (already one of the alt functions or
+          (state->gpio_direction[gpio] == -1 && func == 1)))  // already an output not set from this program)
       {
          PyErr_WarnEx(NULL, "This channel is already in use, continuing anyway.  Use GPIO.setwarnings(False) to disable warnings.", 1);
       }
 
       // warn about pull/up down on i2c channels
-      if (gpio_warnings) {
+      if (state->gpio_warnings) {
          if (rpiinfo.p1_revision == 0) { // compute module - do nothing
          } else if ((rpiinfo.p1_revision == 1 && (gpio == 0 || gpio == 1)) ||
                     (gpio == 2 || gpio == 3)) {
@@ -219,14 +343,30 @@ static PyObject *py_setup_channel(PyObject *self, PyObject *args, PyObject *kwar
          }
       }
 
+      if (count >= 54) {
+         PyErr_SetString(PyExc_ValueError, "Too many channels");
+         return 0;
+      }
+
+      // collect the changes so they can be applied together
       if (direction == OUTPUT && (initial == LOW || initial == HIGH)) {
-         output_gpio(gpio, initial);
+         txn_output_gpio(&txn, gpio, initial);
       }
-      setup_gpio(gpio, direction, pud);
-      gpio_direction[gpio] = direction;
+      txn_setup_gpio(&txn, gpio, direction, pud);
+      gpios[count++] = gpio;
       return 1;
    }
 
+   void commit(void) {
+      state_lock();
+      txn_commit(&txn);
+      for (i=0; i<count; i++) {
+         state->gpio_direction[gpios[i]] = direction;
+         claim_gpio(state, gpios[i]);
+      }
+      state_unlock();
+   }
+
    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Oi|ii", kwlist, &chanlist, &direction, &pud, &initial))
       return NULL;
 
@@ -285,6 +425,7 @@ static PyObject *py_setup_channel(PyObject *self, PyObject *args, PyObject *kwar
       return NULL;
    }
 
+   txn_begin(&txn);
    if (chanlist) {
        chancount = PyList_Size(chanlist);
    } else if (chantuple) {
@@ -292,6 +433,7 @@ static PyObject *py_setup_channel(PyObject *self, PyObject *args, PyObject *kwar
    } else {
        if (!setup_one())
           return NULL;
+       commit();
        Py_RETURN_NONE;
    }
 
@@ -324,13 +466,35 @@ static PyObject *py_setup_channel(PyObject *self, PyObject *args, PyObject *kwar
          return NULL;
    }
 
+   commit();
    Py_RETURN_NONE;
 }
 
+// write one channel of an output() call, returns 0 with an exception set
+static int output_channel(struct module_state *state, int channel, int value)
+{
+   unsigned int gpio;
+
+   if (get_gpio_number(state, channel, &gpio))
+       return 0;
+
+   if (state->gpio_direction[gpio] != OUTPUT)
+   {
+      PyErr_SetString(PyExc_RuntimeError, "The GPIO channel has not been set up as an OUTPUT");
+      return 0;
+   }
+
+   if (check_gpio_priv())
+      return 0;
+
+   output_gpio(gpio, value);
+   return 1;
+}
+
 // python function output(channel(s), value(s))
 static PyObject *py_output_gpio(PyObject *self, PyObject *args)
 {
-   unsigned int gpio;
+   struct module_state *state = get_module_state(self);
    int channel = -1;
    int value = -1;
    int i;
@@ -342,23 +506,6 @@ static PyObject *py_output_gpio(PyObject *self, PyObject *args)
    int chancount = -1;
    int valuecount = -1;
 
-   int output(void) {
-      if (get_gpio_number(channel, &gpio))
-          return 0;
-
-      if (gpio_direction[gpio] != OUTPUT)
-      {
-         PyErr_SetString(PyExc_RuntimeError, "The GPIO channel has not been set up as an OUTPUT");
-         return 0;
-      }
-
-      if (check_gpio_priv())
-         return 0;
-
-      output_gpio(gpio, value);
-      return 1;
-   }
-
    if (!PyArg_ParseTuple(args, "OO", &chanlist, &valuelist))
        return NULL;
 
@@ -416,7 +563,7 @@ static PyObject *py_output_gpio(PyObject *self, PyObject *args)
    }
 
    if (chancount == -1) {
-      if (!output())
+      if (!output_channel(state, channel, value))
          return NULL;
       Py_RETURN_NONE;
    }
@@ -472,7 +619,7 @@ static PyObject *py_output_gpio(PyObject *self, PyObject *args)
               return NULL;
           }
       }
-      if (!output())
+      if (!output_channel(state, channel, value))
          return NULL;
    }
 
@@ -482,6 +629,7 @@ static PyObject *py_output_gpio(PyObject *self, PyObject *args)
 // python function value = input(channel)
 static PyObject *py_input_gpio(PyObject *self, PyObject *args)
 {
+   struct module_state *state = get_module_state(self);
    unsigned int gpio;
    int channel;
    PyObject *value;
@@ -489,11 +637,11 @@ static PyObject *py_input_gpio(PyObject *self, PyObject *args)
    if (!PyArg_ParseTuple(args, "i", &channel))
       return NULL;
 
-   if (get_gpio_number(channel, &gpio))
+   if (get_gpio_number(state, channel, &gpio))
        return NULL;
 
    // check channel is set up as an input or output
-   if (gpio_direction[gpio] != INPUT && gpio_direction[gpio] != OUTPUT)
+   if (state->gpio_direction[gpio] != INPUT && state->gpio_direction[gpio] != OUTPUT)
    {
       PyErr_SetString(PyExc_RuntimeError, "You must setup() the GPIO channel first");
       return NULL;
@@ -513,42 +661,50 @@ static PyObject *py_input_gpio(PyObject *self, PyObject *args)
 // python function setmode(mode)
 static PyObject *py_setmode(PyObject *self, PyObject *args)
 {
+   struct module_state *state = get_module_state(self);
    int new_mode;
 
    if (!PyArg_ParseTuple(args, "i", &new_mode))
       return NULL;
 
-   if (gpio_mode != MODE_UNKNOWN && new_mode != gpio_mode)
+   state_lock();
+   if (state->gpio_mode != MODE_UNKNOWN && new_mode != state->gpio_mode)
    {
+      state_unlock();
       PyErr_SetString(PyExc_ValueError, "A different mode has already been set!");
       return NULL;
    }
 
    if (setup_error)
    {
+      state_unlock();
       PyErr_SetString(PyExc_RuntimeError, "Module not imported correctly!");
       return NULL;
    }
 
    if (new_mode != BOARD && new_mode != BCM)
    {
+      state_unlock();
       PyErr_SetString(PyExc_ValueError, "An invalid mode was passed to setmode()");
       return NULL;
    }
 
    if (rpiinfo.p1_revision == 0 && new_mode == BOARD)
    {
+      state_unlock();
       PyErr_SetString(PyExc_RuntimeError, "BOARD numbering system not applicable on compute module");
       return NULL;
    }
 
-   gpio_mode = new_mode;
+   state->gpio_mode = new_mode;
+   state_unlock();
    Py_RETURN_NONE;
 }
 
 // python function getmode()
 static PyObject *py_getmode(PyObject *self, PyObject *args)
 {
+   struct module_state *state = get_module_state(self);
    PyObject *value;
 
    if (setup_error)
@@ -557,19 +713,19 @@ static PyObject *py_getmode(PyObject *self, PyObject *args)
       return NULL;
    }
 
-   if (gpio_mode == MODE_UNKNOWN)
+   if (state->gpio_mode == MODE_UNKNOWN)
       Py_RETURN_NONE;
 
-   value = Py_BuildValue("i", gpio_mode);
+   value = Py_BuildValue("i", state->gpio_mode);
    return value;
 }
 
-static unsigned int chan_from_gpio(unsigned int gpio)
+static unsigned int chan_from_gpio(struct module_state *state, unsigned int gpio)
 {
    int chan;
    int chans;
 
-   if (gpio_mode == BCM)
+   if (state->gpio_mode == BCM)
       return gpio;
    if (rpiinfo.p1_revision == 0)   // not applicable for compute module
       return -1;
@@ -583,260 +739,302 @@ static unsigned int chan_from_gpio(unsigned int gpio)
    return -1;
 }
 
-static void run_py_callbacks(unsigned int gpio)
+// collect gpios per bank, checking each is set up as an output
+static int output_masks(struct module_state *state, unsigned int *gpios, int count, uint32_t *mask)
 {
-   PyObject *result;
-   PyGILState_STATE gstate;
-   struct py_callback *cb = py_callbacks;
+   int i;
 
-   while (cb != NULL)
+   mask[0] = mask[1] = 0;
+   for (i=0; i<count; i++)
    {
-      if (cb->gpio == gpio) {
-         // run callback
-         gstate = PyGILState_Ensure();
-         result = PyObject_CallFunction(cb->py_cb, "i", chan_from_gpio(gpio));
-         if (result == NULL && PyErr_Occurred()){
-            PyErr_Print();
-            PyErr_Clear();
-         }
-         Py_XDECREF(result);
-         PyGILState_Release(gstate);
+      if (state->gpio_direction[gpios[i]] != OUTPUT)
+      {
+         PyErr_SetString(PyExc_RuntimeError, "The GPIO channel has not been set up as an OUTPUT");
+         return 0;
       }
-      cb = cb->next;
+      mask[gpios[i]/32] |= 1 << (gpios[i]%32);
    }
+   return 1;
 }
 
-static int add_py_callback(unsigned int gpio, PyObject *cb_func)
+// check every gpio in a bank mask is set up as an output
+static int check_output_mask(struct module_state *state, int bank, unsigned long mask)
 {
-   struct py_callback *new_py_cb;
-   struct py_callback *cb = py_callbacks;
+   int gpio;
 
-   // add callback to py_callbacks list
-   new_py_cb = malloc(sizeof(struct py_callback));
-   if (new_py_cb == 0)
+   if (bank != 0 && bank != 1)
    {
-      PyErr_NoMemory();
-      return -1;
+      PyErr_SetString(PyExc_ValueError, "bank must be 0 or 1");
+      return 0;
    }
-   new_py_cb->py_cb = cb_func;
-   Py_XINCREF(cb_func);         // Add a reference to new callback
-   new_py_cb->gpio = gpio;
-   new_py_cb->next = NULL;
-   if (py_callbacks == NULL) {
-      py_callbacks = new_py_cb;
-   } else {
-      // add to end of list
-      while (cb->next != NULL)
-         cb = cb->next;
-      cb->next = new_py_cb;
+
+   if (mask > 0xffffffffUL || (bank == 1 && (mask >> 22)))
+   {
+      PyErr_SetString(PyExc_ValueError, "The mask has bits for GPIOs that do not exist");
+      return 0;
    }
-   add_edge_callback(gpio, run_py_callbacks);
-   return 0;
+
+   for (gpio=0; gpio<32; gpio++)
+   {
+      if ((mask & (1UL << gpio)) && state->gpio_direction[bank*32 + gpio] != OUTPUT)
+      {
+         PyErr_SetString(PyExc_RuntimeError, "The GPIO channel has not been set up as an OUTPUT");
+         return 0;
+      }
+   }
+   return 1;
 }
 
-// python function add_event_callback(gpio, callback)
-static PyObject *py_add_event_callback(PyObject *self, PyObject *args, PyObject *kwargs)
+// python function toggle(channel(s))
+static PyObject *py_toggle(PyObject *self, PyObject *args)
 {
-   unsigned int gpio;
-   int channel;
-   PyObject *cb_func;
-   char *kwlist[] = {"gpio", "callback", NULL};
+   struct module_state *state = get_module_state(self);
+   PyObject *chanlist;
+   unsigned int gpios[54];
+   uint32_t mask[2];
+   int count;
 
-   if (!PyArg_ParseTupleAndKeywords(args, kwargs, "iO|i", kwlist, &channel, &cb_func))
+   if (!PyArg_ParseTuple(args, "O", &chanlist))
       return NULL;
 
-   if (!PyCallable_Check(cb_func))
-   {
-      PyErr_SetString(PyExc_TypeError, "Parameter must be callable");
+   if ((count = parse_gpio_list(state, chanlist, gpios, 54)) < 0)
       return NULL;
-   }
 
-   if (get_gpio_number(channel, &gpio))
-       return NULL;
+   if (!output_masks(state, gpios, count, mask))
+      return NULL;
 
-   // check channel is set up as an input
-   if (gpio_direction[gpio] != INPUT)
-   {
-      PyErr_SetString(PyExc_RuntimeError, "You must setup() the GPIO channel as an input first");
+   if (check_gpio_priv())
       return NULL;
-   }
 
-   if (!gpio_event_added(gpio))
-   {
-      PyErr_SetString(PyExc_RuntimeError, "Add event detection using add_event_detect first before adding a callback");
+   if (mask[0])
+      toggle_gpio_bank(0, mask[0]);
+   if (mask[1])
+      toggle_gpio_bank(1, mask[1]);
+   Py_RETURN_NONE;
+}
+
+// python function toggle_mask(mask, bank=0)
+static PyObject *py_toggle_mask(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+   struct module_state *state = get_module_state(self);
+   unsigned long mask;
+   int bank = 0;
+   static char *kwlist[] = {"mask", "bank", NULL};
+
+   if (!PyArg_ParseTupleAndKeywords(args, kwargs, "k|i", kwlist, &mask, &bank))
       return NULL;
-   }
 
-   if (add_py_callback(gpio, cb_func) != 0)
+   if (!check_output_mask(state, bank, mask))
       return NULL;
 
+   if (check_gpio_priv())
+      return NULL;
+
+   if (mask)
+      toggle_gpio_bank(bank, (uint32_t)mask);
    Py_RETURN_NONE;
 }
 
-// python function add_event_detect(gpio, edge, callback=None, bouncetime=None)
-static PyObject *py_add_event_detect(PyObject *self, PyObject *args, PyObject *kwargs)
+// python function value(s) = output_state(channel(s))
+static PyObject *py_output_state(PyObject *self, PyObject *args)
 {
-   unsigned int gpio;
-   int channel, edge, result;
-   int bouncetime = -666;
-   PyObject *cb_func = NULL;
-   char *kwlist[] = {"gpio", "edge", "callback", "bouncetime", NULL};
-
-   if (!PyArg_ParseTupleAndKeywords(args, kwargs, "ii|Oi", kwlist, &channel, &edge, &cb_func, &bouncetime))
+   struct module_state *state = get_module_state(self);
+   PyObject *chanlist;
+   PyObject *list;
+   unsigned int gpios[54];
+   uint32_t mask[2];
+   uint32_t levels[2];
+   int i, count;
+
+   if (!PyArg_ParseTuple(args, "O", &chanlist))
       return NULL;
 
-   if (cb_func != NULL && !PyCallable_Check(cb_func))
-   {
-      PyErr_SetString(PyExc_TypeError, "Parameter must be callable");
+   if ((count = parse_gpio_list(state, chanlist, gpios, 54)) < 0)
       return NULL;
-   }
 
-   if (get_gpio_number(channel, &gpio))
-       return NULL;
+   if (!output_masks(state, gpios, count, mask))
+      return NULL;
 
-   // check channel is set up as an input
-   if (gpio_direction[gpio] != INPUT)
-   {
-      PyErr_SetString(PyExc_RuntimeError, "You must setup() the GPIO channel as an input first");
+   if (check_gpio_priv())
       return NULL;
-   }
 
-   // is edge valid value
-   edge -= PY_EVENT_CONST_OFFSET;
-   if (edge != RISING_EDGE && edge != FALLING_EDGE && edge != BOTH_EDGE)
-   {
-      PyErr_SetString(PyExc_ValueError, "The edge must be set to RISING, FALLING or BOTH");
+   levels[0] = output_state_bank(0);
+   levels[1] = output_state_bank(1);
+
+   if (!PyList_Check(chanlist) && !PyTuple_Check(chanlist))
+      return Py_BuildValue("i", (levels[gpios[0]/32] >> (gpios[0]%32)) & 1);
+
+   if ((list = PyList_New(count)) == NULL)
       return NULL;
-   }
+   for (i=0; i<count; i++)
+      PyList_SET_ITEM(list, i, Py_BuildValue("i", (levels[gpios[i]/32] >> (gpios[i]%32)) & 1));
+   return list;
+}
 
-   if (bouncetime <= 0 && bouncetime != -666)
-   {
-      PyErr_SetString(PyExc_ValueError, "Bouncetime must be greater than 0");
+// python function [channel, ...] = verify_outputs(resync=False)
+static PyObject *py_verify_outputs(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+   struct module_state *state = get_module_state(self);
+   PyObject *list;
+   PyObject *chan;
+   uint32_t differ[2] = {0, 0};
+   uint32_t outputs[2] = {0, 0};
+   int i, gpio, resync = 0;
+   static char *kwlist[] = {"resync", NULL};
+
+   if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|i", kwlist, &resync))
       return NULL;
-   }
 
    if (check_gpio_priv())
       return NULL;
 
-   if ((result = add_edge_detect(gpio, edge, bouncetime)) != 0)   // starts a thread
+   for (gpio=0; gpio<54; gpio++)
+      if (state->gpio_direction[gpio] == OUTPUT)
+         outputs[gpio/32] |= 1 << (gpio%32);
+
+   for (i=0; i<2; i++)
    {
-      if (result == 1)
+      if (!outputs[i])
+         continue;
+      differ[i] = verify_output_bank(i) & outputs[i];
+      if (resync && differ[i])
+         sync_output_state(i, differ[i]);
+   }
+
+   if ((list = PyList_New(0)) == NULL)
+      return NULL;
+   for (gpio=0; gpio<54; gpio++)
+   {
+      if (!(differ[gpio/32] & (1 << (gpio%32))))
+         continue;
+      chan = Py_BuildValue("i", chan_from_gpio(state, gpio));
+      if (chan == NULL || PyList_Append(list, chan) != 0)
       {
-         PyErr_SetString(PyExc_RuntimeError, "Conflicting edge detection already enabled for this GPIO channel");
-         return NULL;
-      } else {
-         PyErr_SetString(PyExc_RuntimeError, "Failed to add edge detection");
+         Py_XDECREF(chan);
+         Py_DECREF(list);
          return NULL;
       }
+      Py_DECREF(chan);
    }
-
-   if (cb_func != NULL)
-      if (add_py_callback(gpio, cb_func) != 0)
-         return NULL;
-
-   Py_RETURN_NONE;
+   return list;
 }
 
-// python function remove_event_detect(gpio)
-static PyObject *py_remove_event_detect(PyObject *self, PyObject *args)
+// python function [error, ...] = play_waveform(steps, repeat=1)
+static PyObject *py_play_waveform(PyObject *self, PyObject *args, PyObject *kwargs)
 {
-   unsigned int gpio;
-   int channel;
-   struct py_callback *cb = py_callbacks;
-   struct py_callback *temp;
-   struct py_callback *prev = NULL;
+   struct module_state *state = get_module_state(self);
+   PyObject *steplist;
+   PyObject *list;
+   struct wave_step *steps;
+   long long *errors;
+   unsigned long set, clr;
+   unsigned int bank;
+   unsigned int repeat = 1;
+   Py_ssize_t i, count;
+   int result;
+   static char *kwlist[] = {"steps", "repeat", NULL};
 
-   if (!PyArg_ParseTuple(args, "i", &channel))
+   if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|I", kwlist, &steplist, &repeat))
       return NULL;
 
-   if (get_gpio_number(channel, &gpio))
-       return NULL;
-
-   // remove all python callbacks for gpio
-   while (cb != NULL)
+   if (!PyList_Check(steplist) && !PyTuple_Check(steplist))
    {
-      if (cb->gpio == gpio)
-      {
-         Py_XDECREF(cb->py_cb);
-         if (prev == NULL)
-            py_callbacks = cb->next;
-         else
-            prev->next = cb->next;
-         temp = cb;
-         cb = cb->next;
-         free(temp);
-      } else {
-         prev = cb;
-         cb = cb->next;
-      }
+      PyErr_SetString(PyExc_ValueError, "steps must be a list/tuple of (delta_ns, set_mask, clear_mask[, bank]) tuples");
+      return NULL;
    }
 
-   if (check_gpio_priv())
+   if (repeat < 1)
+   {
+      PyErr_SetString(PyExc_ValueError, "repeat must be at least 1");
       return NULL;
+   }
 
-   remove_edge_detect(gpio);
+   count = PySequence_Fast_GET_SIZE(steplist);
+   steps = calloc(count ? count : 1, sizeof(struct wave_step));
+   errors = calloc(count ? count : 1, sizeof(long long));
+   if (steps == NULL || errors == NULL)
+   {
+      free(steps);
+      free(errors);
+      return PyErr_NoMemory();
+   }
 
-   Py_RETURN_NONE;
-}
+   for (i=0; i<count; i++)
+   {
+      bank = 0;
+      if (!PyTuple_Check(PySequence_Fast_GET_ITEM(steplist, i)) ||
+          !PyArg_ParseTuple(PySequence_Fast_GET_ITEM(steplist, i), "dkk|I", &steps[i].delta_ns, &set, &clr, &bank))
+      {
+         if (!PyErr_Occurred())
+            PyErr_SetString(PyExc_ValueError, "Each step must be a (delta_ns, set_mask, clear_mask[, bank]) tuple");
+         goto fail;
+      }
+      if (!(steps[i].delta_ns >= 0 && steps[i].delta_ns <= WAVE_MAX_DELTA_NS))
+      {
+         PyErr_SetString(PyExc_ValueError, "delta_ns must be from 0 to 1000000000");
+         goto fail;
+      }
+      if (!check_output_mask(state, bank, set) || !check_output_mask(state, bank, clr))
+         goto fail;
+      steps[i].bank = bank;
+      steps[i].set = set;
+      steps[i].clr = clr;
+   }
 
-// python function value = event_detected(channel)
-static PyObject *py_event_detected(PyObject *self, PyObject *args)
-{
-   unsigned int gpio;
-   int channel;
+   if (check_gpio_priv())
+      goto fail;
 
-   if (!PyArg_ParseTuple(args, "i", &channel))
-      return NULL;
+   Py_BEGIN_ALLOW_THREADS // disable GIL
+   result = play_wave(steps, count, repeat, errors);
+   Py_END_ALLOW_THREADS   // enable GIL
 
-   if (get_gpio_number(channel, &gpio))
-       return NULL;
+   if (result != 0)
+   {
+      PyErr_SetString(PyExc_RuntimeError, "Failed to start the waveform thread");
+      goto fail;
+   }
 
-   if (event_detected(gpio))
-      Py_RETURN_TRUE;
-   else
-      Py_RETURN_FALSE;
+   if ((list = PyList_New(count)) != NULL)
+   {
+      for (i=0; i<count; i++)
+         PyList_SET_ITEM(list, i, PyLong_FromLongLong(errors[i]));
+   }
+   free(steps);
+   free(errors);
+   return list;
+
+fail:
+   free(steps);
+   free(errors);
+   return NULL;
 }
 
-// python function channel = wait_for_edge(channel, edge, bouncetime=None, timeout=None)
-static PyObject *py_wait_for_edge(PyObject *self, PyObject *args, PyObject *kwargs)
+// python function error = pulse(channel, width_us, level=HIGH)
+static PyObject *py_pulse(PyObject *self, PyObject *args, PyObject *kwargs)
 {
+   struct module_state *state = get_module_state(self);
    unsigned int gpio;
-   int channel, edge, result;
-   int bouncetime = -666; // None
-   int timeout = -1; // None
-
-   static char *kwlist[] = {"channel", "edge", "bouncetime", "timeout", NULL};
-
-   if (!PyArg_ParseTupleAndKeywords(args, kwargs, "ii|ii", kwlist, &channel, &edge, &bouncetime, &timeout))
-      return NULL;
-
-   if (get_gpio_number(channel, &gpio))
-      return NULL;
+   int channel, result;
+   int level = HIGH;
+   double width;
+   long long error;
+   static char *kwlist[] = {"channel", "width_us", "level", NULL};
 
-   // check channel is setup as an input
-   if (gpio_direction[gpio] != INPUT)
-   {
-      PyErr_SetString(PyExc_RuntimeError, "You must setup() the GPIO channel as an input first");
+   if (!PyArg_ParseTupleAndKeywords(args, kwargs, "id|i", kwlist, &channel, &width, &level))
       return NULL;
-   }
 
-   // is edge a valid value?
-   edge -= PY_EVENT_CONST_OFFSET;
-   if (edge != RISING_EDGE && edge != FALLING_EDGE && edge != BOTH_EDGE)
-   {
-      PyErr_SetString(PyExc_ValueError, "The edge must be set to RISING, FALLING or BOTH");
+   if (get_gpio_number(state, channel, &gpio))
       return NULL;
-   }
 
-   if (bouncetime <= 0 && bouncetime != -666)
+   if (state->gpio_direction[gpio] != OUTPUT)
    {
-      PyErr_SetString(PyExc_ValueError, "Bouncetime must be greater than 0");
+      PyErr_SetString(PyExc_RuntimeError, "The GPIO channel has not been set up as an OUTPUT");
       return NULL;
    }
 
-   if (timeout <= 0 && timeout != -1)
+   if (!(width >= 0 && width * 1000.0 <= WAVE_MAX_DELTA_NS))
    {
-      PyErr_SetString(PyExc_ValueError, "Timeout must be greater than 0");
+      PyErr_SetString(PyExc_ValueError, "width_us must be from 0 to 1000000");
       return NULL;
    }
 
@@ -844,35 +1042,1011 @@ static PyObject *py_wait_for_edge(PyObject *self, PyObject *args, PyObject *kwar
       return NULL;
 
    Py_BEGIN_ALLOW_THREADS // disable GIL
-   result = blocking_wait_for_edge(gpio, edge, bouncetime, timeout);
+   result = play_pulse(gpio, (unsigned long long)(width * 1000.0), level, &error);
    Py_END_ALLOW_THREADS   // enable GIL
 
-   if (result == 0) {
-      Py_RETURN_NONE;
-   } else if (result == -1) {
-      PyErr_SetString(PyExc_RuntimeError, "Conflicting edge detection events already exist for this GPIO channel");
-      return NULL;
-   } else if (result == -2) {
-      PyErr_SetString(PyExc_RuntimeError, "Error waiting for edge");
+   if (result != 0)
+   {
+      PyErr_SetString(PyExc_RuntimeError, "Failed to start the waveform thread");
       return NULL;
-   } else {
-      return Py_BuildValue("i", channel);
    }
 
+   return PyLong_FromLongLong(error);
 }
 
-// python function value = gpio_function(channel)
-static PyObject *py_gpio_function(PyObject *self, PyObject *args)
+// call the callbacks of a gpio, holding the GIL.  level and timestamp are
+// as sampled by the poll thread when the edge was detected.
+static void run_py_callbacks(unsigned int gpio, int level, unsigned long long timestamp)
 {
-   unsigned int gpio;
-   int channel;
-   int f;
-   PyObject *func;
-
+   struct module_state *state = main_state;
+   PyObject *result;
+   PyObject *cbs;
+   PyObject *cb;
+   Py_ssize_t i;
+
+   py_cb_lock();
+   cbs = py_callbacks[gpio];
+   Py_XINCREF(cbs);
+   py_cb_unlock();
+   if (cbs == NULL)
+      return;
+   if (state == NULL) {    // the main interpreter's module has gone
+      Py_DECREF(cbs);
+      return;
+   }
+
+   for (i=0; i<PyTuple_GET_SIZE(cbs); i++) {
+      cb = PyTuple_GET_ITEM(cbs, i);
+      if (PyTuple_GET_ITEM(cb, 1) == Py_True)
+         result = PyObject_CallFunction(PyTuple_GET_ITEM(cb, 0), "iiK", chan_from_gpio(state, gpio), level, timestamp);
+      else
+         result = PyObject_CallFunction(PyTuple_GET_ITEM(cb, 0), "i", chan_from_gpio(state, gpio));
+      if (result == NULL && PyErr_Occurred()){
+         PyErr_Print();
+         PyErr_Clear();
+      }
+      Py_XDECREF(result);
+   }
+   Py_DECREF(cbs);
+}
+
+// run on the delivery thread, holding the GIL
+static void deliver_py_edges(unsigned int count, unsigned long dropped)
+{
+   struct module_state *state = main_state;
+   PyObject *batch = NULL;
+   PyObject *batch_cb;
+   PyObject *result;
+   unsigned int i;
+   char message[80];
+
+   if (state == NULL)    // the main interpreter's module has gone
+      return;
+
+   if (dropped && state->gpio_warnings) {
+      PyOS_snprintf(message, sizeof(message), "%lu edges were dropped because callbacks could not keep up", dropped);
+      if (PyErr_WarnEx(PyExc_RuntimeWarning, message, 1) == -1) {   // warnings are errors
+         PyErr_Print();
+         PyErr_Clear();
+      }
+   }
+
+   py_cb_lock();
+   batch_cb = py_batch_cb;
+   Py_XINCREF(batch_cb);
+   py_cb_unlock();
+
+   if (batch_cb != NULL && (batch = PyList_New(count)) == NULL) {
+      PyErr_Print();
+      PyErr_Clear();
+   }
+
+   for (i=0; i<count; i++) {
+      loadgen_mark(py_drained[i].timestamp);
+      run_py_callbacks(py_drained[i].gpio, py_drained[i].level, py_drained[i].timestamp);
+      if (batch != NULL)
+         PyList_SET_ITEM(batch, i, Py_BuildValue("(iiK)", chan_from_gpio(state, py_drained[i].gpio),
+                                                 py_drained[i].level, py_drained[i].timestamp));
+   }
+
+   if (batch != NULL) {
+      if (count) {
+         result = PyObject_CallFunctionObjArgs(batch_cb, batch, NULL);
+         if (result == NULL && PyErr_Occurred()) {
+            PyErr_Print();
+            PyErr_Clear();
+         }
+         Py_XDECREF(result);
+      }
+      Py_DECREF(batch);
+   }
+   Py_XDECREF(batch_cb);
+}
+
+static void *py_delivery(void *arg)
+{
+   PyGILState_STATE gstate;
+   unsigned int i, count;
+   unsigned long dropped;
+
+   pthread_mutex_lock(&py_queue_lock);
+   // finish what is queued before stopping
+   while (py_batching || py_queue_count || py_queue_dropped) {
+      if (!py_queue_count && !py_queue_dropped) {
+         pthread_cond_wait(&py_queue_cond, &py_queue_lock);
+         continue;
+      }
+      count = py_queue_count;
+      for (i=0; i<count; i++)
+         py_drained[i] = py_queue[(py_queue_head + i) % PY_QUEUE_SIZE];
+      py_queue_head = (py_queue_head + count) % PY_QUEUE_SIZE;
+      py_queue_count = 0;
+      dropped = py_queue_dropped;
+      py_queue_dropped = 0;
+      pthread_mutex_unlock(&py_queue_lock);
+
+      gstate = PyGILState_Ensure();
+      deliver_py_edges(count, dropped);
+      PyGILState_Release(gstate);
+
+      pthread_mutex_lock(&py_queue_lock);
+   }
+   pthread_mutex_unlock(&py_queue_lock);
+   return NULL;
+}
+
+// edge callback, run on the poll thread
+static void py_edge_callback(unsigned int gpio, int level, unsigned long long timestamp)
+{
+   PyGILState_STATE gstate;
+
+   pthread_mutex_lock(&py_queue_lock);
+   if (py_batching) {
+      if (py_queue_count < PY_QUEUE_SIZE) {
+         struct py_edge *e = &py_queue[(py_queue_head + py_queue_count) % PY_QUEUE_SIZE];
+         e->gpio = gpio;
+         e->level = level;
+         e->timestamp = timestamp;
+         py_queue_count++;
+      } else {
+         py_queue_dropped++;
+      }
+      pthread_cond_signal(&py_queue_cond);
+      pthread_mutex_unlock(&py_queue_lock);
+      return;
+   }
+   pthread_mutex_unlock(&py_queue_lock);
+
+   if (py_callbacks[gpio] == NULL)
+      return;
+   gstate = PyGILState_Ensure();
+   loadgen_mark(timestamp);
+   run_py_callbacks(gpio, level, timestamp);
+   PyGILState_Release(gstate);
+}
+
+// one edge callback per line runs the callback list, or queues the edge for
+// a batch.  It is only added once a line has something to deliver to, so
+// lines without callbacks can still wait_for_edge().
+static int add_edge_bridge(unsigned int gpio)
+{
+   int result = 0;
+
+   py_cb_lock();
+   if (!callback_exists(gpio) && add_edge_callback_ex(gpio, py_edge_callback) != 0)
+      result = -1;
+   py_cb_unlock();
+   if (result)
+      PyErr_NoMemory();
+   return result;
+}
+
+static int add_py_callback(unsigned int gpio, PyObject *cb_func, int details)
+{
+   PyObject *cb;
+   PyObject *cbs;
+   PyObject *old;
+   Py_ssize_t i, n;
+
+   if (add_edge_bridge(gpio) != 0)
+      return -1;
+
+   if ((cb = Py_BuildValue("(ON)", cb_func, PyBool_FromLong(details))) == NULL)
+      return -1;
+
+   // copy the gpio's list and add to the end of it
+   py_cb_lock();
+   old = py_callbacks[gpio];
+   n = old == NULL ? 0 : PyTuple_GET_SIZE(old);
+   if ((cbs = PyTuple_New(n + 1)) == NULL)
+   {
+      py_cb_unlock();
+      Py_DECREF(cb);
+      return -1;
+   }
+   for (i=0; i<n; i++) {
+      Py_INCREF(PyTuple_GET_ITEM(old, i));
+      PyTuple_SET_ITEM(cbs, i, PyTuple_GET_ITEM(old, i));
+   }
+   PyTuple_SET_ITEM(cbs, n, cb);
+   py_callbacks[gpio] = cbs;
+   py_cb_unlock();
+   Py_XDECREF(old);
+   return 0;
+}
+
+// python function set_callback_batching(enabled, callback=None)
+static PyObject *py_set_callback_batching(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+   struct module_state *state = get_module_state(self);
+   int enabled, i, in_callback, was_batching;
+   int result = 0;
+   PyObject *cb_func = Py_None;
+   PyObject *old_cb;
+   static char *kwlist[] = {"enabled", "callback", NULL};
+
+   if (!PyArg_ParseTupleAndKeywords(args, kwargs, "i|O", kwlist, &enabled, &cb_func))
+      return NULL;
+
+   if (cb_func != Py_None && !PyCallable_Check(cb_func))
+   {
+      PyErr_SetString(PyExc_TypeError, "Parameter must be callable");
+      return NULL;
+   }
+
+   if (cb_func != Py_None && check_callback_interp(state))
+      return NULL;
+
+   pthread_mutex_lock(&py_queue_lock);
+   in_callback = py_batching && pthread_equal(pthread_self(), py_delivery_thread);
+   pthread_mutex_unlock(&py_queue_lock);
+   if (in_callback)
+   {
+      PyErr_SetString(PyExc_RuntimeError, "Callback batching cannot be changed from a callback");
+      return NULL;
+   }
+
+   // one change at a time, waited for without the GIL, which the delivery
+   // thread needs to finish
+   Py_BEGIN_ALLOW_THREADS
+   pthread_mutex_lock(&py_batching_lock);
+   Py_END_ALLOW_THREADS
+
+   py_cb_lock();
+   old_cb = py_batch_cb;
+   py_batch_cb = NULL;
+   py_cb_unlock();
+   Py_XDECREF(old_cb);
+
+   if (!enabled) {
+      pthread_mutex_lock(&py_queue_lock);
+      was_batching = py_batching;
+      py_batching = 0;
+      pthread_cond_signal(&py_queue_cond);
+      pthread_mutex_unlock(&py_queue_lock);
+
+      if (was_batching) {
+         Py_BEGIN_ALLOW_THREADS
+         pthread_join(py_delivery_thread, NULL);
+         Py_END_ALLOW_THREADS
+      }
+      pthread_mutex_unlock(&py_batching_lock);
+      Py_RETURN_NONE;
+   }
+
+   if (cb_func != Py_None) {
+      // the batch callback gets the edges of every line with event detection
+      for (i=0; i<54; i++) {
+         if (state->gpio_direction[i] == INPUT && gpio_event_added(i) && add_edge_bridge(i) != 0) {
+            pthread_mutex_unlock(&py_batching_lock);
+            return NULL;
+         }
+      }
+      Py_INCREF(cb_func);
+      py_cb_lock();
+      py_batch_cb = cb_func;
+      py_cb_unlock();
+   }
+
+   if (py_queue == NULL) {
+      py_queue = malloc(PY_QUEUE_SIZE * sizeof(struct py_edge));
+      py_drained = malloc(PY_QUEUE_SIZE * sizeof(struct py_edge));
+      if (py_queue == NULL || py_drained == NULL) {
+         free(py_queue);
+         free(py_drained);
+         py_queue = py_drained = NULL;
+         pthread_mutex_unlock(&py_batching_lock);
+         return PyErr_NoMemory();
+      }
+   }
+
+   // the thread waits for py_queue_lock, so it sees py_batching set
+   pthread_mutex_lock(&py_queue_lock);
+   if (!py_batching) {
+      py_batching = 1;
+      if (pthread_create(&py_delivery_thread, NULL, py_delivery, NULL) != 0) {
+         py_batching = 0;
+         result = -1;
+      }
+   }
+   pthread_mutex_unlock(&py_queue_lock);
+   pthread_mutex_unlock(&py_batching_lock);
+
+   if (result != 0)
+   {
+      PyErr_SetString(PyExc_RuntimeError, "Failed to start the callback delivery thread");
+      return NULL;
+   }
+   Py_RETURN_NONE;
+}
+
+// python function add_event_callback(gpio, callback, details=False)
+static PyObject *py_add_event_callback(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+   struct module_state *state = get_module_state(self);
+   unsigned int gpio;
+   int channel;
+   int details = 0;
+   PyObject *cb_func;
+   char *kwlist[] = {"gpio", "callback", "details", NULL};
+
+   if (!PyArg_ParseTupleAndKeywords(args, kwargs, "iO|i", kwlist, &channel, &cb_func, &details))
+      return NULL;
+
+   if (!PyCallable_Check(cb_func))
+   {
+      PyErr_SetString(PyExc_TypeError, "Parameter must be callable");
+      return NULL;
+   }
+
+   if (check_callback_interp(state))
+      return NULL;
+
+   if (get_gpio_number(state, channel, &gpio))
+       return NULL;
+
+   // check channel is set up as an input
+   if (state->gpio_direction[gpio] != INPUT)
+   {
+      PyErr_SetString(PyExc_RuntimeError, "You must setup() the GPIO channel as an input first");
+      return NULL;
+   }
+
+   if (!gpio_event_added(gpio))
+   {
+      PyErr_SetString(PyExc_RuntimeError, "Add event detection using add_event_detect first before adding a callback");
+      return NULL;
+   }
+
+   if (add_py_callback(gpio, cb_func, details) != 0)
+      return NULL;
+
+   Py_RETURN_NONE;
+}
+
+// python function add_event_detect(gpio, edge, callback=None, bouncetime=None, details=False)
+static PyObject *py_add_event_detect(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+   struct module_state *state = get_module_state(self);
+   unsigned int gpio;
+   int channel, edge, result, batching;
+   int bouncetime = -666;
+   int details = 0;
+   PyObject *cb_func = NULL;
+   char *kwlist[] = {"gpio", "edge", "callback", "bouncetime", "details", NULL};
+
+   if (!PyArg_ParseTupleAndKeywords(args, kwargs, "ii|Oii", kwlist, &channel, &edge, &cb_func, &bouncetime, &details))
+      return NULL;
+
+   if (cb_func != NULL && !PyCallable_Check(cb_func))
+   {
+      PyErr_SetString(PyExc_TypeError, "Parameter must be callable");
+      return NULL;
+   }
+
+   if (cb_func != NULL && check_callback_interp(state))
+      return NULL;
+
+   if (get_gpio_number(state, channel, &gpio))
+       return NULL;
+
+   // check channel is set up as an input
+   if (state->gpio_direction[gpio] != INPUT)
+   {
+      PyErr_SetString(PyExc_RuntimeError, "You must setup() the GPIO channel as an input first");
+      return NULL;
+   }
+
+   // is edge valid value
+   edge -= PY_EVENT_CONST_OFFSET;
+   if (edge != RISING_EDGE && edge != FALLING_EDGE && edge != BOTH_EDGE)
+   {
+      PyErr_SetString(PyExc_ValueError, "The edge must be set to RISING, FALLING or BOTH");
+      return NULL;
+   }
+
+   if (bouncetime <= 0 && bouncetime != -666)
+   {
+      PyErr_SetString(PyExc_ValueError, "Bouncetime must be greater than 0");
+      return NULL;
+   }
+
+   if (check_gpio_priv())
+      return NULL;
+
+   if ((result = add_edge_detect(gpio, edge, bouncetime)) != 0)   // starts a thread
+   {
+      if (result == 1)
+      {
+         PyErr_SetString(PyExc_RuntimeError, "Conflicting edge detection already enabled for this GPIO channel");
+         return NULL;
+      } else {
+         PyErr_SetString(PyExc_RuntimeError, "Failed to add edge detection");
+         return NULL;
+      }
+   }
+
+   if (cb_func != NULL) {
+      if (add_py_callback(gpio, cb_func, details) != 0)
+         return NULL;
+   } else {
+      py_cb_lock();
+      batching = py_batch_cb != NULL;
+      py_cb_unlock();
+      if (batching && add_edge_bridge(gpio) != 0)
+         return NULL;
+   }
+
+   Py_RETURN_NONE;
+}
+
+// python function remove_event_detect(gpio)
+static PyObject *py_remove_event_detect(PyObject *self, PyObject *args)
+{
+   struct module_state *state = get_module_state(self);
+   unsigned int gpio;
+   int channel;
+
+   if (!PyArg_ParseTuple(args, "i", &channel))
+      return NULL;
+
+   if (get_gpio_number(state, channel, &gpio))
+       return NULL;
+
+   // remove all python callbacks for gpio
+   remove_py_callbacks(gpio);
+
+   if (check_gpio_priv())
+      return NULL;
+
+   remove_edge_detect(gpio);
+
+   Py_RETURN_NONE;
+}
+
+// python function value = event_detected(channel)
+static PyObject *py_event_detected(PyObject *self, PyObject *args)
+{
+   struct module_state *state = get_module_state(self);
+   unsigned int gpio;
+   int channel;
+
+   if (!PyArg_ParseTuple(args, "i", &channel))
+      return NULL;
+
+   if (get_gpio_number(state, channel, &gpio))
+       return NULL;
+
+   if (event_detected(gpio))
+      Py_RETURN_TRUE;
+   else
+      Py_RETURN_FALSE;
+}
+
+// python function channel = wait_for_edge(channel, edge, bouncetime=None, timeout=None)
+static PyObject *py_wait_for_edge(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+   struct module_state *state = get_module_state(self);
+   unsigned int gpio;
+   int channel, edge, result;
+   int bouncetime = -666; // None
+   int timeout = -1; // None
+
+   static char *kwlist[] = {"channel", "edge", "bouncetime", "timeout", NULL};
+
+   if (!PyArg_ParseTupleAndKeywords(args, kwargs, "ii|ii", kwlist, &channel, &edge, &bouncetime, &timeout))
+      return NULL;
+
+   if (get_gpio_number(state, channel, &gpio))
+      return NULL;
+
+   // check channel is setup as an input
+   if (state->gpio_direction[gpio] != INPUT)
+   {
+      PyErr_SetString(PyExc_RuntimeError, "You must setup() the GPIO channel as an input first");
+      return NULL;
+   }
+
+   // is edge a valid value?
+   edge -= PY_EVENT_CONST_OFFSET;
+   if (edge != RISING_EDGE && edge != FALLING_EDGE && edge != BOTH_EDGE)
+   {
+      PyErr_SetString(PyExc_ValueError, "The edge must be set to RISING, FALLING or BOTH");
+      return NULL;
+   }
+
+   if (bouncetime <= 0 && bouncetime != -666)
+   {
+      PyErr_SetString(PyExc_ValueError, "Bouncetime must be greater than 0");
+      return NULL;
+   }
+
+   if (timeout <= 0 && timeout != -1)
+   {
+      PyErr_SetString(PyExc_ValueError, "Timeout must be greater than 0");
+      return NULL;
+   }
+
+   if (check_gpio_priv())
+      return NULL;
+
+   Py_BEGIN_ALLOW_THREADS // disable GIL
+   result = blocking_wait_for_edge(gpio, edge, bouncetime, timeout);
+   Py_END_ALLOW_THREADS   // enable GIL
+
+   if (result == 0) {
+      Py_RETURN_NONE;
+   } else if (result == -1) {
+      PyErr_SetString(PyExc_RuntimeError, "Conflicting edge detection events already exist for this GPIO channel");
+      return NULL;
+   } else if (result == -2) {
+      PyErr_SetString(PyExc_RuntimeError, "Error waiting for edge");
+      return NULL;
+   } else {
+      return Py_BuildValue("i", channel);
+   }
+
+}
+
+// python function prepare_event_detect(channel(s))
+static PyObject *py_prepare_event_detect(PyObject *self, PyObject *args)
+{
+   struct module_state *state = get_module_state(self);
+   PyObject *chanlist;
+   unsigned int gpios[54];
+   int count, result;
+
+   if (!PyArg_ParseTuple(args, "O", &chanlist))
+      return NULL;
+
+   if ((count = parse_gpio_list(state, chanlist, gpios, 54)) < 0)
+      return NULL;
+
+   if (check_gpio_priv())
+      return NULL;
+
+   Py_BEGIN_ALLOW_THREADS // disable GIL
+   result = event_pool_prepare(gpios, count);
+   Py_END_ALLOW_THREADS   // enable GIL
+
+   if (result != 0)
+   {
+      PyErr_SetString(PyExc_RuntimeError, "Failed to prepare edge detection for all channels");
+      return NULL;
+   }
+
+   Py_RETURN_NONE;
+}
+
+// python function fd = event_fd(channel(s))
+static PyObject *py_event_fd(PyObject *self, PyObject *args)
+{
+   struct module_state *state = get_module_state(self);
+   PyObject *chanlist;
+   unsigned int gpios[54];
+   int i, count, fd;
+
+   if (!PyArg_ParseTuple(args, "O", &chanlist))
+      return NULL;
+
+   if ((count = parse_gpio_list(state, chanlist, gpios, 54)) < 0)
+      return NULL;
+
+   for (i=0; i<count; i++)
+   {
+      if (!gpio_event_added(gpios[i]))
+      {
+         PyErr_SetString(PyExc_RuntimeError, "Add edge detection using add_event_detect() first");
+         return NULL;
+      }
+   }
+
+   // a new fd every call, so each caller drains only its own edges
+   if ((fd = event_fd_open()) == -1)
+   {
+      PyErr_SetFromErrno(PyExc_OSError);
+      return NULL;
+   }
+
+   for (i=0; i<count; i++)
+      event_fd_watch(fd, gpios[i], 1);
+
+   return Py_BuildValue("i", fd);
+}
+
+// python function [(channel, level, timestamp), ...] = drain_events(fd, max=4096)
+static PyObject *py_drain_events(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+   struct module_state *state = get_module_state(self);
+   struct edge_record *records;
+   unsigned long dropped;
+   PyObject *list;
+   PyObject *item;
+   int i, fd, count, max = 4096;
+   char message[80];
+   static char *kwlist[] = {"fd", "max", NULL};
+
+   if (!PyArg_ParseTupleAndKeywords(args, kwargs, "i|i", kwlist, &fd, &max))
+      return NULL;
+
+   if (max < 1 || max > EVENT_FD_QUEUE)
+   {
+      PyErr_Format(PyExc_ValueError, "max must be between 1 and %d", EVENT_FD_QUEUE);
+      return NULL;
+   }
+
+   if ((records = malloc(max * sizeof(struct edge_record))) == NULL)
+      return PyErr_NoMemory();
+
+   if ((count = event_fd_drain(fd, records, max, &dropped)) < 0)
+   {
+      free(records);
+      PyErr_SetString(PyExc_ValueError, "Not a file descriptor returned by event_fd()");
+      return NULL;
+   }
+   if (dropped && state->gpio_warnings)
+   {
+      PyOS_snprintf(message, sizeof(message), "%lu edges were dropped because the event fd was not drained", dropped);
+      if (PyErr_WarnEx(PyExc_RuntimeWarning, message, 1) == -1)
+      {
+         free(records);
+         return NULL;
+      }
+   }
+
+   if ((list = PyList_New(count)) != NULL)
+   {
+      for (i=0; i<count; i++)
+      {
+         if ((item = Py_BuildValue("(iiK)", chan_from_gpio(state, records[i].gpio),
+                                   records[i].level, records[i].timestamp)) == NULL)
+         {
+            Py_CLEAR(list);
+            break;
+         }
+         PyList_SET_ITEM(list, i, item);
+      }
+   }
+   free(records);
+   return list;
+}
+
+// python function close_event_fd(fd)
+static PyObject *py_close_event_fd(PyObject *self, PyObject *args)
+{
+   int fd;
+
+   if (!PyArg_ParseTuple(args, "i", &fd))
+      return NULL;
+
+   event_fd_close(fd);
+   Py_RETURN_NONE;
+}
+
+// python function start_trace(filename, channel(s))
+static PyObject *py_start_trace(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+   struct module_state *state = get_module_state(self);
+   char *filename;
+   PyObject *chanlist;
+   unsigned int gpios[54];
+   unsigned long long mask = 0;
+   int i, count, result;
+   static char *kwlist[] = {"filename", "channel", NULL};
+
+   if (!PyArg_ParseTupleAndKeywords(args, kwargs, "sO", kwlist, &filename, &chanlist))
+      return NULL;
+
+   if ((count = parse_gpio_list(state, chanlist, gpios, 54)) < 0)
+      return NULL;
+
+   for (i=0; i<count; i++)
+      mask |= 1ULL << gpios[i];
+
+   if ((result = trace_start(filename, mask)) != 0)
+   {
+      if (result == 1) {
+         PyErr_SetString(PyExc_RuntimeError, "A trace is already being recorded");
+      } else {
+         PyErr_SetFromErrnoWithFilename(PyExc_IOError, filename);
+      }
+      return NULL;
+   }
+
+   Py_RETURN_NONE;
+}
+
+// python function stop_trace()
+static PyObject *py_stop_trace(PyObject *self, PyObject *args)
+{
+   trace_stop();
+   Py_RETURN_NONE;
+}
+
+// python function (events, seconds) = replay_trace(filename, realtime=True)
+static PyObject *py_replay_trace(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+   char *filename;
+   int realtime = 1;
+   long events;
+   unsigned long long elapsed = 0;
+   static char *kwlist[] = {"filename", "realtime", NULL};
+
+   if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|i", kwlist, &filename, &realtime))
+      return NULL;
+
+   Py_BEGIN_ALLOW_THREADS // disable GIL
+   events = trace_replay(filename, realtime, &elapsed);
+   Py_END_ALLOW_THREADS   // enable GIL
+
+   if (events == -1) {
+      PyErr_SetFromErrnoWithFilename(PyExc_IOError, filename);
+      return NULL;
+   } else if (events == -2) {
+      PyErr_SetString(PyExc_ValueError, "Not a valid trace file");
+      return NULL;
+   }
+
+   return Py_BuildValue("(ld)", events, elapsed / 1e9);
+}
+
+// python function stats = event_load(channel(s), rate, duration=1.0)
+static PyObject *py_event_load(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+   struct module_state *state = get_module_state(self);
+   PyObject *chanlist;
+   unsigned int gpios[54];
+   int count, result;
+   double rate;
+   double duration = 1.0;
+   struct loadgen_stats stats;
+   static char *kwlist[] = {"channel", "rate", "duration", NULL};
+
+   if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Od|d", kwlist, &chanlist, &rate, &duration))
+      return NULL;
+
+   if ((count = parse_gpio_list(state, chanlist, gpios, 54)) < 0)
+      return NULL;
+
+   if (rate <= 0.0 || duration <= 0.0)
+   {
+      PyErr_SetString(PyExc_ValueError, "rate and duration must be greater than 0");
+      return NULL;
+   }
+
+   Py_BEGIN_ALLOW_THREADS // disable GIL
+   result = loadgen_run(gpios, count, rate, duration, &stats);
+   Py_END_ALLOW_THREADS   // enable GIL
+
+   if (result == 1) {
+      PyErr_SetString(PyExc_RuntimeError, "Add a callback to every channel using add_event_callback() first");
+      return NULL;
+   } else if (result == 2) {
+      PyErr_SetString(PyExc_ValueError, "Invalid load parameters");
+      return NULL;
+   } else if (result == 3) {
+      PyErr_NoMemory();
+      return NULL;
+   } else if (result == 5) {
+      PyErr_SetString(PyExc_RuntimeError, "Another event_load() is already running");
+      return NULL;
+   } else if (result != 0) {
+      PyErr_SetString(PyExc_RuntimeError, "Failed to start the load generator");
+      return NULL;
+   }
+
+   return Py_BuildValue("{sksksksdsdsdsdsdsd}",
+                        "injected", stats.injected,
+                        "delivered", stats.delivered,
+                        "dropped", stats.dropped,
+                        "seconds", stats.elapsed / 1e9,
+                        "rate", stats.elapsed ? stats.delivered * 1e9 / stats.elapsed : 0.0,
+                        "latency_p50", stats.latency_p50 / 1e9,
+                        "latency_p90", stats.latency_p90 / 1e9,
+                        "latency_p99", stats.latency_p99 / 1e9,
+                        "latency_max", stats.latency_max / 1e9);
+}
+
+static PyObject *sched_status_value(int applied)
+{
+   if (applied == THREAD_NOT_APPLIED)
+      Py_RETURN_NONE;
+   else if (applied)
+      Py_RETURN_TRUE;
+   else
+      Py_RETURN_FALSE;
+}
+
+static PyObject *build_sched_status(int thread_class)
+{
+   struct thread_sched sched;
+   struct thread_sched_status status;
+   PyObject *cpus, *cpu;
+   int i;
+
+   thread_sched_get(thread_class, &sched, &status);
+
+   if ((cpus = PyList_New(0)) == NULL)
+      return NULL;
+   for (i=0; i<64; i++) {
+      if (sched.cpus & (1ULL << i)) {
+         if ((cpu = Py_BuildValue("i", i)) == NULL || PyList_Append(cpus, cpu) != 0) {
+            Py_XDECREF(cpu);
+            Py_DECREF(cpus);
+            return NULL;
+         }
+         Py_DECREF(cpu);
+      }
+   }
+
+   return Py_BuildValue("{sisisNsOsNsNsNsi}",
+                        "policy", sched.policy,
+                        "priority", sched.priority,
+                        "cpus", cpus,
+                        "lock_memory", sched.lock_memory ? Py_True : Py_False,
+                        "policy_applied", sched_status_value(status.policy),
+                        "affinity_applied", sched_status_value(status.affinity),
+                        "lock_memory_applied", sched_status_value(status.lock_memory),
+                        "error", status.error);
+}
+
+// python function status = set_thread_scheduling(thread, policy=SCHED_OTHER, priority=0, cpus=None, lock_memory=False)
+static PyObject *py_set_thread_scheduling(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+   int thread_class, i, cpu;
+   struct thread_sched sched;
+   PyObject *cpulist = NULL;
+   PyObject *tempobj;
+   static char *kwlist[] = {"thread", "policy", "priority", "cpus", "lock_memory", NULL};
+
+   memset(&sched, 0, sizeof(sched));
+   sched.policy = SCHED_OTHER;
+
+   if (!PyArg_ParseTupleAndKeywords(args, kwargs, "i|iiOi", kwlist, &thread_class, &sched.policy, &sched.priority, &cpulist, &sched.lock_memory))
+      return NULL;
+
+   if (thread_class < 0 || thread_class >= THREAD_CLASSES)
+   {
+      PyErr_SetString(PyExc_ValueError, "thread must be EVENT_THREAD, PWM_THREAD or WAVE_THREAD");
+      return NULL;
+   }
+
+   if (cpulist != NULL && cpulist != Py_None)
+   {
+      if (!PyList_Check(cpulist) && !PyTuple_Check(cpulist))
+      {
+         PyErr_SetString(PyExc_ValueError, "cpus must be a list/tuple of integers");
+         return NULL;
+      }
+      for (i=0; i<PySequence_Fast_GET_SIZE(cpulist); i++) {
+         tempobj = PySequence_Fast_GET_ITEM(cpulist, i);
+         cpu = (int)PyLong_AsLong(tempobj);
+         if (PyErr_Occurred())
+            return NULL;
+         if (cpu < 0 || cpu > 63)
+         {
+            PyErr_SetString(PyExc_ValueError, "Invalid cpu number");
+            return NULL;
+         }
+         sched.cpus |= 1ULL << cpu;
+      }
+   }
+
+   if (thread_sched_set(thread_class, &sched) == 2)
+   {
+      PyErr_SetString(PyExc_ValueError, "policy must be SCHED_OTHER, SCHED_FIFO or SCHED_RR");
+      return NULL;
+   }
+
+   return build_sched_status(thread_class);
+}
+
+// python function status = get_thread_scheduling(thread)
+static PyObject *py_get_thread_scheduling(PyObject *self, PyObject *args)
+{
+   int thread_class;
+
+   if (!PyArg_ParseTuple(args, "i", &thread_class))
+      return NULL;
+
+   if (thread_class < 0 || thread_class >= THREAD_CLASSES)
+   {
+      PyErr_SetString(PyExc_ValueError, "thread must be EVENT_THREAD, PWM_THREAD or WAVE_THREAD");
+      return NULL;
+   }
+
+   return build_sched_status(thread_class);
+}
+
+// python function data = snapshot()
+static PyObject *py_snapshot(PyObject *self, PyObject *args)
+{
+   struct gpio_snapshot snap;
+
+   if (mmap_gpio_mem())
+      return NULL;
+
+   snapshot_take(&snap);
+#if PY_MAJOR_VERSION > 2
+   return PyBytes_FromStringAndSize((char *)&snap, sizeof(snap));
+#else
+   return PyString_FromStringAndSize((char *)&snap, sizeof(snap));
+#endif
+}
+
+// python function restore(data, channel=None)
+static PyObject *py_restore(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+   struct module_state *state = get_module_state(self);
+   struct gpio_snapshot snap;
+   Py_buffer data;
+   PyObject *chanlist = NULL;
+   unsigned int gpios[54];
+   uint32_t mask[2] = {0, 0};
+   int i, count, f, valid;
+   static char *kwlist[] = {"data", "channel", NULL};
+
+   if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s*|O", kwlist, &data, &chanlist))
+      return NULL;
+
+   valid = data.len == sizeof(snap);
+   if (valid)
+      memcpy(&snap, data.buf, sizeof(snap));
+   PyBuffer_Release(&data);
+   if (!valid || snap.magic != SNAPSHOT_MAGIC) {
+      PyErr_SetString(PyExc_ValueError, "Not a GPIO snapshot");
+      return NULL;
+   }
+
+   if (chanlist == NULL || chanlist == Py_None) {   // every channel set up
+      for (i=0; i<54; i++)
+         if (state->gpio_direction[i] != -1)
+            mask[i/32] |= 1 << (i%32);
+   } else {
+      if ((count = parse_gpio_list(state, chanlist, gpios, 54)) < 0)
+         return NULL;
+      for (i=0; i<count; i++)
+         mask[gpios[i]/32] |= 1 << (gpios[i]%32);
+   }
+
+   if (mmap_gpio_mem())
+      return NULL;
+
+   state_lock();
+   // channels set up by other interpreters are left alone
+   for (i=0; i<54; i++)
+      if (gpio_in_use(state, i))
+         mask[i/32] &= ~(1 << (i%32));
+
+   snapshot_restore(&snap, mask[0], mask[1]);
+
+   // keep the direction of channels this program has set up in step
+   for (i=0; i<54; i++) {
+      if (state->gpio_direction[i] != -1 && (mask[i/32] & (1 << (i%32)))) {
+         f = (snap.fsel[i/10] >> ((i%10)*3)) & 7;
+         state->gpio_direction[i] = f == 1 ? OUTPUT : f == 0 ? INPUT : -1;
+         if (state->gpio_direction[i] == -1)
+            release_gpio(state, i);
+      }
+   }
+   state_unlock();
+
+   Py_RETURN_NONE;
+}
+
+// python function value = gpio_function(channel)
+static PyObject *py_gpio_function(PyObject *self, PyObject *args)
+{
+   struct module_state *state = get_module_state(self);
+   unsigned int gpio;
+   int channel;
+   int f;
+   PyObject *func;
+
    if (!PyArg_ParseTuple(args, "i", &channel))
       return NULL;
 
-   if (get_gpio_number(channel, &gpio))
+   if (get_gpio_number(state, channel, &gpio))
        return NULL;
 
    if (mmap_gpio_mem())
@@ -939,7 +2113,8 @@ static PyObject *py_gpio_function(PyObject *self, PyObject *args)
 // python function setwarnings(state)
 static PyObject *py_setwarnings(PyObject *self, PyObject *args)
 {
-   if (!PyArg_ParseTuple(args, "i", &gpio_warnings))
+   struct module_state *state = get_module_state(self);
+   if (!PyArg_ParseTuple(args, "i", &state->gpio_warnings))
       return NULL;
 
    if (setup_error)
@@ -958,61 +2133,114 @@ PyMethodDef rpi_gpio_methods[] = {
    {"cleanup", (PyCFunction)py_cleanup, METH_VARARGS | METH_KEYWORDS, "Clean up by resetting all GPIO channels that have been used by this program to INPUT with no pullup/pulldown and no event detection\n[channel] - individual channel or list/tuple of channels to clean up.  Default - clean every channel that has been used."},
    {"output", py_output_gpio, METH_VARARGS, "Output to a GPIO channel or list of channels\nchannel - either board pin number or BCM number depending on which mode is set.\nvalue   - 0/1 or False/True or LOW/HIGH"},
    {"input", py_input_gpio, METH_VARARGS, "Input from a GPIO channel.  Returns HIGH=1=True or LOW=0=False\nchannel - either board pin number or BCM number depending on which mode is set."},
+   {"toggle", py_toggle, METH_VARARGS, "Invert the level of an output channel or list of channels, from the levels last written rather than a read of the pins\nchannel - either board pin number or BCM number depending on which mode is set."},
+   {"toggle_mask", (PyCFunction)py_toggle_mask, METH_VARARGS | METH_KEYWORDS, "Invert the level of many outputs at once\nmask   - bit n is BCM GPIO n, or GPIO n+32 for bank 1\n[bank] - 0 (default) or 1"},
+   {"output_state", py_output_state, METH_VARARGS, "Return the level last written to an output channel, or a list of levels for a list of channels, without reading the pins\nchannel - either board pin number or BCM number depending on which mode is set."},
+   {"verify_outputs", (PyCFunction)py_verify_outputs, METH_VARARGS | METH_KEYWORDS, "Compare the levels last written with the pins of every output channel.  Returns a list of the channels that differ, for example because another program changed them\n[resync] - take the levels of the channels that differ from the pins (default False)"},
+   {"play_waveform", (PyCFunction)py_play_waveform, METH_VARARGS | METH_KEYWORDS, "Play timed writes to the output channels from a real time thread (see WAVE_THREAD), busy waiting for each step.  Returns how late each step was written in ns, the worst over the repeats\nsteps    - list/tuple of (delta_ns, set_mask, clear_mask[, bank]) tuples.  delta_ns is the time after the previous step, up to 1e9, mask bit n is BCM GPIO n, or GPIO n+32 for bank 1\n[repeat] - times to play the steps back to back (default 1)"},
+   {"pulse", (PyCFunction)py_pulse, METH_VARARGS | METH_KEYWORDS, "Drive an output channel to level for width_us, then back, timed like play_waveform().  Returns the achieved width less width_us in ns\nchannel  - either board pin number or BCM number depending on which mode is set.\nwidth_us - pulse width in microseconds, up to 1000000\n[level]  - HIGH (default) or LOW"},
    {"setmode", py_setmode, METH_VARARGS, "Set up numbering mode to use for channels.\nBOARD - Use Raspberry Pi board numbers\nBCM   - Use Broadcom GPIO 00..nn numbers"},
    {"getmode", py_getmode, METH_VARARGS, "Get numbering mode used for channel numbers.\nReturns BOARD, BCM or None"},
-   {"add_event_detect", (PyCFunction)py_add_event_detect, METH_VARARGS | METH_KEYWORDS, "Enable edge detection events for a particular GPIO channel.\nchannel      - either board pin number or BCM number depending on which mode is set.\nedge         - RISING, FALLING or BOTH\n[callback]   - A callback function for the event (optional)\n[bouncetime] - Switch bounce timeout in ms for callback"},
+   {"add_event_detect", (PyCFunction)py_add_event_detect, METH_VARARGS | METH_KEYWORDS, "Enable edge detection events for a particular GPIO channel.\nchannel      - either board pin number or BCM number depending on which mode is set.\nedge         - RISING, FALLING or BOTH\n[callback]   - A callback function for the event (optional)\n[bouncetime] - Switch bounce timeout in ms for callback\n[details]    - call the callback with (channel, level, timestamp), the level and monotonic ns timestamp sampled when the edge was detected"},
    {"remove_event_detect", py_remove_event_detect, METH_VARARGS, "Remove edge detection for a particular GPIO channel\nchannel - either board pin number or BCM number depending on which mode is set."},
    {"event_detected", py_event_detected, METH_VARARGS, "Returns True if an edge has occured on a given GPIO.  You need to enable edge detection using add_event_detect() first.\nchannel - either board pin number or BCM number depending on which mode is set."},
-   {"add_event_callback", (PyCFunction)py_add_event_callback, METH_VARARGS | METH_KEYWORDS, "Add a callback for an event already defined using add_event_detect()\nchannel      - either board pin number or BCM number depending on which mode is set.\ncallback     - a callback function"},
+   {"add_event_callback", (PyCFunction)py_add_event_callback, METH_VARARGS | METH_KEYWORDS, "Add a callback for an event already defined using add_event_detect()\nchannel      - either board pin number or BCM number depending on which mode is set.\ncallback     - a callback function\n[details]    - call the callback with (channel, level, timestamp), the level and monotonic ns timestamp sampled when the edge was detected"},
+   {"set_callback_batching", (PyCFunction)py_set_callback_batching, METH_VARARGS | METH_KEYWORDS, "Queue edges and run the callbacks for everything queued under one GIL acquisition on a delivery thread, instead of taking the GIL for every edge on the edge detection thread\nenabled    - True or False\n[callback] - called once per batch with a list of (channel, level, timestamp) tuples, timestamp in ns on the time.monotonic() clock"},
    {"wait_for_edge", (PyCFunction)py_wait_for_edge, METH_VARARGS | METH_KEYWORDS, "Wait for an edge.  Returns the channel number or None on timeout.\nchannel      - either board pin number or BCM number depending on which mode is set.\nedge         - RISING, FALLING or BOTH\n[bouncetime] - time allowed between calls to allow for switchbounce\n[timeout]    - timeout in ms"},
+   {"prepare_event_detect", py_prepare_event_detect, METH_VARARGS, "Export and open channels for edge detection ahead of time, so add_event_detect() and remove_event_detect() only change the edge setting\nchannel - either board pin number or BCM number, or a list/tuple of them"},
+   {"event_fd", py_event_fd, METH_VARARGS, "Queue the edges of a channel or list of channels and return a new file descriptor that is readable while edges are queued to it, for use with select(), poll() or an asyncio loop.  Each file descriptor has its own queue.  Edge detection must already be added\nchannel - either board pin number or BCM number depending on which mode is set."},
+   {"drain_events", (PyCFunction)py_drain_events, METH_VARARGS | METH_KEYWORDS, "Return the edges queued to a file descriptor from event_fd() as a list of (channel, level, timestamp) tuples without blocking, timestamp in ns on the time.monotonic() clock\nfd - file descriptor returned by event_fd()\n[max] - most edges to return (default 4096)"},
+   {"close_event_fd", py_close_event_fd, METH_VARARGS, "Close a file descriptor returned by event_fd() and stop queueing edges to it\nfd - file descriptor returned by event_fd()"},
+   {"start_trace", (PyCFunction)py_start_trace, METH_VARARGS | METH_KEYWORDS, "Record the edges detected on a channel or list of channels to a trace file\nfilename - trace file to create\nchannel  - either board pin number or BCM number depending on which mode is set."},
+   {"stop_trace", py_stop_trace, METH_VARARGS, "Stop recording edges and close the trace file"},
+   {"replay_trace", (PyCFunction)py_replay_trace, METH_VARARGS | METH_KEYWORDS, "Inject the edges from a trace file into event detection and callbacks.  Returns (events, seconds)\nfilename   - trace file to replay\n[realtime] - replay with the recorded timing (default) or as fast as possible"},
+   {"event_load", (PyCFunction)py_event_load, METH_VARARGS | METH_KEYWORDS, "Inject synthetic edges into event callbacks and measure delivery.  Returns a dict of counts, delivered rate and latencies in seconds\nchannel    - channel or list of channels with callbacks, events are spread evenly over them\nrate       - edges per second\n[duration] - seconds to run for (default 1.0)"},
+   {"set_thread_scheduling", (PyCFunction)py_set_thread_scheduling, METH_VARARGS | METH_KEYWORDS, "Set the scheduling of a class of library thread.  Returns a dict showing which settings took effect (None until a thread of the class has run)\nthread        - EVENT_THREAD, PWM_THREAD or WAVE_THREAD\n[policy]      - SCHED_OTHER (default), SCHED_FIFO or SCHED_RR\n[priority]    - scheduling priority for SCHED_FIFO or SCHED_RR\n[cpus]        - list of cpus the threads may run on (default any)\n[lock_memory] - lock the process memory to avoid page faults"},
+   {"get_thread_scheduling", py_get_thread_scheduling, METH_VARARGS, "Return the scheduling settings of a class of library thread and whether they took effect\nthread - EVENT_THREAD, PWM_THREAD or WAVE_THREAD"},
+   {"snapshot", py_snapshot, METH_NOARGS, "Return the function, level, event detect and pull up/down state of every GPIO as bytes.  Pull up/down cannot be read back, so only pulls set by this program are recorded"},
+   {"restore", (PyCFunction)py_restore, METH_VARARGS | METH_KEYWORDS, "Restore GPIO state saved by snapshot()\ndata - bytes returned by snapshot()\n[channel] - individual channel or list/tuple of channels to restore.  Default - every channel this program has set up.  Pulls that were not recorded are left as they are"},
    {"gpio_function", py_gpio_function, METH_VARARGS, "Return the current GPIO function (IN, OUT, PWM, SERIAL, I2C, SPI)\nchannel - either board pin number or BCM number depending on which mode is set."},
    {"setwarnings", py_setwarnings, METH_VARARGS, "Enable or disable warning messages"},
    {NULL, NULL, 0, NULL}
 };
 
-#if PY_MAJOR_VERSION > 2
-static struct PyModuleDef rpigpiomodule = {
-   PyModuleDef_HEAD_INIT,
-   "RPi._GPIO",      // name of module
-   moduledocstring,  // module documentation, may be NULL
-   -1,               // size of per-interpreter state of the module, or -1 if the module keeps state in global variables.
-   rpi_gpio_methods
-};
-#endif
+// board detection and the exit handlers are done once per process, however
+// many interpreters import the module
+static int init_process(void)
+// return values:
+// 0 - Success
+// 1 - Not a Raspberry Pi
+// 2 - Unable to register the exit handlers
+{
+   static int result = -1;
 
-#if PY_MAJOR_VERSION > 2
-PyMODINIT_FUNC PyInit__GPIO(void)
-#else
-PyMODINIT_FUNC init_GPIO(void)
-#endif
+   if (result != -1)
+      return result;
+
+   // detect board revision and set up accordingly
+   if (get_rpi_info(&rpiinfo))
+   {
+      setup_error = 1;
+      return result = 1;
+   }
+
+   if (rpiinfo.p1_revision == 1) {
+      pin_to_gpio = &pin_to_gpio_rev1;
+   } else if (rpiinfo.p1_revision == 2) {
+      pin_to_gpio = &pin_to_gpio_rev2;
+   } else { // assume model B+ or A+ or 2B
+      pin_to_gpio = &pin_to_gpio_rev3;
+   }
+
+   if (!PyEval_ThreadsInitialized())
+      PyEval_InitThreads();
+
+   // register exit functions - last declared is called first
+   if (Py_AtExit(cleanup) != 0 || Py_AtExit(event_cleanup_all) != 0 ||
+       Py_AtExit(pwm_stop_all) != 0)
+   {
+      setup_error = 1;
+      cleanup();
+      return result = 2;
+   }
+
+   return result = 0;
+}
+
+// fill in a new module object, once per interpreter
+// returns 0, or -1 with an exception set
+static int exec_module(PyObject *module)
 {
-   int i;
-   PyObject *module = NULL;
+   struct module_state *state = get_module_state(module);
+   PyObject *board_info;
+   PyObject *rpi_revision;
+   int main_interp = 1;
+   int result;
 
-#if PY_MAJOR_VERSION > 2
-   if ((module = PyModule_Create(&rpigpiomodule)) == NULL)
-      return NULL;
-#else
-   if ((module = Py_InitModule3("RPi._GPIO", rpi_gpio_methods, moduledocstring)) == NULL)
-      return;
+#if PY_VERSION_HEX >= 0x03090000
+   main_interp = PyInterpreterState_Get() == PyInterpreterState_Main();
 #endif
+   state_lock();
+   init_module_state(state, main_interp);
+   if (main_interp)
+      main_state = state;
+   module_states++;
+   state_unlock();
 
    define_constants(module);
 
-   for (i=0; i<54; i++)
-      gpio_direction[i] = -1;
-
-   // detect board revision and set up accordingly
-   if (get_rpi_info(&rpiinfo))
+   state_lock();
+   result = init_process();
+   state_unlock();
+   if (result == 1)
    {
       PyErr_SetString(PyExc_RuntimeError, "This module can only be run on a Raspberry Pi!");
-      setup_error = 1;
-#if PY_MAJOR_VERSION > 2
-      return NULL;
-#else
-      return;
-#endif
+      return -1;
+   } else if (result == 2) {
+      PyErr_SetString(PyExc_RuntimeError, "Unable to register the exit functions");
+      return -1;
    }
+
    board_info = Py_BuildValue("{sissssssssss}",
                               "P1_REVISION",rpiinfo.p1_revision,
                               "REVISION",&rpiinfo.revision,
@@ -1020,58 +2248,109 @@ PyMODINIT_FUNC init_GPIO(void)
                               "MANUFACTURER",rpiinfo.manufacturer,
                               "PROCESSOR",rpiinfo.processor,
                               "RAM",rpiinfo.ram);
-   PyModule_AddObject(module, "RPI_INFO", board_info); 
-
-   if (rpiinfo.p1_revision == 1) {
-      pin_to_gpio = &pin_to_gpio_rev1;
-   } else if (rpiinfo.p1_revision == 2) {
-      pin_to_gpio = &pin_to_gpio_rev2;
-   } else { // assume model B+ or A+ or 2B
-      pin_to_gpio = &pin_to_gpio_rev3;
-   }
+   PyModule_AddObject(module, "RPI_INFO", board_info);
 
    rpi_revision = Py_BuildValue("i", rpiinfo.p1_revision);     // deprecated
    PyModule_AddObject(module, "RPI_REVISION", rpi_revision);   // deprecated
 
    // Add PWM class
    if (PWM_init_PWMType() == NULL)
-#if PY_MAJOR_VERSION > 2
-      return NULL;
-#else
-      return;
-#endif
+      return -1;
    Py_INCREF(&PWMType);
    PyModule_AddObject(module, "PWM", (PyObject*)&PWMType);
 
-   if (!PyEval_ThreadsInitialized())
-      PyEval_InitThreads();
+   // Add Pin and PinGroup classes
+   if (Pin_init_PinType() == NULL || Pin_init_PinGroupType() == NULL)
+      return -1;
+   Py_INCREF(&PinType);
+   PyModule_AddObject(module, "Pin", (PyObject*)&PinType);
+   Py_INCREF(&PinGroupType);
+   PyModule_AddObject(module, "PinGroup", (PyObject*)&PinGroupType);
 
-   // register exit functions - last declared is called first
-   if (Py_AtExit(cleanup) != 0)
-   {
-      setup_error = 1;
-      cleanup();
-#if PY_MAJOR_VERSION > 2
-      return NULL;
-#else
+   return 0;
+}
+
+#if PY_VERSION_HEX >= 0x03050000
+// an interpreter is done with the module, so its channels are free for the
+// others to set up.  They are left as they are, like at exit without
+// cleanup().
+static void free_module(void *module)
+{
+   struct module_state *state = PyModule_GetState(module);
+   int i;
+
+   if (state == NULL)
       return;
+
+   state_lock();
+   for (i=0; i<54; i++)
+      release_gpio(state, i);
+   if (main_state == state)
+      main_state = NULL;
+   module_states--;
+   state_unlock();
+}
+#endif
+
+#if PY_VERSION_HEX >= 0x03050000
+// the channel ownership is shared and locked, so the module may be imported
+// by several interpreters and run without the GIL.  The types are static, so
+// the interpreters have to share one GIL.
+static PyModuleDef_Slot rpigpio_slots[] = {
+   {Py_mod_exec, (void *)exec_module},
+#ifdef Py_mod_multiple_interpreters
+   {Py_mod_multiple_interpreters, Py_MOD_MULTIPLE_INTERPRETERS_SUPPORTED},
+#endif
+#ifdef Py_mod_gil
+   {Py_mod_gil, Py_MOD_GIL_NOT_USED},
+#endif
+   {0, NULL}
+};
 #endif
-   }
 
-   if (Py_AtExit(event_cleanup_all) != 0)
-   {
-      setup_error = 1;
-      cleanup();
 #if PY_MAJOR_VERSION > 2
-      return NULL;
+static struct PyModuleDef rpigpiomodule = {
+   PyModuleDef_HEAD_INIT,
+   "RPi._GPIO",      // name of module
+   moduledocstring,  // module documentation, may be NULL
+#if PY_VERSION_HEX >= 0x03050000
+   sizeof(struct module_state),   // size of per-interpreter state of the module
+   rpi_gpio_methods,
+   rpigpio_slots,
+   NULL,             // m_traverse, the state holds no objects
+   NULL,             // m_clear
+   free_module
 #else
-      return;
+   -1,               // size of per-interpreter state of the module, or -1 if the module keeps state in global variables.
+   rpi_gpio_methods
+#endif
+};
 #endif
-   }
 
 #if PY_MAJOR_VERSION > 2
+PyMODINIT_FUNC PyInit__GPIO(void)
+#else
+PyMODINIT_FUNC init_GPIO(void)
+#endif
+{
+#if PY_VERSION_HEX >= 0x03050000
+   return PyModuleDef_Init(&rpigpiomodule);
+#elif PY_MAJOR_VERSION > 2
+   PyObject *module;
+
+   if ((module = PyModule_Create(&rpigpiomodule)) == NULL)
+      return NULL;
+   if (exec_module(module) != 0)
+   {
+      Py_DECREF(module);
+      return NULL;
+   }
    return module;
 #else
-   return;
+   PyObject *module;
+
+   if ((module = Py_InitModule3("RPi._GPIO", rpi_gpio_methods, moduledocstring)) == NULL)
+      return;
+   exec_module(module);
 #endif
 }
@@ -0,0 +1,464 @@
+/*
+Based on RPi.GPIO by Ben Croston
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "Python.h"
+#include "py_pin.h"
+#include "common.h"
+#include "c_gpio.h"
+#include "sequence.h"
+
+/* Pin and PinGroup check their channels once when created and keep the bank
+   and bit masks, so each call is a direction check and one register access.
+   The methods take their arguments as a C array through METH_FASTCALL; on
+   Pythons without it the same functions sit behind a METH_VARARGS shim. */
+
+#if PY_VERSION_HEX >= 0x03070000
+#define FASTCALL_METHOD(name, func, doc) { name, (PyCFunction)(void(*)(void))func, METH_FASTCALL, doc }
+#define FASTCALL_SHIM(func, type)
+#else
+#define FASTCALL_METHOD(name, func, doc) { name, (PyCFunction)func##_varargs, METH_VARARGS, doc }
+#define FASTCALL_SHIM(func, type) \
+static PyObject *func##_varargs(type *self, PyObject *args) \
+{ \
+   return func(self, &PyTuple_GET_ITEM(args, 0), PyTuple_GET_SIZE(args)); \
+}
+#endif
+
+#if PY_MAJOR_VERSION > 2
+#define level_object(level) PyLong_FromLong(level)
+#else
+#define level_object(level) PyInt_FromLong(level)
+#endif
+
+// the start of PinObject and PinGroupObject, the module keeps the state of
+// the interpreter that created the object alive
+typedef struct
+{
+    PyObject_HEAD
+    PyObject *module;
+    struct module_state *state;
+} BoundObject;
+
+typedef struct
+{
+    PyObject_HEAD
+    PyObject *module;
+    struct module_state *state;
+    unsigned int gpio;
+    int bank;
+    uint32_t mask;
+} PinObject;
+
+typedef struct
+{
+    PyObject_HEAD
+    PyObject *module;
+    struct module_state *state;
+    int count;
+    unsigned int gpios[32];
+    struct bank_map map[2];     // one per bank, mask is 0 if no pin is in it
+} PinGroupObject;
+
+static int check_nargs(const char *name, Py_ssize_t nargs, Py_ssize_t expected)
+{
+    if (nargs == expected)
+        return 1;
+    PyErr_Format(PyExc_TypeError, "%s() takes exactly %d argument%s (%d given)",
+                 name, (int)expected, expected == 1 ? "" : "s", (int)nargs);
+    return 0;
+}
+
+// new objects use the mode and channels of the interpreter creating them
+// for their whole life
+static PyObject *Bound_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    BoundObject *self;
+
+    if ((self = (BoundObject *)PyType_GenericNew(type, args, kwds)) == NULL)
+        return NULL;
+    if ((self->module = current_module()) == NULL) {
+        Py_DECREF(self);
+        return NULL;
+    }
+    self->state = get_module_state(self->module);
+    return (PyObject *)self;
+}
+
+// python method Pin.__init__(self, channel)
+static int Pin_init(PinObject *self, PyObject *args, PyObject *kwds)
+{
+    int channel;
+
+    if (!PyArg_ParseTuple(args, "i", &channel))
+        return -1;
+
+    if (get_gpio_number(self->state, channel, &(self->gpio)))
+        return -1;
+
+    if (self->state->gpio_direction[self->gpio] != INPUT && self->state->gpio_direction[self->gpio] != OUTPUT)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "You must setup() the GPIO channel first");
+        return -1;
+    }
+
+    if (check_gpio_priv())
+        return -1;
+
+    self->bank = self->gpio / 32;
+    self->mask = 1 << (self->gpio % 32);
+    return 0;
+}
+
+static void Bound_dealloc(BoundObject *self)
+{
+    Py_XDECREF(self->module);
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+// python method Pin.write(self, value)
+static PyObject *Pin_write(PinObject *self, PyObject *const *args, Py_ssize_t nargs)
+{
+    int level;
+
+    if (!check_nargs("write", nargs, 1))
+        return NULL;
+    if ((level = PyObject_IsTrue(args[0])) < 0)
+        return NULL;
+
+    if (self->state->gpio_direction[self->gpio] != OUTPUT)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "The GPIO channel has not been set up as an OUTPUT");
+        return NULL;
+    }
+
+    if (level)
+        output_gpio_bank(self->bank, self->mask, 0);
+    else
+        output_gpio_bank(self->bank, 0, self->mask);
+    Py_RETURN_NONE;
+}
+FASTCALL_SHIM(Pin_write, PinObject)
+
+// python method value = Pin.read(self)
+static PyObject *Pin_read(PinObject *self, PyObject *const *args, Py_ssize_t nargs)
+{
+    if (!check_nargs("read", nargs, 0))
+        return NULL;
+
+    if (self->state->gpio_direction[self->gpio] == -1)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "You must setup() the GPIO channel first");
+        return NULL;
+    }
+
+    return level_object((input_gpio_bank(self->bank) & self->mask) != 0);
+}
+FASTCALL_SHIM(Pin_read, PinObject)
+
+// python method Pin.toggle(self)
+static PyObject *Pin_toggle(PinObject *self, PyObject *const *args, Py_ssize_t nargs)
+{
+    if (!check_nargs("toggle", nargs, 0))
+        return NULL;
+
+    if (self->state->gpio_direction[self->gpio] != OUTPUT)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "The GPIO channel has not been set up as an OUTPUT");
+        return NULL;
+    }
+
+    toggle_gpio_bank(self->bank, self->mask);
+    Py_RETURN_NONE;
+}
+FASTCALL_SHIM(Pin_toggle, PinObject)
+
+// python method PinGroup.__init__(self, channels)
+static int PinGroup_init(PinGroupObject *self, PyObject *args, PyObject *kwds)
+{
+    PyObject *chanlist;
+    int i;
+
+    if (!PyArg_ParseTuple(args, "O", &chanlist))
+        return -1;
+
+    if (!PyList_Check(chanlist) && !PyTuple_Check(chanlist))
+    {
+        PyErr_SetString(PyExc_ValueError, "Channels must be a list/tuple of integers");
+        return -1;
+    }
+
+    if ((self->count = parse_gpio_list(self->state, chanlist, self->gpios, 32)) < 0)
+        return -1;
+    if (self->count == 0)
+    {
+        PyErr_SetString(PyExc_ValueError, "PinGroup needs at least one channel");
+        return -1;
+    }
+
+    for (i=0; i<self->count; i++) {
+        if (self->state->gpio_direction[self->gpios[i]] != INPUT && self->state->gpio_direction[self->gpios[i]] != OUTPUT)
+        {
+            PyErr_SetString(PyExc_RuntimeError, "You must setup() every GPIO channel first");
+            return -1;
+        }
+    }
+
+    if (check_gpio_priv())
+        return -1;
+
+    bank_map_init_bank(&self->map[0], self->gpios, self->count, 0);
+    bank_map_init_bank(&self->map[1], self->gpios, self->count, 1);
+    return 0;
+}
+
+static int check_group_outputs(PinGroupObject *self)
+{
+    int i;
+
+    for (i=0; i<self->count; i++) {
+        if (self->state->gpio_direction[self->gpios[i]] != OUTPUT)
+        {
+            PyErr_SetString(PyExc_RuntimeError, "Every GPIO channel must be set up as an OUTPUT");
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// one SET and one CLR write for each bank the group uses
+static void write_group(PinGroupObject *self, uint32_t value)
+{
+    if (self->map[0].mask)
+        bank_map_write(&self->map[0], value);
+    if (self->map[1].mask)
+        bank_map_write(&self->map[1], value);
+}
+
+static uint32_t read_group(PinGroupObject *self)
+{
+    uint32_t value = 0;
+
+    if (self->map[0].mask)
+        value |= bank_map_read(&self->map[0]);
+    if (self->map[1].mask)
+        value |= bank_map_read(&self->map[1]);
+    return value;
+}
+
+// python method PinGroup.write(self, value(s))
+// a list/tuple holds one level per channel, a single level drives them all
+static PyObject *PinGroup_write(PinGroupObject *self, PyObject *const *args, Py_ssize_t nargs)
+{
+    uint32_t value = 0;
+    int i, level;
+
+    if (!check_nargs("write", nargs, 1))
+        return NULL;
+
+    if (PyList_Check(args[0]) || PyTuple_Check(args[0])) {
+        if (PySequence_Fast_GET_SIZE(args[0]) != self->count)
+        {
+            PyErr_SetString(PyExc_RuntimeError, "Number of channels != number of values");
+            return NULL;
+        }
+        for (i=0; i<self->count; i++) {
+            if ((level = PyObject_IsTrue(PySequence_Fast_GET_ITEM(args[0], i))) < 0)
+                return NULL;
+            if (level)
+                value |= 1 << i;
+        }
+    } else {
+        if ((level = PyObject_IsTrue(args[0])) < 0)
+            return NULL;
+        if (level)
+            value = 0xffffffff;
+    }
+
+    if (!check_group_outputs(self))
+        return NULL;
+    write_group(self, value);
+    Py_RETURN_NONE;
+}
+FASTCALL_SHIM(PinGroup_write, PinGroupObject)
+
+// python method PinGroup.write_int(self, value), bit n drives the nth channel
+static PyObject *PinGroup_write_int(PinGroupObject *self, PyObject *const *args, Py_ssize_t nargs)
+{
+    unsigned long value;
+
+    if (!check_nargs("write_int", nargs, 1))
+        return NULL;
+
+    value = PyLong_AsUnsignedLongMask(args[0]);
+    if (PyErr_Occurred())
+        return NULL;
+
+    if (!check_group_outputs(self))
+        return NULL;
+    write_group(self, (uint32_t)value);
+    Py_RETURN_NONE;
+}
+FASTCALL_SHIM(PinGroup_write_int, PinGroupObject)
+
+// python method value = PinGroup.read(self), bit n is the nth channel
+static PyObject *PinGroup_read(PinGroupObject *self, PyObject *const *args, Py_ssize_t nargs)
+{
+    if (!check_nargs("read", nargs, 0))
+        return NULL;
+
+    return PyLong_FromUnsignedLong(read_group(self));
+}
+FASTCALL_SHIM(PinGroup_read, PinGroupObject)
+
+// python method PinGroup.toggle(self)
+static PyObject *PinGroup_toggle(PinGroupObject *self, PyObject *const *args, Py_ssize_t nargs)
+{
+    if (!check_nargs("toggle", nargs, 0))
+        return NULL;
+
+    if (!check_group_outputs(self))
+        return NULL;
+    if (self->map[0].mask)
+        toggle_gpio_bank(self->map[0].bank, self->map[0].mask);
+    if (self->map[1].mask)
+        toggle_gpio_bank(self->map[1].bank, self->map[1].mask);
+    Py_RETURN_NONE;
+}
+FASTCALL_SHIM(PinGroup_toggle, PinGroupObject)
+
+static PyMethodDef
+Pin_methods[] = {
+   FASTCALL_METHOD("write", Pin_write, "Output to the channel\nvalue - 0/1 or False/True or LOW/HIGH"),
+   FASTCALL_METHOD("read", Pin_read, "Input from the channel.  Returns HIGH=1 or LOW=0"),
+   FASTCALL_METHOD("toggle", Pin_toggle, "Invert the level of an output channel"),
+   { NULL }
+};
+
+static PyMethodDef
+PinGroup_methods[] = {
+   FASTCALL_METHOD("write", PinGroup_write, "Output to every channel of the group, one write per GPIO bank\nvalue - list/tuple with a level for each channel, or one level for all of them"),
+   FASTCALL_METHOD("write_int", PinGroup_write_int, "Output an integer to the group, bit n driving the nth channel\nvalue - integer"),
+   FASTCALL_METHOD("read", PinGroup_read, "Input from every channel of the group.  Returns an integer, bit n being the nth channel"),
+   FASTCALL_METHOD("toggle", PinGroup_toggle, "Invert the level of every channel of the group"),
+   { NULL }
+};
+
+PyTypeObject PinType = {
+   PyVarObject_HEAD_INIT(NULL,0)
+   "RPi.GPIO.Pin",            // tp_name
+   sizeof(PinObject),         // tp_basicsize
+   0,                         // tp_itemsize
+   (destructor)Bound_dealloc, // tp_dealloc
+   0,                         // tp_print
+   0,                         // tp_getattr
+   0,                         // tp_setattr
+   0,                         // tp_compare
+   0,                         // tp_repr
+   0,                         // tp_as_number
+   0,                         // tp_as_sequence
+   0,                         // tp_as_mapping
+   0,                         // tp_hash
+   0,                         // tp_call
+   0,                         // tp_str
+   0,                         // tp_getattro
+   0,                         // tp_setattro
+   0,                         // tp_as_buffer
+   Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE, // tp_flag
+   "A channel set up with setup(), checked once for fast access",    // tp_doc
+   0,                         // tp_traverse
+   0,                         // tp_clear
+   0,                         // tp_richcompare
+   0,                         // tp_weaklistoffset
+   0,                         // tp_iter
+   0,                         // tp_iternext
+   Pin_methods,               // tp_methods
+   0,                         // tp_members
+   0,                         // tp_getset
+   0,                         // tp_base
+   0,                         // tp_dict
+   0,                         // tp_descr_get
+   0,                         // tp_descr_set
+   0,                         // tp_dictoffset
+   (initproc)Pin_init,        // tp_init
+   0,                         // tp_alloc
+   0,                         // tp_new
+};
+
+PyTypeObject PinGroupType = {
+   PyVarObject_HEAD_INIT(NULL,0)
+   "RPi.GPIO.PinGroup",       // tp_name
+   sizeof(PinGroupObject),    // tp_basicsize
+   0,                         // tp_itemsize
+   (destructor)Bound_dealloc, // tp_dealloc
+   0,                         // tp_print
+   0,                         // tp_getattr
+   0,                         // tp_setattr
+   0,                         // tp_compare
+   0,                         // tp_repr
+   0,                         // tp_as_number
+   0,                         // tp_as_sequence
+   0,                         // tp_as_mapping
+   0,                         // tp_hash
+   0,                         // tp_call
+   0,                         // tp_str
+   0,                         // tp_getattro
+   0,                         // tp_setattro
+   0,                         // tp_as_buffer
+   Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE, // tp_flag
+   "Up to 32 channels set up with setup(), driven and read as the bits of an integer",    // tp_doc
+   0,                         // tp_traverse
+   0,                         // tp_clear
+   0,                         // tp_richcompare
+   0,                         // tp_weaklistoffset
+   0,                         // tp_iter
+   0,                         // tp_iternext
+   PinGroup_methods,          // tp_methods
+   0,                         // tp_members
+   0,                         // tp_getset
+   0,                         // tp_base
+   0,                         // tp_dict
+   0,                         // tp_descr_get
+   0,                         // tp_descr_set
+   0,                         // tp_dictoffset
+   (initproc)PinGroup_init,   // tp_init
+   0,                         // tp_alloc
+   0,                         // tp_new
+};
+
+PyTypeObject *Pin_init_PinType(void)
+{
+   // Fill in some slots in the type, and make it ready
+   PinType.tp_new = Bound_new;
+   if (PyType_Ready(&PinType) < 0)
+      return NULL;
+
+   return &PinType;
+}
+
+PyTypeObject *Pin_init_PinGroupType(void)
+{
+   PinGroupType.tp_new = Bound_new;
+   if (PyType_Ready(&PinGroupType) < 0)
+      return NULL;
+
+   return &PinGroupType;
+}
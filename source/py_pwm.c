@@ -37,22 +37,27 @@ typedef struct
 // python method PWM.__init__(self, channel, frequency)
 static int PWM_init(PWMObject *self, PyObject *args, PyObject *kwds)
 {
-    int channel;
+    PyObject *module;
+    struct module_state *state;
+    int channel, result;
     float frequency;
 
     if (!PyArg_ParseTuple(args, "if", &channel, &frequency))
         return -1;
 
-    // convert channel to gpio
-    if (get_gpio_number(channel, &(self->gpio)))
+    // convert channel to gpio, in the mode of the calling interpreter
+    if ((module = current_module()) == NULL)
         return -1;
-
-    // ensure channel set as output
-    if (gpio_direction[self->gpio] != OUTPUT)
+    state = get_module_state(module);
+    result = get_gpio_number(state, channel, &(self->gpio));
+    if (result == 0 && state->gpio_direction[self->gpio] != OUTPUT)    // ensure channel set as output
     {
         PyErr_SetString(PyExc_RuntimeError, "You must setup() the GPIO channel as an output first");
-        return -1;
+        result = 1;
     }
+    Py_DECREF(module);
+    if (result)
+        return -1;
 
     if (frequency <= 0.0)
     {
@@ -0,0 +1,364 @@
+/*
+Based on RPi.GPIO by Ben Croston
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <pthread.h>
+#include "rpio.h"
+#include "c_gpio.h"
+#include "cpuinfo.h"
+#include "event_gpio.h"
+#include "event_fd.h"
+#include "sequence.h"
+#include "soft_pwm.h"
+#include "timing.h"
+
+// the public constants are the core's own values
+#if RPIO_INPUT != INPUT || RPIO_OUTPUT != OUTPUT || RPIO_PUD_OFF != PUD_OFF || \
+    RPIO_PUD_DOWN != PUD_DOWN || RPIO_PUD_UP != PUD_UP || RPIO_RISING != RISING_EDGE || \
+    RPIO_FALLING != FALLING_EDGE || RPIO_BOTH != BOTH_EDGE || RPIO_ERR_NOT_RPI != SETUP_NOT_RPI_FAIL
+#error "rpio.h constants do not match the core"
+#endif
+
+typedef char rpio_edge_matches_edge_record[sizeof(struct rpio_edge) == sizeof(struct edge_record) ? 1 : -1];
+typedef char rpio_wave_step_matches_wave_step[sizeof(struct rpio_wave_step) == sizeof(struct wave_step) ? 1 : -1];
+
+static pthread_mutex_t open_lock = PTHREAD_MUTEX_INITIALIZER;
+static int opened = 0;
+static rpi_info board;
+static int event_fd = -1;   // the library's own event fd, opened on first use
+
+unsigned int rpio_version(void)
+{
+    return RPIO_VERSION;
+}
+
+int rpio_open(void)
+// return values:
+// RPIO_OK, or one of RPIO_ERR_DEVMEM to RPIO_ERR_NOT_RPI
+{
+    int result = RPIO_OK;
+
+    pthread_mutex_lock(&open_lock);
+    if (!opened) {
+        if (get_rpi_info(&board))
+            result = RPIO_ERR_NOT_RPI;
+        else if ((result = setup()) == SETUP_OK)
+            opened = 1;
+    }
+    pthread_mutex_unlock(&open_lock);
+    return result;
+}
+
+void rpio_close(void)
+{
+    pthread_mutex_lock(&open_lock);
+    if (opened) {
+        event_cleanup_all();
+        pwm_stop_all();     // the pwm threads write the registers until they finish
+        cleanup();
+        event_fd = -1;
+        opened = 0;
+    }
+    pthread_mutex_unlock(&open_lock);
+}
+
+int rpio_board_info(struct rpio_board_info *info)
+// return values:
+// RPIO_OK or RPIO_ERR_INVALID
+{
+    if (!opened)
+        return RPIO_ERR_INVALID;
+    info->p1_revision = board.p1_revision;
+    info->revision = board.revision;
+    info->type = board.type;
+    info->manufacturer = board.manufacturer;
+    info->processor = board.processor;
+    info->ram = board.ram;
+    return RPIO_OK;
+}
+
+unsigned long long rpio_time_ns(void)
+{
+    return time_ns();
+}
+
+int rpio_setup(unsigned int gpio, int direction, int pud)
+// return values:
+// RPIO_OK or RPIO_ERR_INVALID
+{
+    if (!opened || gpio > 53 || (direction != RPIO_INPUT && direction != RPIO_OUTPUT) ||
+        pud < RPIO_PUD_OFF || pud > RPIO_PUD_UP)
+        return RPIO_ERR_INVALID;
+    setup_gpio(gpio, direction, pud);
+    return RPIO_OK;
+}
+
+int rpio_function(unsigned int gpio)
+// returns the function select value, 0 for input, 1 for output and 2-7
+// for the alternate functions, or -RPIO_ERR_INVALID
+{
+    if (!opened || gpio > 53)
+        return -RPIO_ERR_INVALID;
+    return gpio_function(gpio);
+}
+
+void rpio_write(unsigned int gpio, int value)
+{
+    output_gpio(gpio, value);
+}
+
+int rpio_read(unsigned int gpio)
+{
+    return input_gpio(gpio) != 0;
+}
+
+void rpio_write_bank(int bank, uint32_t set, uint32_t clr)
+{
+    output_gpio_bank(bank, set, clr);
+}
+
+uint32_t rpio_read_bank(int bank)
+{
+    return input_gpio_bank(bank);
+}
+
+volatile uint32_t *rpio_registers(void)
+// returns the mapped GPIO registers, or NULL before rpio_open()
+{
+    return opened ? gpio_registers() : NULL;
+}
+
+uint32_t rpio_toggle_bank(int bank, uint32_t mask)
+// returns the new output levels of the bank
+{
+    return toggle_gpio_bank(bank, mask);
+}
+
+uint32_t rpio_output_state_bank(int bank)
+// returns the levels last written to the bank by this process; writes
+// through rpio_registers() are not seen
+{
+    return output_state_bank(bank);
+}
+
+uint32_t rpio_verify_bank(int bank)
+// returns the outputs of the bank whose level differs from the level last
+// written, which are then reloaded from the pins
+{
+    uint32_t differ = verify_output_bank(bank);
+
+    if (differ)
+        sync_output_state(bank, differ);
+    return differ;
+}
+
+int rpio_edge_add(unsigned int gpio, int edge, int bouncetime, rpio_edge_callback callback)
+// bouncetime in ms, or 0 for none.  callback may be NULL, and is run on the
+// library's edge thread, so it should return quickly.
+// return values:
+// RPIO_OK, RPIO_ERR_INVALID, RPIO_ERR_IN_USE, RPIO_ERR_MALLOC or RPIO_ERR_FAILED
+{
+    int result;
+
+    if (!opened || gpio > 53 || edge < RPIO_RISING || edge > RPIO_BOTH || bouncetime < 0)
+        return RPIO_ERR_INVALID;
+
+    result = add_edge_detect(gpio, edge, bouncetime ? bouncetime : -666);
+    if (result == 1)
+        return RPIO_ERR_IN_USE;
+    else if (result != 0)
+        return RPIO_ERR_FAILED;
+
+    if (callback != NULL && add_edge_callback_ex(gpio, callback) != 0) {
+        remove_edge_detect(gpio);
+        return RPIO_ERR_MALLOC;
+    }
+    return RPIO_OK;
+}
+
+void rpio_edge_remove(unsigned int gpio)
+{
+    if (gpio <= 53)
+        remove_edge_detect(gpio);
+}
+
+int rpio_edge_detected(unsigned int gpio)
+// returns 1 if an edge has been detected since the last call, else 0
+{
+    if (gpio > 53)
+        return 0;
+    return event_detected(gpio);
+}
+
+int rpio_edge_wait(unsigned int gpio, int edge, int bouncetime, int timeout)
+// bouncetime in ms or 0, timeout in ms or -1 to wait for ever
+// returns 1 on an edge, 0 on timeout, -RPIO_ERR_INVALID,
+// -RPIO_ERR_IN_USE or -RPIO_ERR_FAILED
+{
+    int result;
+
+    if (!opened || gpio > 53 || edge < RPIO_RISING || edge > RPIO_BOTH || bouncetime < 0)
+        return -RPIO_ERR_INVALID;
+
+    result = blocking_wait_for_edge(gpio, edge, bouncetime ? bouncetime : -666, timeout);
+    if (result == -1)
+        return -RPIO_ERR_IN_USE;
+    else if (result < 0)
+        return -RPIO_ERR_FAILED;
+    return result;
+}
+
+static int open_event_fd(void)
+// returns the library's event fd, opening it on first use, or -1
+{
+    int fd;
+
+    pthread_mutex_lock(&open_lock);
+    if (event_fd == -1)
+        event_fd = event_fd_open();
+    fd = event_fd;
+    pthread_mutex_unlock(&open_lock);
+    return fd;
+}
+
+int rpio_event_fd(void)
+// returns a descriptor that is readable while watched edges are queued,
+// or -RPIO_ERR_FAILED
+{
+    int fd;
+
+    if ((fd = open_event_fd()) == -1)
+        return -RPIO_ERR_FAILED;
+    return fd;
+}
+
+int rpio_event_watch(unsigned int gpio, int watch)
+// queue the edges of a gpio with edge detection for rpio_event_drain()
+// return values:
+// RPIO_OK or RPIO_ERR_INVALID
+{
+    int fd;
+
+    if (gpio > 53 || (watch && !gpio_event_added(gpio)))
+        return RPIO_ERR_INVALID;
+    if ((fd = open_event_fd()) == -1 || event_fd_watch(fd, gpio, watch) != 0)
+        return RPIO_ERR_INVALID;
+    return RPIO_OK;
+}
+
+int rpio_event_drain(struct rpio_edge *edges, int max, unsigned long *dropped)
+// copy up to max queued edges without blocking, and the number dropped
+// since the last call because the queue was full
+// returns the number of edges copied or -RPIO_ERR_INVALID
+{
+    unsigned long lost = 0;
+    int fd;
+
+    if (max < 1)
+        return -RPIO_ERR_INVALID;
+    pthread_mutex_lock(&open_lock);
+    fd = event_fd;
+    pthread_mutex_unlock(&open_lock);
+    if ((max = event_fd_drain(fd, (struct edge_record *)edges, max, &lost)) < 0)
+        max = 0;    // nothing watched yet
+    if (dropped != NULL)
+        *dropped = lost;
+    return max;
+}
+
+int rpio_pwm_set_frequency(unsigned int gpio, float freq)
+// return values:
+// RPIO_OK or RPIO_ERR_INVALID
+{
+    if (gpio > 53 || freq <= 0.0)
+        return RPIO_ERR_INVALID;
+    pwm_set_frequency(gpio, freq);
+    return RPIO_OK;
+}
+
+int rpio_pwm_set_duty_cycle(unsigned int gpio, float dutycycle)
+// dutycycle in percent
+// return values:
+// RPIO_OK or RPIO_ERR_INVALID
+{
+    if (gpio > 53 || dutycycle < 0.0 || dutycycle > 100.0)
+        return RPIO_ERR_INVALID;
+    pwm_set_duty_cycle(gpio, dutycycle);
+    return RPIO_OK;
+}
+
+int rpio_pwm_start(unsigned int gpio)
+// the gpio must be set up as an output
+// return values:
+// RPIO_OK or RPIO_ERR_INVALID
+{
+    if (!opened || gpio > 53)
+        return RPIO_ERR_INVALID;
+    pwm_start(gpio);
+    return RPIO_OK;
+}
+
+int rpio_pwm_stop(unsigned int gpio)
+// return values:
+// RPIO_OK or RPIO_ERR_INVALID
+{
+    if (gpio > 53)
+        return RPIO_ERR_INVALID;
+    pwm_stop(gpio);
+    return RPIO_OK;
+}
+
+int rpio_play_wave(const struct rpio_wave_step *steps, size_t count, unsigned int repeat, long long *errors)
+// plays the steps repeat times and returns when they are done.  errors, if
+// not NULL, gets count entries: how late each step was written in ns, the
+// worst over the repeats.
+// return values:
+// RPIO_OK, RPIO_ERR_INVALID or RPIO_ERR_FAILED
+{
+    if (!opened || (count && steps == NULL))
+        return RPIO_ERR_INVALID;
+    switch (play_wave((const struct wave_step *)steps, count, repeat, errors)) {
+    case 0:
+        return RPIO_OK;
+    case 1:
+        return RPIO_ERR_INVALID;
+    default:
+        return RPIO_ERR_FAILED;
+    }
+}
+
+int rpio_pulse(unsigned int gpio, unsigned long long width_ns, int level, long long *error)
+// drives gpio to level for width_ns, then back.  error, if not NULL, gets
+// the achieved width less width_ns.
+// return values:
+// RPIO_OK, RPIO_ERR_INVALID or RPIO_ERR_FAILED
+{
+    if (!opened || gpio > 53)
+        return RPIO_ERR_INVALID;
+    switch (play_pulse(gpio, width_ns, level, error)) {
+    case 0:
+        return RPIO_OK;
+    case 1:
+        return RPIO_ERR_INVALID;   // wider than WAVE_MAX_DELTA_NS
+    default:
+        return RPIO_ERR_FAILED;
+    }
+}
@@ -0,0 +1,143 @@
+/*
+Based on RPi.GPIO by Ben Croston
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* librpio: the GPIO core used by the Node and Python modules, for native
+   programs.  Only this header is part of the stable API; the other headers
+   in source/ may change between releases.  Every function may be called
+   from any thread.
+
+   Call rpio_open() once before anything else.  rpio_write(), rpio_read()
+   and the bank functions do no checking, so they can be used directly on
+   a hot path. */
+
+#ifndef RPIO_H
+#define RPIO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RPIO_VERSION_MAJOR 1
+#define RPIO_VERSION_MINOR 3
+#define RPIO_VERSION_PATCH 0
+#define RPIO_VERSION ((RPIO_VERSION_MAJOR << 16) | (RPIO_VERSION_MINOR << 8) | RPIO_VERSION_PATCH)
+
+// results; functions that return a count, descriptor or level return the
+// negated error instead
+#define RPIO_OK            0
+#define RPIO_ERR_DEVMEM    1    // no access to /dev/gpiomem or /dev/mem
+#define RPIO_ERR_MALLOC    2
+#define RPIO_ERR_MMAP      3
+#define RPIO_ERR_CPUINFO   4
+#define RPIO_ERR_NOT_RPI   5
+#define RPIO_ERR_INVALID   6    // bad argument, or rpio_open() has not succeeded
+#define RPIO_ERR_IN_USE    7    // conflicting edge detection on the gpio
+#define RPIO_ERR_FAILED    8    // sysfs, thread or descriptor failure
+
+#define RPIO_INPUT  1
+#define RPIO_OUTPUT 0
+
+#define RPIO_PUD_OFF  0
+#define RPIO_PUD_DOWN 1
+#define RPIO_PUD_UP   2
+
+#define RPIO_RISING  1
+#define RPIO_FALLING 2
+#define RPIO_BOTH    3
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct rpio_board_info
+{
+    int p1_revision;            // 0 for the compute module, else 1-3
+    const char *revision;       // revision code from /proc/cpuinfo
+    const char *type;
+    const char *manufacturer;
+    const char *processor;
+    const char *ram;
+};
+
+struct rpio_edge
+{
+    uint32_t gpio;
+    uint32_t level;             // level read when the edge was detected
+    uint64_t timestamp;         // rpio_time_ns() when the edge was detected
+};
+
+struct rpio_wave_step
+{
+    uint32_t bank;
+    uint32_t set;
+    uint32_t clr;
+    uint32_t reserved;
+    double delta_ns;            // after the previous step, the first after the start
+};
+
+typedef void (*rpio_edge_callback)(unsigned int gpio, int level, unsigned long long timestamp);
+
+unsigned int rpio_version(void);    // RPIO_VERSION the library was built as
+
+// board and registers
+int rpio_open(void);
+void rpio_close(void);
+int rpio_board_info(struct rpio_board_info *info);
+unsigned long long rpio_time_ns(void);
+
+// register I/O, gpio is the BCM number 0-53 and bank 0 or 1
+int rpio_setup(unsigned int gpio, int direction, int pud);
+int rpio_function(unsigned int gpio);
+void rpio_write(unsigned int gpio, int value);
+int rpio_read(unsigned int gpio);
+void rpio_write_bank(int bank, uint32_t set, uint32_t clr);
+uint32_t rpio_read_bank(int bank);
+volatile uint32_t *rpio_registers(void);    // since 1.1, see rpio.hpp
+
+// output levels as last written, without reading the pins (since 1.2)
+uint32_t rpio_toggle_bank(int bank, uint32_t mask);
+uint32_t rpio_output_state_bank(int bank);
+uint32_t rpio_verify_bank(int bank);
+
+// edge events
+int rpio_edge_add(unsigned int gpio, int edge, int bouncetime, rpio_edge_callback callback);
+void rpio_edge_remove(unsigned int gpio);
+int rpio_edge_detected(unsigned int gpio);
+int rpio_edge_wait(unsigned int gpio, int edge, int bouncetime, int timeout);
+int rpio_event_fd(void);
+int rpio_event_watch(unsigned int gpio, int watch);
+int rpio_event_drain(struct rpio_edge *edges, int max, unsigned long *dropped);
+
+// software PWM
+int rpio_pwm_set_frequency(unsigned int gpio, float freq);
+int rpio_pwm_set_duty_cycle(unsigned int gpio, float dutycycle);
+int rpio_pwm_start(unsigned int gpio);
+int rpio_pwm_stop(unsigned int gpio);
+
+// timed output from a real time thread (since 1.3)
+int rpio_play_wave(const struct rpio_wave_step *steps, size_t count, unsigned int repeat, long long *errors);
+int rpio_pulse(unsigned int gpio, unsigned long long width_ns, int level, long long *error);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RPIO_H */
@@ -0,0 +1,294 @@
+/*
+Based on RPi.GPIO by Ben Croston
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* rpio.hpp: header-only C++ access to the GPIO registers with the pins
+   fixed at compile time.  Bank offsets, bit masks and the mapping of
+   header pins to BCM numbers are constant expressions, so Pin<N>::high()
+   is a single store and a pin that does not exist fails to compile.
+
+       rpio::open();
+       using Clock = rpio::BoardPin<11>;          // header pin 11 is gpio 17
+       using Data = rpio::PinSet<22, 23, 24, 25>;
+       Clock::setup(RPIO_OUTPUT);
+       Data::write(0xa);                          // one store to set, one to clear
+       Clock::high();
+
+   Setup, events and PWM go through the rpio.h functions, which lock the
+   shared registers.  Pin and PinSet only touch the set, clear and level
+   registers, which need no lock, and do not update the output levels kept
+   for rpio_output_state_bank(). */
+
+#ifndef RPIO_HPP
+#define RPIO_HPP
+
+#if __cplusplus < 201402L
+#error "rpio.hpp needs C++14"
+#endif
+
+#include <stdint.h>
+#include "rpio.h"
+
+namespace rpio {
+
+namespace detail {
+
+// register word offsets, as in c_gpio.c
+constexpr unsigned set_offset = 7;
+constexpr unsigned clr_offset = 10;
+constexpr unsigned level_offset = 13;
+
+// set by rpio::open(), shared by every translation unit
+inline volatile uint32_t *&registers()
+{
+    static volatile uint32_t *base = nullptr;
+    return base;
+}
+
+template <unsigned... Gpios>
+struct pin_list
+{
+    static constexpr uint32_t mask = 0;
+    static constexpr bool valid = true;
+};
+
+template <unsigned Gpio, unsigned... Rest>
+struct pin_list<Gpio, Rest...>
+{
+    static constexpr uint32_t mask = (1u << (Gpio % 32)) | pin_list<Rest...>::mask;
+    static constexpr bool valid = Gpio < 54 && pin_list<Rest...>::valid;
+};
+
+template <unsigned Bank, unsigned... Gpios>
+struct in_bank
+{
+    static constexpr bool value = true;
+};
+
+template <unsigned Bank, unsigned Gpio, unsigned... Rest>
+struct in_bank<Bank, Gpio, Rest...>
+{
+    static constexpr bool value = Gpio / 32 == Bank && in_bank<Bank, Rest...>::value;
+};
+
+template <unsigned Gpio, unsigned... Rest>
+struct first_gpio
+{
+    static constexpr unsigned value = Gpio;
+};
+
+constexpr unsigned bit_count(uint32_t mask)
+{
+    unsigned count = 0;
+
+    for (; mask; mask &= mask - 1)
+        count++;
+    return count;
+}
+
+// move bit I of value to the bit of the I-th gpio, and back
+template <unsigned I>
+constexpr uint32_t spread(uint32_t)
+{
+    return 0;
+}
+
+template <unsigned I, unsigned Gpio, unsigned... Rest>
+constexpr uint32_t spread(uint32_t value)
+{
+    return (((value >> I) & 1u) << (Gpio % 32)) | spread<I + 1, Rest...>(value);
+}
+
+template <unsigned I>
+constexpr uint32_t gather(uint32_t)
+{
+    return 0;
+}
+
+template <unsigned I, unsigned Gpio, unsigned... Rest>
+constexpr uint32_t gather(uint32_t levels)
+{
+    return (((levels >> (Gpio % 32)) & 1u) << I) | gather<I + 1, Rest...>(levels);
+}
+
+template <unsigned Pin, class Layout>
+struct board_gpio
+{
+    static_assert(Pin >= 1 && Pin <= Layout::pins, "the header pin is not on this board");
+    static_assert(Layout::gpio(Pin) >= 0, "the header pin is not a gpio");
+
+    static constexpr unsigned value = Layout::gpio(Pin) < 0 ? 0 : Layout::gpio(Pin);
+};
+
+} // namespace detail
+
+// open the library and keep the register map for Pin and PinSet
+// returns RPIO_OK or an RPIO_ERR_ value
+inline int open()
+{
+    int result = rpio_open();
+
+    if (result == RPIO_OK)
+        detail::registers() = rpio_registers();
+    return result;
+}
+
+// one gpio by BCM number
+template <unsigned Gpio>
+struct Pin
+{
+    static_assert(Gpio < 54, "BCM gpio numbers are 0-53");
+
+    static constexpr unsigned gpio = Gpio;
+    static constexpr unsigned bank = Gpio / 32;
+    static constexpr uint32_t mask = 1u << (Gpio % 32);
+
+    static int setup(int direction, int pud = RPIO_PUD_OFF)
+    {
+        return rpio_setup(Gpio, direction, pud);
+    }
+
+    static void high()
+    {
+        detail::registers()[detail::set_offset + bank] = mask;
+    }
+
+    static void low()
+    {
+        detail::registers()[detail::clr_offset + bank] = mask;
+    }
+
+    static void write(bool value)
+    {
+        detail::registers()[(value ? detail::set_offset : detail::clr_offset) + bank] = mask;
+    }
+
+    static bool read()
+    {
+        return (detail::registers()[detail::level_offset + bank] & mask) != 0;
+    }
+};
+
+template <unsigned Gpio> constexpr unsigned Pin<Gpio>::gpio;
+template <unsigned Gpio> constexpr unsigned Pin<Gpio>::bank;
+template <unsigned Gpio> constexpr uint32_t Pin<Gpio>::mask;
+
+// gpios in one bank, written and read together; bit i of a value is the
+// i-th gpio listed
+template <unsigned... Gpios>
+struct PinSet
+{
+    static_assert(sizeof...(Gpios) > 0, "a PinSet needs at least one gpio");
+    static_assert(detail::pin_list<Gpios...>::valid, "BCM gpio numbers are 0-53");
+
+    static constexpr unsigned size = sizeof...(Gpios);
+    static constexpr unsigned bank = detail::first_gpio<Gpios...>::value / 32;
+    static constexpr uint32_t mask = detail::pin_list<Gpios...>::mask;
+
+    static_assert(detail::in_bank<bank, Gpios...>::value,
+                  "the gpios of a PinSet must all be in 0-31 or all in 32-53");
+    static_assert(detail::bit_count(mask) == size, "a gpio is listed twice");
+
+    static int setup(int direction, int pud = RPIO_PUD_OFF)
+    {
+        const unsigned gpios[] = {Gpios...};
+        int result;
+
+        for (unsigned gpio : gpios)
+            if ((result = rpio_setup(gpio, direction, pud)) != RPIO_OK)
+                return result;
+        return RPIO_OK;
+    }
+
+    static void high()
+    {
+        detail::registers()[detail::set_offset + bank] = mask;
+    }
+
+    static void low()
+    {
+        detail::registers()[detail::clr_offset + bank] = mask;
+    }
+
+    static void write(uint32_t value)
+    {
+        uint32_t set = detail::spread<0, Gpios...>(value);
+        volatile uint32_t *registers = detail::registers();
+
+        registers[detail::set_offset + bank] = set;
+        registers[detail::clr_offset + bank] = mask & ~set;
+    }
+
+    static uint32_t read()
+    {
+        return detail::gather<0, Gpios...>(detail::registers()[detail::level_offset + bank]);
+    }
+};
+
+template <unsigned... Gpios> constexpr unsigned PinSet<Gpios...>::size;
+template <unsigned... Gpios> constexpr unsigned PinSet<Gpios...>::bank;
+template <unsigned... Gpios> constexpr uint32_t PinSet<Gpios...>::mask;
+
+// header layouts for BoardPin, the same tables as the BOARD numbering mode
+namespace board {
+
+struct Rev1     // Model B revision 1
+{
+    static constexpr unsigned pins = 26;
+    static constexpr int gpio(unsigned pin)
+    {
+        constexpr int map[27] = {-1, -1, -1, 0, -1, 1, -1, 4, 14, -1, 15, 17, 18, 21, -1, 22, 23, -1, 24, 10, -1, 9, 25, 11, 8, -1, 7};
+        return pin < 27 ? map[pin] : -1;
+    }
+};
+
+struct Rev2     // Model A and B revision 2
+{
+    static constexpr unsigned pins = 26;
+    static constexpr int gpio(unsigned pin)
+    {
+        constexpr int map[27] = {-1, -1, -1, 2, -1, 3, -1, 4, 14, -1, 15, 17, 18, 27, -1, 22, 23, -1, 24, 10, -1, 9, 25, 11, 8, -1, 7};
+        return pin < 27 ? map[pin] : -1;
+    }
+};
+
+struct Plus40   // every board with the 40 pin header
+{
+    static constexpr unsigned pins = 40;
+    static constexpr int gpio(unsigned pin)
+    {
+        constexpr int map[41] = {-1, -1, -1, 2, -1, 3, -1, 4, 14, -1, 15, 17, 18, 27, -1, 22, 23, -1, 24, 10, -1, 9, 25, 11, 8, -1, 7, -1, -1, 5, -1, 6, 12, 13, -1, 19, 16, 26, 20, -1, 21};
+        return pin < 41 ? map[pin] : -1;
+    }
+};
+
+} // namespace board
+
+// a gpio by header pin number
+template <unsigned Pin, class Layout = board::Plus40>
+using BoardPin = rpio::Pin<detail::board_gpio<Pin, Layout>::value>;
+
+template <class Layout, unsigned... Pins>
+using BoardPinSet = PinSet<detail::board_gpio<Pins, Layout>::value...>;
+
+} // namespace rpio
+
+#endif /* RPIO_HPP */
@@ -0,0 +1,264 @@
+/*
+Based on RPi.GPIO by Ben Croston
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <string.h>
+#include <pthread.h>
+#include "c_gpio.h"
+#include "sequence.h"
+#include "thread_sched.h"
+#include "timing.h"
+
+// sleep to within this of each step and busy wait the rest
+#define SEQUENCE_SPIN_NS 100000
+
+// the waveform player spins for longer, as a real time thread wakes late
+// less often but a step that is late cannot be taken back
+#define WAVE_SPIN_NS 200000
+
+struct wave
+{
+    const struct wave_step *steps;
+    size_t count;
+    unsigned int repeat;
+    long long *errors;
+};
+
+int bank_map_init(struct bank_map *map, const unsigned int *gpios, int count)
+// return values:
+// 0 - Success
+// 1 - Pins are not all in one bank
+// 2 - Invalid count
+{
+    int i;
+
+    if (count <= 0 || count > 32)
+        return 2;
+    for (i=0; i<count; i++)
+        if (gpios[i] / 32 != gpios[0] / 32)
+            return 1;
+    return bank_map_init_bank(map, gpios, count, gpios[0] / 32);
+}
+
+// map only the pins in bank, keeping their bit positions in the value, so
+// a list spanning both banks is written with one map per bank
+int bank_map_init_bank(struct bank_map *map, const unsigned int *gpios, int count, int bank)
+// return values:
+// 0 - Success
+// 2 - Invalid count
+{
+    int i, byte, value, bit;
+    uint32_t mask;
+
+    if (count <= 0 || count > 32)
+        return 2;
+
+    memset(map, 0, sizeof(struct bank_map));
+    map->bank = bank;
+    map->count = count;
+    for (i=0; i<count; i++) {
+        map->gpios[i] = gpios[i];
+        if ((int)(gpios[i] / 32) == bank)
+            map->pin_mask[i] = 1 << (gpios[i] % 32);
+        map->mask |= map->pin_mask[i];
+    }
+
+    for (byte=0; byte<4; byte++) {
+        for (value=0; value<256; value++) {
+            mask = 0;
+            for (bit=0; bit<8; bit++) {
+                i = byte*8 + bit;
+                if (i < count && (value & (1 << bit)))
+                    mask |= map->pin_mask[i];
+            }
+            map->byte_mask[byte][value] = mask;
+        }
+    }
+    return 0;
+}
+
+// bank bits to set for value, bit n of value being the nth pin
+uint32_t bank_map_bits(const struct bank_map *map, uint32_t value)
+{
+    return map->byte_mask[0][value & 0xff] |
+           map->byte_mask[1][(value >> 8) & 0xff] |
+           map->byte_mask[2][(value >> 16) & 0xff] |
+           map->byte_mask[3][(value >> 24) & 0xff];
+}
+
+// gather the pins from a level register read
+uint32_t bank_map_value(const struct bank_map *map, uint32_t levels)
+{
+    uint32_t value = 0;
+    int i;
+
+    for (i=0; i<map->count; i++)
+        if (levels & map->pin_mask[i])
+            value |= 1 << i;
+    return value;
+}
+
+void bank_map_write(const struct bank_map *map, uint32_t value)
+{
+    uint32_t set = bank_map_bits(map, value);
+    output_gpio_bank(map->bank, set, map->mask & ~set);
+}
+
+uint32_t bank_map_read(const struct bank_map *map)
+{
+    return bank_map_value(map, input_gpio_bank(map->bank));
+}
+
+static unsigned long spin_for(unsigned long long interval_ns)
+{
+    return interval_ns < SEQUENCE_SPIN_NS ? interval_ns : SEQUENCE_SPIN_NS;
+}
+
+// write values[i] at start + i*interval_ns
+void write_sequence(const struct bank_map *map, const uint32_t *values, size_t count, unsigned long long interval_ns)
+{
+    unsigned long long start;
+    unsigned long spin = spin_for(interval_ns);
+    size_t i;
+
+    start = time_ns();
+    for (i=0; i<count; i++) {
+        if (i)
+            sleep_until_ns(start + i * interval_ns, spin);
+        bank_map_write(map, values[i]);
+    }
+}
+
+// sample the pins at start + i*interval_ns; the bits are gathered after
+// the run so the sampling loop only reads the level register
+void read_samples(const struct bank_map *map, uint32_t *samples, size_t count, unsigned long long interval_ns)
+{
+    unsigned long long start;
+    unsigned long spin = spin_for(interval_ns);
+    size_t i;
+
+    start = time_ns();
+    for (i=0; i<count; i++) {
+        if (i)
+            sleep_until_ns(start + i * interval_ns, spin);
+        samples[i] = input_gpio_bank(map->bank);
+    }
+    for (i=0; i<count; i++)
+        samples[i] = bank_map_value(map, samples[i]);
+}
+
+// write each frame at its time on the monotonic clock, frames whose time
+// has passed are written straight away
+void write_frames(const struct output_frame *frames, size_t count)
+{
+    size_t i;
+
+    for (i=0; i<count; i++) {
+        if (frames[i].time_ns > 0)
+            sleep_until_ns((unsigned long long)frames[i].time_ns, SEQUENCE_SPIN_NS);
+        output_gpio_bank(frames[i].bank, frames[i].set, frames[i].clr);
+    }
+}
+
+static void *wave_thread(void *arg)
+{
+    struct wave *w = (struct wave *)arg;
+    unsigned long long next, now;
+    long long error;
+    unsigned int r;
+    size_t i;
+
+    thread_sched_enter(THREAD_WAVE);
+
+    // every step is timed from the start, so a late step does not push
+    // back the ones after it
+    next = time_ns();
+    for (r=0; r<w->repeat; r++) {
+        for (i=0; i<w->count; i++) {
+            next += (unsigned long long)w->steps[i].delta_ns;
+            sleep_until_ns(next, WAVE_SPIN_NS);
+            now = time_ns();
+            output_gpio_bank(w->steps[i].bank, w->steps[i].set, w->steps[i].clr);
+
+            error = (long long)(now - next);
+            if (w->errors != NULL && (r == 0 || error > w->errors[i]))
+                w->errors[i] = error;
+        }
+    }
+
+    thread_sched_exit(THREAD_WAVE);
+    return NULL;
+}
+
+/* Play steps repeat times from a thread of the THREAD_WAVE class, and wait
+   for it to finish.  errors, when not NULL, gets the latest each step was
+   written over all the repeats, in ns. */
+int play_wave(const struct wave_step *steps, size_t count, unsigned int repeat, long long *errors)
+// return values:
+// 0 - Success
+// 1 - Invalid step or repeat count
+// 2 - The player thread could not be started
+{
+    struct wave w;
+    pthread_t thread;
+    size_t i;
+
+    if (repeat == 0)
+        return 1;
+    for (i=0; i<count; i++)
+        if (steps[i].bank > 1 || !(steps[i].delta_ns >= 0 && steps[i].delta_ns <= WAVE_MAX_DELTA_NS))
+            return 1;
+
+    w.steps = steps;
+    w.count = count;
+    w.repeat = repeat;
+    w.errors = errors;
+    if (pthread_create(&thread, NULL, wave_thread, &w) != 0)
+        return 2;
+    pthread_join(thread, NULL);
+    return 0;
+}
+
+// drive gpio to level for width_ns, then back.  error gets the achieved
+// width less width_ns.  Return values are those of play_wave().
+int play_pulse(unsigned int gpio, unsigned long long width_ns, int level, long long *error)
+{
+    struct wave_step steps[2];
+    long long errors[2];
+    uint32_t mask = 1 << (gpio%32);
+    int result;
+
+    memset(steps, 0, sizeof(steps));
+    steps[0].bank = steps[1].bank = gpio/32;
+    steps[0].delta_ns = 0;
+    steps[1].delta_ns = (double)width_ns;
+    if (level) {
+        steps[0].set = mask;
+        steps[1].clr = mask;
+    } else {
+        steps[0].clr = mask;
+        steps[1].set = mask;
+    }
+
+    if ((result = play_wave(steps, 2, 1, errors)) == 0 && error != NULL)
+        *error = errors[1] - errors[0];
+    return result;
+}
@@ -0,0 +1,72 @@
+/*
+Based on RPi.GPIO by Ben Croston
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* Pins of one bank driven or sampled as the bits of an integer, and timed
+   sequences of such writes and reads */
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct bank_map
+{
+    int bank;
+    int count;
+    unsigned int gpios[32];
+    uint32_t pin_mask[32];          // bank bit of each pin, 0 if in the other bank
+    uint32_t mask;                  // every pin in the map
+    uint32_t byte_mask[4][256];     // bank bits set by each value of each byte
+};
+
+// one timed write to a bank, laid out as the records of a Node frame buffer
+struct output_frame
+{
+    uint32_t bank;
+    uint32_t set;
+    uint32_t clr;
+    uint32_t reserved;
+    double time_ns;     // monotonic clock, 0 to write at once
+};
+
+// one step of a waveform, laid out like output_frame but timed from the
+// step before
+#define WAVE_MAX_DELTA_NS 1e9   // longest a step may wait, busy waiting
+
+struct wave_step
+{
+    uint32_t bank;
+    uint32_t set;
+    uint32_t clr;
+    uint32_t reserved;
+    double delta_ns;    // after the previous step, the first after the start
+};
+
+int bank_map_init(struct bank_map *map, const unsigned int *gpios, int count);
+int bank_map_init_bank(struct bank_map *map, const unsigned int *gpios, int count, int bank);
+uint32_t bank_map_bits(const struct bank_map *map, uint32_t value);
+uint32_t bank_map_value(const struct bank_map *map, uint32_t levels);
+void bank_map_write(const struct bank_map *map, uint32_t value);
+uint32_t bank_map_read(const struct bank_map *map);
+void write_sequence(const struct bank_map *map, const uint32_t *values, size_t count, unsigned long long interval_ns);
+void read_samples(const struct bank_map *map, uint32_t *samples, size_t count, unsigned long long interval_ns);
+void write_frames(const struct output_frame *frames, size_t count);
+int play_wave(const struct wave_step *steps, size_t count, unsigned int repeat, long long *errors);
+int play_pulse(unsigned int gpio, unsigned long long width_ns, int level, long long *error);
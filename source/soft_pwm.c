@@ -22,10 +22,10 @@ SOFTWARE.
 
 #include <stdlib.h>
 #include <pthread.h>
-#include <time.h>
 #include "c_gpio.h"
 #include "soft_pwm.h"
-pthread_t threads;
+#include "thread_sched.h"
+#include "timing.h"
 
 struct pwm
 {
@@ -34,82 +34,88 @@ struct pwm
     float dutycycle;
     float basetime;
     float slicetime;
-    struct timespec req_on, req_off;
+    unsigned long long on_ns, off_ns;
     int running;
+    int thread_alive;   // the thread frees the node when it exits
     struct pwm *next;
 };
-struct pwm *pwm_list = NULL;
 
-void remove_pwm(unsigned int gpio)
-{
-    struct pwm *p = pwm_list;
-    struct pwm *prev = NULL;
-    struct pwm *temp;
-
-    while (p != NULL)
-    {
-        if (p->gpio == gpio)
-        {
-            if (prev == NULL)
-                pwm_list = p->next;
-            else
-                prev->next = p->next;
-            temp = p;
-            p = p->next;
-            free(temp);
-        } else {
-            prev = p;
-            p = p->next;
-        }
-    }
-}
+// guards pwm_list, pwm_threads and every field of the nodes; the pwm
+// threads take it once per period to pick up changes
+static pthread_mutex_t pwm_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pwm_exited = PTHREAD_COND_INITIALIZER;
+static struct pwm *pwm_list = NULL;
+static int pwm_threads = 0;     // pwm threads that have not finished yet
 
-void calculate_times(struct pwm *p)
+static void remove_pwm(struct pwm *p)
 {
-    long long usec;
+    struct pwm **link = &pwm_list;
 
-    usec = (long long)(p->dutycycle * p->slicetime * 1000.0);
-    p->req_on.tv_sec = (int)(usec / 1000000LL);
-    usec -= (long long)p->req_on.tv_sec * 1000000LL;
-    p->req_on.tv_nsec = (long)usec * 1000L;
-
-    usec = (long long)((100.0-p->dutycycle) * p->slicetime * 1000.0);
-    p->req_off.tv_sec = (int)(usec / 1000000LL);
-    usec -= (long long)p->req_off.tv_sec * 1000000LL;
-    p->req_off.tv_nsec = (long)usec * 1000L;
+    while (*link != NULL && *link != p)
+        link = &(*link)->next;
+    if (*link == p)
+        *link = p->next;
+    free(p);
 }
 
-void full_sleep(struct timespec *req)
+void calculate_times(struct pwm *p)
 {
-    struct timespec rem = {0};
-
-    if (nanosleep(req,&rem) == -1)
-        full_sleep(&rem);
+    p->on_ns = (unsigned long long)(p->dutycycle * p->slicetime * 1000000.0);
+    p->off_ns = (unsigned long long)((100.0-p->dutycycle) * p->slicetime * 1000000.0);
 }
 
 void *pwm_thread(void *threadarg)
 {
     struct pwm *p = (struct pwm *)threadarg;
+    unsigned int gpio = p->gpio;
+    unsigned long long next, on_ns, off_ns;
+    float dutycycle;
 
-    while (p->running)
+    thread_sched_enter(THREAD_PWM);
+
+    // sleep to absolute times so the period does not drift
+    next = time_ns();
+    while (1)
     {
+        pthread_mutex_lock(&pwm_lock);
+        if (!p->running)
+        {
+            // a pwm_start() before this point keeps the thread going.  The
+            // last register write is done before the thread counts as
+            // finished, so pwm_stop_all() callers may unmap afterwards.
+            output_gpio(gpio, 0);
+            p->thread_alive = 0;
+            remove_pwm(p);
+            pwm_threads--;
+            pthread_cond_broadcast(&pwm_exited);
+            pthread_mutex_unlock(&pwm_lock);
+            break;
+        }
+        on_ns = p->on_ns;
+        off_ns = p->off_ns;
+        dutycycle = p->dutycycle;
+        pthread_mutex_unlock(&pwm_lock);
+
+        // start afresh rather than catch up after a long stall
+        if (time_ns() > next + on_ns + off_ns)
+            next = time_ns();
 
-        if (p->dutycycle > 0.0)
+        if (dutycycle > 0.0)
         {
-            output_gpio(p->gpio, 1);
-            full_sleep(&p->req_on);
+            output_gpio(gpio, 1);
+            next += on_ns;
+            sleep_until_ns(next, 0);
         }
 
-        if (p->dutycycle < 100.0)
+        if (dutycycle < 100.0)
         {
-            output_gpio(p->gpio, 0);
-            full_sleep(&p->req_off);
+            output_gpio(gpio, 0);
+            next += off_ns;
+            sleep_until_ns(next, 0);
         }
     }
 
-    // clean up
-    output_gpio(p->gpio, 0);
-    remove_pwm(p->gpio);
+    thread_sched_exit(THREAD_PWM);
     pthread_exit(NULL);
 }
 
@@ -117,9 +123,11 @@ struct pwm *add_new_pwm(unsigned int gpio)
 {
     struct pwm *new_pwm;
 
-    new_pwm = malloc(sizeof(struct pwm));
+    if ((new_pwm = malloc(sizeof(struct pwm))) == NULL)
+        return NULL;
     new_pwm->gpio = gpio;
     new_pwm->running = 0;
+    new_pwm->thread_alive = 0;
     new_pwm->next = NULL;
     // default to 1 kHz frequency, dutycycle 0.0
     new_pwm->freq = 1000.0;
@@ -130,6 +138,7 @@ struct pwm *add_new_pwm(unsigned int gpio)
     return new_pwm;
 }
 
+// call holding pwm_lock
 struct pwm *find_pwm(unsigned int gpio)
 {
     struct pwm *p = pwm_list;
@@ -164,11 +173,13 @@ void pwm_set_duty_cycle(unsigned int gpio, float dutycycle)
         return;
     }
 
+    pthread_mutex_lock(&pwm_lock);
     if ((p = find_pwm(gpio)) != NULL)
     {
         p->dutycycle = dutycycle;
         calculate_times(p);
     }
+    pthread_mutex_unlock(&pwm_lock);
 }
 
 void pwm_set_frequency(unsigned int gpio, float freq)
@@ -181,34 +192,70 @@ void pwm_set_frequency(unsigned int gpio, float freq)
         return;
     }
 
+    pthread_mutex_lock(&pwm_lock);
     if ((p = find_pwm(gpio)) != NULL)
     {
         p->basetime = 1000.0 / freq;    // calculated in ms
         p->slicetime = p->basetime / 100.0;
         calculate_times(p);
     }
+    pthread_mutex_unlock(&pwm_lock);
 }
 
 void pwm_start(unsigned int gpio)
 {
+    pthread_t thread;
     struct pwm *p;
 
+    pthread_mutex_lock(&pwm_lock);
     if (((p = find_pwm(gpio)) == NULL) || p->running)
+    {
+        pthread_mutex_unlock(&pwm_lock);
         return;
+    }
 
+    // a thread still finishing after pwm_stop() carries on instead
     p->running = 1;
-    if (pthread_create(&threads, NULL, pwm_thread, (void *)p) != 0)
+    if (!p->thread_alive)
     {
-        // btc fixme - error
-        p->running = 0;
-        return;
+        if (pthread_create(&thread, NULL, pwm_thread, (void *)p) != 0)
+        {
+            // btc fixme - error
+            p->running = 0;
+        } else {
+            pthread_detach(thread);
+            p->thread_alive = 1;
+            pwm_threads++;
+        }
     }
+    pthread_mutex_unlock(&pwm_lock);
 }
 
 void pwm_stop(unsigned int gpio)
 {
     struct pwm *p;
 
+    pthread_mutex_lock(&pwm_lock);
     if ((p = find_pwm(gpio)) != NULL)
         p->running = 0;
+    pthread_mutex_unlock(&pwm_lock);
+}
+
+// stop every pwm and wait for the threads to set their pins low and finish,
+// which takes up to one period of the slowest.  Call before unmapping the
+// registers.
+void pwm_stop_all(void)
+{
+    struct pwm *p;
+
+    pthread_mutex_lock(&pwm_lock);
+    for (p = pwm_list; p != NULL; p = p->next)
+        p->running = 0;
+    while (pwm_threads > 0)
+        pthread_cond_wait(&pwm_exited, &pwm_lock);
+
+    // only pwms that never ran are left
+    while (pwm_list != NULL)
+        remove_pwm(pwm_list);
+    pthread_mutex_unlock(&pwm_lock);
 }
@@ -0,0 +1,180 @@
+/*
+Based on RPi.GPIO by Ben Croston
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include "thread_sched.h"
+
+#define MAX_THREADS 64
+
+struct thread_class
+{
+    struct thread_sched sched;
+    struct thread_sched_status status;
+    int configured;
+    pthread_t threads[MAX_THREADS];
+    int thread_count;
+};
+
+static pthread_mutex_t sched_lock = PTHREAD_MUTEX_INITIALIZER;
+#define NOT_APPLIED { THREAD_NOT_APPLIED, THREAD_NOT_APPLIED, THREAD_NOT_APPLIED, 0 }
+
+// waveform players run at real time priority unless told otherwise; if the
+// process may not use it they run as they are and the status says so
+static struct thread_class classes[THREAD_CLASSES] = {
+    [THREAD_EVENT] = {
+        .sched = { SCHED_OTHER, 0, 0, 0 },
+        .status = NOT_APPLIED,
+    },
+    [THREAD_PWM] = {
+        .sched = { SCHED_OTHER, 0, 0, 0 },
+        .status = NOT_APPLIED,
+    },
+    [THREAD_WAVE] = {
+        .sched = { SCHED_FIFO, 50, 0, 0 },
+        .status = NOT_APPLIED,
+        .configured = 1,
+    },
+};
+static int memory_locked = 0;
+
+static void apply(struct thread_class *c, pthread_t thread)
+{
+    struct sched_param param;
+    cpu_set_t cpuset;
+    int i, result;
+
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = c->sched.priority;
+    if ((result = pthread_setschedparam(thread, c->sched.policy, &param)) == 0) {
+        c->status.policy = 1;
+    } else {
+        c->status.policy = 0;
+        c->status.error = result;
+    }
+
+    CPU_ZERO(&cpuset);
+    for (i=0; i<CPU_SETSIZE && i<64; i++)
+        if (c->sched.cpus == 0 || (c->sched.cpus & (1ULL << i)))
+            CPU_SET(i, &cpuset);
+    if ((result = pthread_setaffinity_np(thread, sizeof(cpuset), &cpuset)) == 0) {
+        c->status.affinity = 1;
+    } else {
+        c->status.affinity = 0;
+        c->status.error = result;
+    }
+}
+
+int thread_sched_set(int thread_class, const struct thread_sched *sched)
+// return values:
+// 0 - Success, or nothing running to apply the settings to yet
+// 1 - Some of the settings could not be applied (see thread_sched_get)
+// 2 - Invalid thread class or policy
+{
+    struct thread_class *c;
+    int i, result = 0;
+
+    if (thread_class < 0 || thread_class >= THREAD_CLASSES)
+        return 2;
+    if (sched->policy != SCHED_OTHER && sched->policy != SCHED_FIFO && sched->policy != SCHED_RR)
+        return 2;
+
+    pthread_mutex_lock(&sched_lock);
+    c = &classes[thread_class];
+    c->sched = *sched;
+    c->configured = 1;
+    c->status.policy = THREAD_NOT_APPLIED;
+    c->status.affinity = THREAD_NOT_APPLIED;
+    c->status.lock_memory = THREAD_NOT_APPLIED;
+    c->status.error = 0;
+
+    // memory locking is process wide
+    if (sched->lock_memory) {
+        if (memory_locked || mlockall(MCL_CURRENT | MCL_FUTURE) == 0) {
+            memory_locked = 1;
+            c->status.lock_memory = 1;
+        } else {
+            c->status.lock_memory = 0;
+            c->status.error = errno;
+        }
+    }
+
+    for (i=0; i<c->thread_count; i++)
+        apply(c, c->threads[i]);
+
+    if (c->status.policy == 0 || c->status.affinity == 0 || c->status.lock_memory == 0)
+        result = 1;
+    pthread_mutex_unlock(&sched_lock);
+    return result;
+}
+
+void thread_sched_get(int thread_class, struct thread_sched *sched, struct thread_sched_status *status)
+{
+    if (thread_class < 0 || thread_class >= THREAD_CLASSES)
+        return;
+
+    pthread_mutex_lock(&sched_lock);
+    if (sched != NULL)
+        *sched = classes[thread_class].sched;
+    if (status != NULL)
+        *status = classes[thread_class].status;
+    pthread_mutex_unlock(&sched_lock);
+}
+
+void thread_sched_enter(int thread_class)
+{
+    struct thread_class *c;
+
+    if (thread_class < 0 || thread_class >= THREAD_CLASSES)
+        return;
+
+    c = &classes[thread_class];
+    pthread_mutex_lock(&sched_lock);
+    if (c->thread_count < MAX_THREADS)
+        c->threads[c->thread_count++] = pthread_self();
+    if (c->configured)
+        apply(c, pthread_self());
+    pthread_mutex_unlock(&sched_lock);
+}
+
+void thread_sched_exit(int thread_class)
+{
+    struct thread_class *c;
+    int i;
+
+    if (thread_class < 0 || thread_class >= THREAD_CLASSES)
+        return;
+
+    c = &classes[thread_class];
+    pthread_mutex_lock(&sched_lock);
+    for (i=0; i<c->thread_count; i++) {
+        if (pthread_equal(c->threads[i], pthread_self())) {
+            c->threads[i] = c->threads[--c->thread_count];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&sched_lock);
+}
@@ -0,0 +1,54 @@
+/*
+Based on RPi.GPIO by Ben Croston
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* Scheduling policy, priority, CPU affinity and memory locking for the
+   threads owned by the library, set per class of thread */
+
+#include <sched.h>
+
+#define THREAD_EVENT   0   // edge detection poll thread
+#define THREAD_PWM     1   // software PWM threads
+#define THREAD_WAVE    2   // waveform player threads
+#define THREAD_CLASSES 3
+
+#define THREAD_NOT_APPLIED -1   // no thread of the class has run since the settings were made
+
+struct thread_sched
+{
+    int policy;             // SCHED_OTHER, SCHED_FIFO or SCHED_RR
+    int priority;
+    unsigned long long cpus; // bit n set to allow cpu n, 0 for any cpu
+    int lock_memory;
+};
+
+struct thread_sched_status
+{
+    int policy;             // 1 applied, 0 failed or THREAD_NOT_APPLIED
+    int affinity;
+    int lock_memory;
+    int error;              // errno of the last failure
+};
+
+int thread_sched_set(int thread_class, const struct thread_sched *sched);
+void thread_sched_get(int thread_class, struct thread_sched *sched, struct thread_sched_status *status);
+void thread_sched_enter(int thread_class);
+void thread_sched_exit(int thread_class);
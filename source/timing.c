@@ -0,0 +1,113 @@
+/*
+Based on RPi.GPIO by Ben Croston
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <time.h>
+#include <errno.h>
+#include "timing.h"
+
+#define ST_CLO            1         // 0x0004 / 4
+#define ST_CHI            2         // 0x0008 / 4
+#define ST_RESOLUTION_NS  1000      // the system timer counts at 1MHz
+
+// the BCM system timer, a free running 1MHz counter, when it is mapped.
+// On the Pi 1 and Zero there is no arch timer for the vDSO to use, so
+// clock_gettime() is a system call and reading the counter is much cheaper.
+// It runs off the crystal while CLOCK_MONOTONIC is slewed by NTP, so it is
+// only polled inside a wait, matched to CLOCK_MONOTONIC when the wait
+// starts; every timestamp handed out is CLOCK_MONOTONIC.  st_map stays
+// mapped once it has been published.
+static volatile uint32_t *st_map = NULL;
+
+static unsigned long long systimer_ns(volatile uint32_t *systimer)
+{
+    uint32_t hi, lo;
+
+    // the 1MHz counter is split over two registers, re-read if CLO wrapped
+    do {
+        hi = *(systimer+ST_CHI);
+        lo = *(systimer+ST_CLO);
+    } while (hi != *(systimer+ST_CHI));
+    return (((unsigned long long)hi << 32) | lo) * 1000ULL;
+}
+
+// the same clock as process.hrtime() and time.monotonic_ns()
+unsigned long long time_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);   // vDSO, no system call
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void timing_use_systimer(volatile uint32_t *systimer)
+// NULL goes back to polling the vDSO clock.  The mapping must stay valid
+// for the life of the process, as other threads may still be reading it.
+{
+    __atomic_store_n(&st_map, systimer, __ATOMIC_RELEASE);
+}
+
+// busy wait until the time_ns() deadline
+static void spin_until_ns(unsigned long long deadline)
+{
+    volatile uint32_t *systimer = __atomic_load_n(&st_map, __ATOMIC_ACQUIRE);
+    unsigned long long now = time_ns();
+    unsigned long long st_deadline;
+
+    if (now >= deadline)
+        return;
+    if (systimer == NULL) {
+        while (time_ns() < deadline)
+            ;
+        return;
+    }
+    st_deadline = systimer_ns(systimer) + (deadline - now);
+    while (systimer_ns(systimer) < st_deadline)
+        ;
+}
+
+// wait at least ns.  The clock is polled rather than a loop counted, so
+// the wait does not shrink when cpufreq raises the clock speed.
+void busy_wait_ns(unsigned long ns)
+{
+    unsigned long long deadline;
+
+    deadline = time_ns() + ns;
+    if (__atomic_load_n(&st_map, __ATOMIC_RELAXED) != NULL)
+        deadline += ST_RESOLUTION_NS;     // its first tick may come at once
+    spin_until_ns(deadline);
+}
+
+void sleep_until_ns(unsigned long long deadline, unsigned long spin_ns)
+// sleep until spin_ns before the deadline, then busy wait the rest
+{
+    struct timespec req, rem;
+    unsigned long long now = time_ns();
+
+    if (deadline > now + spin_ns) {
+        req.tv_sec = (deadline - now - spin_ns) / 1000000000ULL;
+        req.tv_nsec = (deadline - now - spin_ns) % 1000000000ULL;
+        while (nanosleep(&req, &rem) == -1 && errno == EINTR)
+            req = rem;
+    }
+
+    spin_until_ns(deadline);
+}